@@ -19,6 +19,8 @@
 
 #include "mainwindow.h"
 
+#include <mongochem/gui/fingerprintstore.h>
+
 #ifdef MongoChem_ENABLE_RPC
 # include <mongochem/gui/rpclistener.h>
 #endif
@@ -34,6 +36,7 @@ int main(int argc, char *argv[])
   // process command line options
   QSettings settings;
   QString testFile;
+  bool backfillFingerprints = false;
 #if QTTESTING
   bool testExit = true;
 #endif
@@ -96,6 +99,9 @@ int main(int argc, char *argv[])
       return -1;
 #endif
     }
+    else if (argument == "--backfill-fingerprints") {
+      backfillFingerprints = true;
+    }
     else if (argument == "--testing") {
     }
     else {
@@ -114,6 +120,16 @@ int main(int argc, char *argv[])
   if(!settings.contains("user"))
     settings.setValue("user", "unknown");
 
+  // store fingerprints for existing molecules and exit
+  if (backfillFingerprints) {
+    long updated = MongoChem::FingerprintStore::backfill();
+    if (updated < 0) {
+      qWarning("Failed to backfill fingerprints.");
+      return -1;
+    }
+    return 0;
+  }
+
   // create main gui window
   MongoChem::MainWindow window;
   window.show();
@@ -18,14 +18,18 @@
 
 #include "mongomodel.h"
 #include "chemkit.h"
-#include "substructurefiltermodel.h"
+#include "fingerprintindex.h"
+#include "substructuresearch.h"
 
 #include "ui_mainwindow.h"
 
 #include <mongo/client/dbclient.h>
 
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtCore/QDebug>
+#include <QtCore/QEventLoop>
 #include <QtCore/QSettings>
+#include <QtCore/QTimer>
 #include <QtWidgets/QFileDialog>
 #include <QtGui/QPainter>
 #include <QtWidgets/QStyledItemDelegate>
@@ -33,6 +37,7 @@
 #include <QtGui/QAbstractTextDocumentLayout>
 #include <QtWidgets/QDockWidget>
 #include <QtWidgets/QMessageBox>
+#include <QtWidgets/QStatusBar>
 
 #include <vtkAnnotationLink.h>
 #include <vtkEventQtSlotConnect.h>
@@ -241,6 +246,28 @@ protected:
 };
 #endif // QTTESTING
 
+// The interval (in milliseconds) between updates of the similarity search
+// progress in the status bar.
+const int similarityProgressInterval = 250;
+
+// Searches the collection for the molecules most similar to @p ref.
+std::vector<MongoChem::MoleculeRef>
+findSimilarMolecules(const MongoChem::MoleculeRef &ref, size_t count)
+{
+  return MongoChem::ChemKit::similarMolecules(ref, count);
+}
+
+// Searches the collection for the molecules most similar to the molecule
+// with @p identifier in @p format.
+std::vector<MongoChem::MoleculeRef>
+findSimilarIdentifiers(const std::string &identifier,
+                       const std::string &format,
+                       size_t count)
+{
+  return MongoChem::ChemKit::similarMolecules(
+    MongoChem::ChemKit::createMolecule(identifier, format), count);
+}
+
 } // end anonymous namespace
 
 namespace MongoChem {
@@ -289,7 +316,11 @@ MainWindow::loadFactoryPlugins(QMenu *menu, const char *slot)
 
 MainWindow::MainWindow()
   : m_db(0),
-    m_model(0)
+    m_model(0),
+    m_substructureSearch(0),
+    m_similarityWatcher(0),
+    m_similarityProgressTimer(0),
+    m_similaritySearchCanceled(false)
 {
   m_ui = new Ui::MainWindow;
   m_ui->setupUi(this);
@@ -307,6 +338,19 @@ MainWindow::MainWindow()
   addDockWidget(Qt::TopDockWidgetArea, queryDockWidget);
   queryDockWidget->hide();
 
+  m_substructureSearch = new SubstructureSearch(this);
+  connect(m_substructureSearch, SIGNAL(progress(int, int)),
+          SLOT(updateSubstructureSearchProgress(int, int)));
+
+  // the similarity search loads the fingerprint index on a worker thread
+  m_similarityWatcher = new QFutureWatcher<std::vector<MoleculeRef> >(this);
+  connect(m_similarityWatcher, SIGNAL(finished()),
+          SLOT(similarMoleculesFound()));
+  m_similarityProgressTimer = new QTimer(this);
+  m_similarityProgressTimer->setInterval(similarityProgressInterval);
+  connect(m_similarityProgressTimer, SIGNAL(timeout()),
+          SLOT(updateSimilaritySearchProgress()));
+
   connect(m_ui->actionAbout, SIGNAL(triggered()), SLOT(showAboutDialog()));
 
 #ifdef QTTESTING
@@ -412,6 +456,7 @@ void MainWindow::performBatchCalculation()
 
 MainWindow::~MainWindow()
 {
+  cancelSearches();
   delete m_model;
   m_model = 0;
   delete m_ui;
@@ -425,6 +470,7 @@ MainWindow::~MainWindow()
 void MainWindow::connectToDatabase()
 {
   // remove current model
+  cancelSearches();
   delete m_model;
   m_model = 0;
   m_ui->tableView->setModel(m_model);
@@ -443,6 +489,10 @@ void MainWindow::connectToDatabase()
 
   // setup model
   m_model = new MongoModel(m_db, this);
+  connect(m_substructureSearch,
+          SIGNAL(moleculesFound(std::vector<MongoChem::MoleculeRef>)),
+          m_model, SLOT(addMolecules(std::vector<MongoChem::MoleculeRef>)));
+  connect(m_model, SIGNAL(queryReset()), SLOT(cancelSearches()));
   m_ui->tableView->setModel(m_model);
   m_ui->tableView->resizeColumnsToContents();
 }
@@ -518,25 +568,25 @@ void MainWindow::clearDatabase()
 
 void MainWindow::runQuery()
 {
+  cancelSearches();
+
   // Delete the old model if it is not the main model (e.g. it is a filter model
-  // such as SubstructureFilterModel).
+  // such as SelectionFilterModel).
   if (m_ui->tableView->model() != m_model)
     m_ui->tableView->model()->deleteLater();
 
   m_ui->tableView->setModel(0);
 
-  // Update the UI to show an empty table while the query is performed.
-  qApp->processEvents();
-
-  m_model->setQuery(m_queryWidget->query());
-
   if (m_queryWidget->field() == "Structure") {
-    SubstructureFilterModel *model = new SubstructureFilterModel;
-    model->setIdentifier(m_queryWidget->value());
-    model->setSourceModel(m_model);
-    m_ui->tableView->setModel(model);
+    // The whole collection is searched in the background. Matching molecules
+    // are added to the model as they are found.
+    m_model->setMolecules(std::vector<MoleculeRef>());
+    m_ui->tableView->setModel(m_model);
+    m_substructureSearch->start(m_queryWidget->value(),
+                                m_queryWidget->mode() == "is");
   }
   else {
+    m_model->setQuery(m_queryWidget->query());
     m_ui->tableView->setModel(m_model);
   }
 
@@ -545,14 +595,13 @@ void MainWindow::runQuery()
 
 void MainWindow::resetQuery()
 {
+  cancelSearches();
+
   if (m_ui->tableView->model() != m_model)
     m_ui->tableView->model()->deleteLater();
 
   m_ui->tableView->setModel(0);
 
-  // Update the UI to show an empty table while the query is performed.
-  qApp->processEvents();
-
   m_model->setQuery(mongo::Query());
 
   m_ui->tableView->setModel(m_model);
@@ -561,36 +610,75 @@ void MainWindow::resetQuery()
 
 void MainWindow::showSimilarMolecules(const MoleculeRef &ref, size_t count)
 {
+  // search the entire collection for similar molecules
+  startSimilaritySearch(QtConcurrent::run(findSimilarMolecules, ref, count));
+}
+
+void MainWindow::showSimilarMolecules(const string &id, const string &format,
+                                      size_t count)
+{
+  // search the entire collection for similar molecules
+  startSimilaritySearch(QtConcurrent::run(findSimilarIdentifiers,
+                                          id, format, count));
+}
+
+void MainWindow::startSimilaritySearch(
+  const QFuture<std::vector<MoleculeRef> > &future)
+{
+  cancelSearches();
   m_ui->tableView->setModel(0);
-  qApp->processEvents();
 
-  std::vector<MoleculeRef> similarMolecules =
-      ChemKit::similarMolecules(ref, m_model->molecules(), count);
+  m_similaritySearchCanceled = false;
+  m_similarityWatcher->setFuture(future);
+  m_similarityProgressTimer->start();
+  statusBar()->showMessage(tr("Searching for similar molecules"));
+}
+
+void MainWindow::similarMoleculesFound()
+{
+  m_similarityProgressTimer->stop();
+  if (m_similaritySearchCanceled)
+    return;
+
+  statusBar()->clearMessage();
 
   // set the similar molecules to show in the model
-  m_model->setMolecules(similarMolecules);
+  m_model->setMolecules(m_similarityWatcher->result());
 
   // update the view for the updated model
   m_ui->tableView->setModel(m_model);
   m_ui->tableView->resizeColumnsToContents();
 }
 
-void MainWindow::showSimilarMolecules(const string &id, const string &format,
-                                      size_t count)
+void MainWindow::updateSimilaritySearchProgress()
 {
-  m_ui->tableView->setModel(0);
-  qApp->processEvents();
+  // the first search loads the fingerprint of every molecule
+  int total = 0;
+  int loaded = FingerprintIndex::instance()->refreshProgress(&total);
+  if (total > 0)
+    statusBar()->showMessage(tr("Loaded %1 of %2 fingerprints")
+                             .arg(loaded).arg(total));
+}
 
-  std::vector<MoleculeRef> similarMolecules =
-      ChemKit::similarMolecules(ChemKit::createMolecule(id, format),
-                                m_model->molecules(), count);
+void MainWindow::cancelSearches()
+{
+  m_substructureSearch->cancel();
 
-  // set the similar molecules to show in the model
-  m_model->setMolecules(similarMolecules);
+  // the similarity search cannot be stopped, its results are ignored
+  if (m_similarityWatcher->isRunning()) {
+    m_similaritySearchCanceled = true;
+    m_similarityProgressTimer->stop();
+    statusBar()->clearMessage();
+  }
+}
 
-  // update the view for the updated model
-  m_ui->tableView->setModel(m_model);
-  m_ui->tableView->resizeColumnsToContents();
+void MainWindow::updateSubstructureSearchProgress(int value, int maximum)
+{
+  if (value < maximum)
+    statusBar()->showMessage(tr("Searched %1 of %2 candidates")
+                             .arg(value).arg(maximum));
+  else
+    statusBar()->clearMessage();
 }
 
 void MainWindow::setShowSelectedMolecules(bool enabled)
@@ -607,15 +695,24 @@ void MainWindow::setShowSelectedMolecules(bool enabled)
     QueryProgressDialog progressDialog(this);
 
     while (m_model->hasMoreData()) {
-      // update ui
-      qApp->processEvents();
+      // load next batch of data
+      if (!m_model->isLoading())
+        m_model->loadMoreData();
+
+      // the batch may have been loaded from the rows read ahead, otherwise
+      // update ui and wait for it to arrive from the server
+      if (m_model->isLoading() && m_model->hasMoreData()) {
+        QEventLoop loop;
+        connect(m_model, SIGNAL(dataLoaded()), &loop, SLOT(quit()));
+        loop.exec();
+      }
+      else {
+        qApp->processEvents();
+      }
 
       // stop loading data if the user clicked cancel
       if (progressDialog.wasCanceled())
         break;
-
-      // load next batch of data
-      m_model->loadMoreData();
     }
 
     SelectionFilterModel *filterModel = new SelectionFilterModel(this);
@@ -18,13 +18,19 @@
 #define MAINWINDOW_H
 
 #include <QtWidgets/QMainWindow>
+#include <QtCore/QFutureWatcher>
 #include <QtCore/QMap>
 
+#include <string>
+#include <vector>
+
 #include <vtkNew.h>
 
 class vtkAnnotationLink;
 class vtkEventQtSlotConnect;
 
+class QTimer;
+
 namespace mongo {
 class DBClientConnection;
 }
@@ -49,6 +55,7 @@ namespace MongoChem {
 class MoleculeRef;
 class MongoModel;
 class QuickQueryWidget;
+class SubstructureSearch;
 
 class MainWindow : public QMainWindow
 {
@@ -103,10 +110,18 @@ private:
   /** Connects to MongoDB */
   void connectToDatabase();
 
+  /** Shows the results of @p future when the similarity search finishes. */
+  void startSimilaritySearch(
+    const QFuture<std::vector<MongoChem::MoleculeRef> > &future);
+
   Ui::MainWindow *m_ui;
   mongo::DBClientConnection *m_db;
   MongoModel *m_model;
   QuickQueryWidget *m_queryWidget;
+  SubstructureSearch *m_substructureSearch;
+  QFutureWatcher<std::vector<MongoChem::MoleculeRef> > *m_similarityWatcher;
+  QTimer *m_similarityProgressTimer;
+  bool m_similaritySearchCanceled;
   vtkNew<vtkAnnotationLink> m_annotationLink;
   vtkNew<vtkEventQtSlotConnect> m_annotationEventConnector;
 
@@ -151,6 +166,22 @@ private slots:
   void runQuery();
   void resetQuery();
 
+  /**
+   * Stops the substructure and similarity searches from showing results.
+   * This is also called when the model runs another query (e.g. when the
+   * table is sorted) so that search results are not mixed into its rows.
+   */
+  void cancelSearches();
+
+  /** Shows the progress of the substructure search in the status bar. */
+  void updateSubstructureSearchProgress(int value, int maximum);
+
+  /** Shows the similar molecules once the similarity search has finished. */
+  void similarMoleculesFound();
+
+  /** Shows the progress of loading the fingerprint index in the status bar. */
+  void updateSimilaritySearchProgress();
+
   void setShowSelectedMolecules(bool enabled);
   void updateSelectionFilterModel();
 
@@ -211,11 +211,18 @@ void BatchJobManager::jobCompleted(BatchJob::BatchId id,
   }
 
   MongoDatabase *db = MongoDatabase::instance();
-  if (!db->connection()) {
+  if (!db->isConnected()) {
     qDebug() << "mongodb not connected. Cannot add batch job result.";
     return;
   }
 
+  // Use a pooled connection so that results can be stored from any thread.
+  ScopedMongoConnection conn(db->connectionPool());
+  if (!conn) {
+    qDebug() << "No mongodb connection available. Cannot add batch job result.";
+    return;
+  }
+
   MoleculeRef molRef = batch->moleculeRef(id);
   if (!molRef) {
     qDebug() << "Invalid MoleculeRef associated with batch job " << id;
@@ -252,7 +259,7 @@ void BatchJobManager::jobCompleted(BatchJob::BatchId id,
     docBuilder << "calculation" << calcObj;
 
   // Store files in db.quantum.[files|chunks]
-  mongo::GridFS gridfs(*db->connection(), db->databaseName(), "quantum");
+  mongo::GridFS gridfs(*conn.get(), db->databaseName(), "quantum");
   mongo::BSONArrayBuilder logFileBuilder;
   QDir outputDir(jobObject.value("outputDirectory").toString());
   if (outputDir.isReadable()) {
@@ -274,7 +281,7 @@ void BatchJobManager::jobCompleted(BatchJob::BatchId id,
 
   mongo::BSONObj docObj = docBuilder.obj();
 
-  db->connection()->insert(db->quantumCollectionName(), docObj);
+  conn->insert(db->quantumCollectionName(), docObj);
 }
 
 void BatchJobManager::refreshGenerators()
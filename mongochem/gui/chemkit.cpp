@@ -16,16 +16,52 @@
 
 #include "chemkit.h"
 
+#include "fingerprintindex.h"
+#include "fingerprintstore.h"
 #include "mongodatabase.h"
 
 #include <chemkit/fingerprint.h>
 #include <chemkit/molecule.h>
 
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+
 namespace MongoChem {
 
 using std::string;
 using std::vector;
 
+namespace {
+
+// Serializes calls into the InChI library.
+QMutex inchiLock;
+
+// Creates a chemkit molecule from the "inchi" and "name" fields of @p obj.
+boost::shared_ptr<chemkit::Molecule> createMoleculeFromBSONObj(
+    const mongo::BSONObj &obj)
+{
+  // get inchi formula
+  mongo::BSONElement inchiElement = obj.getField("inchi");
+  if (inchiElement.eoo())
+    return boost::make_shared<chemkit::Molecule>();
+
+  string inchi = inchiElement.str();
+
+  // Create a chemkit molecule from the InChI.
+  chemkit::Molecule *molecule = 0;
+  {
+    QMutexLocker locker(&inchiLock);
+    molecule = new chemkit::Molecule(inchi, "inchi");
+  }
+  mongo::BSONElement nameElement = obj.getField("name");
+  if (!nameElement.eoo())
+    molecule->setName(nameElement.str());
+
+  return boost::shared_ptr<chemkit::Molecule>(molecule);
+}
+
+} // end anonymous namespace
+
 ChemKit::ChemKit()
 {
 }
@@ -40,29 +76,47 @@ boost::shared_ptr<chemkit::Molecule> ChemKit::createMolecule(
   MongoDatabase *db = MongoDatabase::instance();
   mongo::BSONObj obj = db->fetchMolecule(ref);
 
-  // get inchi formula
-  mongo::BSONElement inchiElement = obj.getField("inchi");
-  if (inchiElement.eoo())
-    return boost::make_shared<chemkit::Molecule>();
+  return createMoleculeFromBSONObj(obj);
+}
 
-  string inchi = inchiElement.str();
+vector<boost::shared_ptr<chemkit::Molecule> > ChemKit::createMolecules(
+    const vector<MoleculeRef> &refs)
+{
+  // Fetch the identifiers for all of the molecules at once.
+  MongoDatabase *db = MongoDatabase::instance();
+  vector<mongo::BSONObj> objs =
+    db->fetchMolecules(refs, BSON("inchi" << 1 << "name" << 1));
 
-  // Create a chemkit molecule from the InChI.
-  chemkit::Molecule *molecule = new chemkit::Molecule(inchi, "inchi");
-  mongo::BSONElement nameElement = obj.getField("name");
-  if (!nameElement.eoo())
-    molecule->setName(nameElement.str());
+  vector<boost::shared_ptr<chemkit::Molecule> > molecules;
+  molecules.reserve(objs.size());
+  for (size_t i = 0; i < objs.size(); i++)
+    molecules.push_back(createMoleculeFromBSONObj(objs[i]));
 
-  return boost::shared_ptr<chemkit::Molecule>(molecule);
+  return molecules;
 }
 
 boost::shared_ptr<chemkit::Molecule> ChemKit::createMolecule(const string &identifier,
                                                              const string &format)
 {
+  QMutexLocker locker(format == "inchi" ? &inchiLock : 0);
   chemkit::Molecule *molecule = new chemkit::Molecule(identifier, format);
   return boost::shared_ptr<chemkit::Molecule>(molecule);
 }
 
+boost::shared_ptr<chemkit::Molecule> ChemKit::createMolecule(
+    const mongo::BSONObj &obj)
+{
+  string smiles = obj.getStringField("smiles");
+  if (!smiles.empty())
+    return createMolecule(smiles, "smiles");
+
+  string inchi = obj.getStringField("inchi");
+  if (!inchi.empty())
+    return createMolecule(inchi, "inchi");
+
+  return boost::shared_ptr<chemkit::Molecule>();
+}
+
 MoleculeRef ChemKit::importMoleculeFromIdentifier(const string &identifier,
                                                   const string &format)
 {
@@ -71,6 +125,7 @@ MoleculeRef ChemKit::importMoleculeFromIdentifier(const string &identifier,
     return MoleculeRef();
 
   // create molecule
+  QMutexLocker inchiLocker(&inchiLock);
   boost::scoped_ptr<chemkit::Molecule>
     molecule(new chemkit::Molecule(identifier, format));
 
@@ -79,6 +134,7 @@ MoleculeRef ChemKit::importMoleculeFromIdentifier(const string &identifier,
 
   // Generate an InChI key for the molecule.
   string inchikey = molecule->formula("inchikey");
+  inchiLocker.unlock();
 
   // Check if molecule already exists in the database
   MoleculeRef ref = db->findMoleculeFromInChIKey(inchikey);
@@ -87,10 +143,37 @@ MoleculeRef ChemKit::importMoleculeFromIdentifier(const string &identifier,
     return ref;
   }
 
+  // insert molecule
+  mongo::BSONObj obj = createMoleculeObject(molecule.get(), inchikey);
+  db->connection()->insert(db->moleculesCollectionName(), obj);
+
+  return MoleculeRef(obj["_id"].OID().str());
+}
+
+mongo::BSONObj ChemKit::createMoleculeObject(const string &identifier,
+                                             const string &format)
+{
+  QMutexLocker inchiLocker(&inchiLock);
+  boost::scoped_ptr<chemkit::Molecule>
+    molecule(new chemkit::Molecule(identifier, format));
+  if (molecule->isEmpty())
+    return mongo::BSONObj();
+
+  string inchikey = molecule->formula("inchikey");
+  inchiLocker.unlock();
+
+  return createMoleculeObject(molecule.get(), inchikey);
+}
+
+mongo::BSONObj ChemKit::createMoleculeObject(const chemkit::Molecule *molecule,
+                                             const string &inchikey)
+{
   // generate identifiers
+  QMutexLocker inchiLocker(&inchiLock);
   string formula = molecule->formula();
   string inchi = molecule->formula("inchi");
   string smiles = molecule->formula("smiles");
+  inchiLocker.unlock();
 
   // generate descriptors
   double mass = molecule->mass();
@@ -111,11 +194,41 @@ MoleculeRef ChemKit::importMoleculeFromIdentifier(const string &identifier,
   b << "mass" << mass;
   b << "atomCount" << atomCount;
   b << "heavyAtomCount" << heavyAtomCount;
+  b << "fingerprints" << FingerprintStore::createFingerprints(molecule);
 
-  // insert molecule
-  db->connection()->insert(db->moleculesCollectionName(), b.obj());
+  return b.obj();
+}
 
-  return MoleculeRef(id.str());
+vector<MoleculeRef> ChemKit::similarMolecules(const MoleculeRef &ref,
+                                              size_t count)
+{
+  return similarMolecules(createMolecule(ref), count);
+}
+
+vector<MoleculeRef> ChemKit::similarMolecules(const boost::shared_ptr<chemkit::Molecule> &molecule,
+                                              size_t count)
+{
+  vector<MoleculeRef> molecules;
+  if (!molecule)
+    return molecules;
+
+  // Create an fp2 fingerprint for the molecule given.
+  boost::scoped_ptr<chemkit::Fingerprint>
+      fp2(chemkit::Fingerprint::create("fp2"));
+  if (!fp2)
+    return molecules;
+
+  // Load any molecules added since the index was last used.
+  FingerprintIndex *index = FingerprintIndex::instance();
+  index->refresh();
+
+  vector<FingerprintIndex::Match> matches =
+    index->search(fp2->value(molecule.get()), count);
+
+  for (size_t i = 0; i < matches.size(); ++i)
+    molecules.push_back(matches[i].molecule);
+
+  return molecules;
 }
 
 vector<MoleculeRef> ChemKit::similarMolecules(const MoleculeRef &ref,
@@ -139,75 +252,27 @@ vector<MoleculeRef> ChemKit::similarMolecules(const boost::shared_ptr<chemkit::M
   if (!fp2)
     return molecules;
 
-  // Calculate the fingerprint for the input molecule.
-  chemkit::Bitset fingerprint = fp2->value(molecule.get());
-
-  // Get access to the database.
-  MongoDatabase *db = MongoDatabase::instance();
-
-  // Calculate the tanimoto similarity value for each molecule.
-  std::map<float, MoleculeRef> sorted;
-  for (size_t i = 0; i < refs.size(); ++i) {
-    float similarity = 0;
-    mongo::BSONObj obj = db->fetchMolecule(refs[i]);
-    mongo::BSONElement element = obj.getField("fp2_fingerprint");
-    if (element.ok()) {
-      // There is already a fingerprint stored for the molecule so load and use
-      // that for calculating the similarity value.
-      int len = 0;
-      const char *binData = element.binData(len);
-      vector<size_t> binDataBlockVector(fingerprint.num_blocks());
-
-      memcpy(&binDataBlockVector[0],
-             binData,
-             binDataBlockVector.size() * sizeof(size_t));
-
-      chemkit::Bitset fingerprintValue(binDataBlockVector.begin(),
-                                       binDataBlockVector.end());
-
-      // Ensure that the fingerprints are the same size. This is necessary
-      // because different platforms may have different padding for the bits.
-      fingerprintValue.resize(fingerprint.size());
-
-      similarity =
-        static_cast<float>(
-          chemkit::Fingerprint::tanimotoCoefficient(fingerprint,
-                                                    fingerprintValue));
-    }
-    else {
-      // There is not a fingerprint calculated for the molecule so create the
-      // molecule and calculate the fingerprint directly.
-      boost::shared_ptr<chemkit::Molecule> otherMolecule = createMolecule(refs[i]);
-
-      if (otherMolecule) {
-        similarity =
-          static_cast<float>(
-            chemkit::Fingerprint::tanimotoCoefficient(fingerprint,
-                                                      fp2->value(
-                                                        otherMolecule.get())));
-      }
-      else {
-        similarity = 0.0f;
-      }
-    }
-    sorted[similarity] = refs[i];
-  }
-
-  // Clamp number of output molecules to the number of input molecules.
-  count = std::min(count, refs.size());
+  // Load any molecules added since the index was last used.
+  FingerprintIndex *index = FingerprintIndex::instance();
+  index->refresh();
 
-  // Build a vector of refs composed of the most similar molecules.
-  molecules.resize(count);
+  vector<FingerprintIndex::Match> matches =
+    index->search(fp2->value(molecule.get()), refs, count);
 
-  std::map<float, MoleculeRef>::const_reverse_iterator iter = sorted.rbegin();
-  for (size_t i = 0; i < count; ++i)
-    molecules[i] = iter++->second;
+  for (size_t i = 0; i < matches.size(); ++i)
+    molecules.push_back(matches[i].molecule);
 
   return molecules;
 }
 
+QMutex* ChemKit::inchiMutex()
+{
+  return &inchiLock;
+}
+
 int ChemKit::heavyAtomCount(const string &identifier, const string &format)
 {
+  QMutexLocker locker(&inchiLock);
   chemkit::Molecule molecule(identifier, format);
   return static_cast<int>(molecule.atomCount() - molecule.atomCount("H"));
 }
@@ -20,10 +20,16 @@
 #include <boost/shared_ptr.hpp>
 #include <vector>
 
+class QMutex;
+
 namespace chemkit {
 class Molecule;
 }
 
+namespace mongo {
+class BSONObj;
+}
+
 namespace MongoChem {
 
 class MoleculeRef;
@@ -46,6 +52,16 @@ public:
   static boost::shared_ptr<chemkit::Molecule> createMolecule(
       const MoleculeRef &ref);
 
+  /**
+   * Creates a new molecule object for each reference in @p refs. The molecule
+   * data is fetched from the database with a batched query so this is much
+   * faster than calling createMolecule() for each reference. The returned
+   * vector has the same order as @p refs and contains an empty molecule for
+   * each reference which could not be loaded.
+   */
+  static std::vector<boost::shared_ptr<chemkit::Molecule> > createMolecules(
+      const std::vector<MoleculeRef> &refs);
+
   /**
    * @brief Create a molecule object for the supplied identifer.
    * @param identifier The line format identifier.
@@ -55,6 +71,15 @@ public:
   static boost::shared_ptr<chemkit::Molecule> createMolecule(
       const std::string &identifier, const std::string &format);
 
+  /**
+   * Creates a molecule from the "smiles" field of the molecule document
+   * @p obj, or from its "inchi" field if it has no SMILES. The SMILES is
+   * preferred as the InChI library can only be used by one thread at a
+   * time. Returns a null pointer if @p obj has neither field.
+   */
+  static boost::shared_ptr<chemkit::Molecule> createMolecule(
+      const mongo::BSONObj &obj);
+
   /**
    * Creates a new molecule for @p identifier with @p format. Returns a
    * reference to the newly created molecule.
@@ -71,6 +96,50 @@ public:
   static MoleculeRef importMoleculeFromIdentifier(const std::string &identifier,
                                                   const std::string &format);
 
+  /**
+   * Creates the document to store in the molecules collection for the
+   * molecule with @p identifier in @p format. The document includes a newly
+   * generated object id, the line formats, basic descriptors and the
+   * fingerprints. It is not inserted into the database.
+   *
+   * Returns an empty object if the molecule could not be created.
+   */
+  static mongo::BSONObj createMoleculeObject(const std::string &identifier,
+                                             const std::string &format);
+
+  /**
+   * Creates the document to store in the molecules collection for
+   * @p molecule, whose InChIKey is @p inchikey.
+   */
+  static mongo::BSONObj createMoleculeObject(const chemkit::Molecule *molecule,
+                                             const std::string &inchikey);
+
+  /**
+   * @brief Find the molecules in the database most similar to @p ref up to a
+   * maximum of @p count.
+   * @param ref The reference to the target molecule.
+   * @param count The maximum number of results to return.
+   * @return A vector of similar molecules, in order of similarity (as
+   * determined by the tanimoto similarity value).
+   *
+   * The search is performed with the FingerprintIndex for the molecules
+   * collection. The first search loads the index, which can take a long time
+   * for a large collection, so this should be called from a worker thread.
+   */
+  static std::vector<MoleculeRef> similarMolecules(const MoleculeRef &ref,
+                                                   size_t count);
+
+  /**
+   * @brief Find the molecules in the database most similar to @p molecule up
+   * to a maximum of @p count.
+   * @param molecule The target molecule.
+   * @param count The maximum number of results to return.
+   * @return A vector of similar molecules, in order of similarity (as
+   * determined by the tanimoto similarity value).
+   */
+  static std::vector<MoleculeRef> similarMolecules(const boost::shared_ptr<chemkit::Molecule> &molecule,
+                                                   size_t count);
+
   /**
    * @brief Find similar molecules to @p ref in @p refs up to a maximum of @p
    * count.
@@ -97,6 +166,14 @@ public:
                                                    const std::vector<MoleculeRef> &refs,
                                                    size_t count);
 
+  /**
+   * Returns the mutex which serializes the use of the InChI library. The
+   * InChI library is not thread-safe, so this must be held whenever a
+   * molecule is read from or converted to an InChI. The methods in this
+   * class lock it themselves.
+   */
+  static QMutex* inchiMutex();
+
   /**
    * @brief Obtain the heavy atom count for the supplied structure.
    * @param identifier The line format identifier.
@@ -0,0 +1,426 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "csvreader.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtCore/QThread>
+
+#include <algorithm>
+#include <limits>
+
+namespace MongoChem {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// The default number of bytes read by CsvReader::readBlock().
+const size_t defaultBlockSize = 16 * 1024 * 1024;
+
+// The minimum number of bytes read from the file at once when it can not be
+// mapped.
+const qint64 minimumReadSize = 1024 * 1024;
+
+// The minimum number of bytes parsed by a single thread.
+const size_t minimumChunkSize = 256 * 1024;
+
+bool isBlankRecord(const vector<string> &fields)
+{
+  return fields.size() == 1 && fields[0].empty();
+}
+
+double toNumber(const string &field)
+{
+  bool ok = false;
+  double value =
+    QByteArray::fromRawData(field.data(), static_cast<int>(field.size()))
+      .toDouble(&ok);
+  return ok ? value : std::numeric_limits<double>::quiet_NaN();
+}
+
+void resetBlock(CsvReader::Block &block,
+                const vector<CsvReader::ColumnType> &types)
+{
+  block.rowCount = 0;
+  block.strings.assign(types.size(), vector<string>());
+  block.numbers.assign(types.size(), vector<double>());
+}
+
+void appendRecord(CsvReader::Block &block,
+                  const vector<string> &fields,
+                  const vector<CsvReader::ColumnType> &types)
+{
+  static const string empty;
+
+  for (size_t i = 0; i < types.size(); i++) {
+    const string &field = i < fields.size() ? fields[i] : empty;
+
+    if (types[i] == CsvReader::String)
+      block.strings[i].push_back(field);
+    else if (types[i] == CsvReader::Number)
+      block.numbers[i].push_back(toNumber(field));
+  }
+
+  block.rowCount++;
+}
+
+// A range of whole records to be parsed on a single thread.
+struct ParseTask
+{
+  const char *begin;
+  const char *end;
+  char delimiter;
+  const vector<CsvReader::ColumnType> *types;
+  CsvReader::Block block;
+};
+
+struct RunParseTask
+{
+  void operator()(ParseTask &task) const
+  {
+    resetBlock(task.block, *task.types);
+
+    vector<string> fields;
+    const char *position = task.begin;
+    while (position < task.end) {
+      position =
+        CsvReader::parseRecord(position, task.end, task.delimiter, fields);
+      if (!isBlankRecord(fields))
+        appendRecord(task.block, fields, *task.types);
+    }
+  }
+};
+
+} // end anonymous namespace
+
+CsvReader::CsvReader()
+  : m_delimiter(','),
+    m_blockSize(defaultBlockSize),
+    m_map(0),
+    m_data(0),
+    m_size(0),
+    m_position(0),
+    m_atEndOfFile(true)
+{
+}
+
+CsvReader::~CsvReader()
+{
+  close();
+}
+
+bool CsvReader::open(const QString &fileName)
+{
+  close();
+
+  m_file.setFileName(fileName);
+  if (!m_file.open(QFile::ReadOnly)) {
+    m_errorString = m_file.errorString();
+    return false;
+  }
+
+  // map the entire file if possible. this fails for empty files, sequential
+  // devices and files too large for the address space, which are read in
+  // blocks instead.
+  if (m_file.size() > 0 && !m_file.isSequential())
+    m_map = m_file.map(0, m_file.size());
+
+  if (m_map) {
+    m_data = reinterpret_cast<const char *>(m_map);
+    m_size = static_cast<size_t>(m_file.size());
+    m_atEndOfFile = true;
+  }
+  else {
+    m_atEndOfFile = false;
+  }
+
+  return true;
+}
+
+void CsvReader::close()
+{
+  if (m_map)
+    m_file.unmap(m_map);
+  m_map = 0;
+  m_file.close();
+  m_buffer.clear();
+  m_data = 0;
+  m_size = 0;
+  m_position = 0;
+  m_atEndOfFile = true;
+}
+
+bool CsvReader::isOpen() const
+{
+  return m_file.isOpen();
+}
+
+bool CsvReader::atEnd() const
+{
+  return m_atEndOfFile && m_position >= m_size;
+}
+
+QString CsvReader::errorString() const
+{
+  return m_errorString;
+}
+
+void CsvReader::setDelimiter(char delimiter_)
+{
+  m_delimiter = delimiter_;
+}
+
+char CsvReader::delimiter() const
+{
+  return m_delimiter;
+}
+
+void CsvReader::setColumnTypes(const vector<ColumnType> &types)
+{
+  m_columnTypes = types;
+}
+
+vector<CsvReader::ColumnType> CsvReader::columnTypes() const
+{
+  return m_columnTypes;
+}
+
+void CsvReader::setBlockSize(size_t bytes)
+{
+  m_blockSize = std::max(bytes, static_cast<size_t>(1));
+}
+
+size_t CsvReader::blockSize() const
+{
+  return m_blockSize;
+}
+
+bool CsvReader::readRecord(vector<string> &fields)
+{
+  fields.clear();
+
+  size_t wanted = static_cast<size_t>(minimumReadSize);
+  for (;;) {
+    fill(wanted);
+    if (m_position >= m_size)
+      return false;
+
+    const char *begin = m_data + m_position;
+    const char *end = m_data + m_size;
+
+    const char *recordEnd = findRecordEnd(begin, end);
+    if (!recordEnd) {
+      // the record is longer than the data read so far
+      wanted = 2 * (m_size - m_position);
+      continue;
+    }
+
+    parseRecord(begin, recordEnd, m_delimiter, fields);
+    m_position = static_cast<size_t>(recordEnd - m_data);
+
+    if (!isBlankRecord(fields))
+      return true;
+  }
+}
+
+bool CsvReader::readBlock(Block &block)
+{
+  resetBlock(block, m_columnTypes);
+
+  size_t threadCount = static_cast<size_t>(qMax(1, QThread::idealThreadCount()));
+  size_t chunkSize = std::max(m_blockSize / threadCount, minimumChunkSize);
+
+  // find the boundaries of the records to parse on each thread. this only
+  // needs to track whether each character is quoted so it is much faster
+  // than parsing.
+  vector<const char *> boundaries;
+  size_t wanted = m_blockSize;
+  for (;;) {
+    fill(wanted);
+    if (m_position >= m_size)
+      return false;
+
+    const char *begin = m_data + m_position;
+    const char *end = m_data + m_size;
+
+    boundaries.clear();
+    boundaries.push_back(begin);
+
+    const char *blockEnd = 0;
+    const char *nextChunk = begin + chunkSize;
+    bool quoted = false;
+    for (const char *c = begin; c < end; ++c) {
+      if (*c == '"') {
+        quoted = !quoted;
+      }
+      else if (*c == '\n' && !quoted) {
+        blockEnd = c + 1;
+        if (static_cast<size_t>(blockEnd - begin) >= m_blockSize)
+          break;
+        if (blockEnd >= nextChunk) {
+          boundaries.push_back(blockEnd);
+          nextChunk = blockEnd + chunkSize;
+        }
+      }
+    }
+
+    // the last record in the file may not end with a line break
+    if (m_atEndOfFile && (!blockEnd || static_cast<size_t>(blockEnd - begin) <
+                                       m_blockSize))
+      blockEnd = end;
+
+    if (blockEnd) {
+      if (boundaries.back() != blockEnd)
+        boundaries.push_back(blockEnd);
+      m_position = static_cast<size_t>(blockEnd - m_data);
+      break;
+    }
+
+    // a single record is longer than the data read so far
+    wanted = 2 * (m_size - m_position);
+  }
+
+  vector<ParseTask> tasks(boundaries.size() - 1);
+  for (size_t i = 0; i < tasks.size(); i++) {
+    tasks[i].begin = boundaries[i];
+    tasks[i].end = boundaries[i + 1];
+    tasks[i].delimiter = m_delimiter;
+    tasks[i].types = &m_columnTypes;
+  }
+
+  if (tasks.size() == 1)
+    RunParseTask()(tasks[0]);
+  else
+    QtConcurrent::blockingMap(tasks, RunParseTask());
+
+  // join the chunks in order
+  for (size_t i = 0; i < tasks.size(); i++) {
+    Block &chunk = tasks[i].block;
+    for (size_t column = 0; column < m_columnTypes.size(); column++) {
+      block.strings[column].insert(block.strings[column].end(),
+                                   chunk.strings[column].begin(),
+                                   chunk.strings[column].end());
+      block.numbers[column].insert(block.numbers[column].end(),
+                                   chunk.numbers[column].begin(),
+                                   chunk.numbers[column].end());
+    }
+    block.rowCount += chunk.rowCount;
+  }
+
+  // the block may contain only blank records
+  if (block.rowCount == 0)
+    return readBlock(block);
+
+  return true;
+}
+
+const char* CsvReader::parseRecord(const char *begin,
+                                   const char *end,
+                                   char delimiter_,
+                                   vector<string> &fields)
+{
+  fields.clear();
+
+  string field;
+  bool quoted = false;
+  const char *c = begin;
+  while (c < end) {
+    char ch = *c++;
+
+    if (quoted) {
+      if (ch == '"') {
+        // a doubled quote is an escaped quote, otherwise the quotes end
+        if (c < end && *c == '"') {
+          field += '"';
+          ++c;
+        }
+        else {
+          quoted = false;
+        }
+      }
+      else {
+        field += ch;
+      }
+    }
+    else if (ch == '"') {
+      quoted = true;
+    }
+    else if (ch == delimiter_) {
+      fields.push_back(field);
+      field.clear();
+    }
+    else if (ch == '\n') {
+      break;
+    }
+    else if (ch == '\r' && (c == end || *c == '\n')) {
+      // part of a "\r\n" line break
+    }
+    else {
+      field += ch;
+    }
+  }
+
+  fields.push_back(field);
+
+  return c;
+}
+
+void CsvReader::fill(size_t bytes)
+{
+  if (m_map || m_atEndOfFile || m_size - m_position >= bytes)
+    return;
+
+  // drop the data which has been read
+  m_buffer.remove(0, static_cast<int>(m_position));
+  m_position = 0;
+
+  while (static_cast<size_t>(m_buffer.size()) < bytes) {
+    qint64 readSize =
+      std::max(static_cast<qint64>(bytes - m_buffer.size()), minimumReadSize);
+    QByteArray data = m_file.read(readSize);
+    if (data.isEmpty()) {
+      if (m_file.error() != QFile::NoError)
+        m_errorString = m_file.errorString();
+      m_atEndOfFile = true;
+      break;
+    }
+    m_buffer.append(data);
+  }
+
+  if (m_file.atEnd())
+    m_atEndOfFile = true;
+
+  m_data = m_buffer.constData();
+  m_size = static_cast<size_t>(m_buffer.size());
+}
+
+const char* CsvReader::findRecordEnd(const char *begin, const char *end) const
+{
+  bool quoted = false;
+  for (const char *c = begin; c < end; ++c) {
+    if (*c == '"')
+      quoted = !quoted;
+    else if (*c == '\n' && !quoted)
+      return c + 1;
+  }
+
+  // the last record in the file may not end with a line break
+  return m_atEndOfFile ? end : 0;
+}
+
+} // end MongoChem namespace
@@ -0,0 +1,195 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_CSVREADER_H
+#define MONGOCHEM_CSVREADER_H
+
+#include "mongochemguiexport.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFile>
+#include <QtCore/QString>
+
+#include <string>
+#include <vector>
+
+namespace MongoChem {
+
+/**
+ * @class CsvReader
+ * @brief The CsvReader class reads delimiter separated values from a file.
+ *
+ * Fields may be quoted as described in RFC 4180. Quoted fields may contain
+ * the delimiter, line breaks and quotes (escaped by doubling them). Records
+ * may end with either "\n" or "\r\n" and empty records are skipped.
+ *
+ * The file is memory mapped if possible and otherwise read in large blocks.
+ * Single records (e.g. the header) are read with readRecord(). The rest of
+ * the file is read with readBlock() which splits each block of the file at
+ * record boundaries and parses the pieces on multiple threads into columns
+ * of the types given with setColumnTypes().
+ *
+ * @code
+   CsvReader reader;
+   if (!reader.open(fileName))
+     return;
+
+   std::vector<std::string> header;
+   reader.readRecord(header);
+
+   reader.setColumnTypes(types);
+
+   CsvReader::Block block;
+   while (reader.readBlock(block)) {
+     for (size_t i = 0; i < block.rowCount; i++)
+       use(block.strings[0][i], block.numbers[1][i]);
+   }
+ * @endcode
+ */
+class MONGOCHEMGUI_EXPORT CsvReader
+{
+public:
+  /** The type a column is parsed as by readBlock(). */
+  enum ColumnType {
+    /** The column is stored in Block::strings. */
+    String,
+    /**
+     * The column is stored in Block::numbers. Fields which are empty or are
+     * not numbers are read as NaN.
+     */
+    Number,
+    /** The column is skipped. */
+    Ignored
+  };
+
+  /** A block of records read by readBlock(). */
+  struct Block
+  {
+    Block() : rowCount(0) { }
+
+    /** The number of records in the block. */
+    size_t rowCount;
+
+    /**
+     * The values for each column in the block. Only the vector matching the
+     * type of a column contains values, the others are empty.
+     */
+    std::vector<std::vector<std::string> > strings;
+    std::vector<std::vector<double> > numbers;
+  };
+
+  /** Creates a new CSV reader. */
+  CsvReader();
+
+  /** Destroys the CSV reader. */
+  ~CsvReader();
+
+  /**
+   * Opens the file @p fileName for reading. Returns @c false if the file
+   * could not be opened.
+   */
+  bool open(const QString &fileName);
+
+  /** Closes the file. */
+  void close();
+
+  /** Returns @c true if a file is open. */
+  bool isOpen() const;
+
+  /** Returns @c true if every record in the file has been read. */
+  bool atEnd() const;
+
+  /** Returns a description of the last error which occurred. */
+  QString errorString() const;
+
+  /** Sets the character separating fields to @p delimiter (default ','). */
+  void setDelimiter(char delimiter);
+
+  /** Returns the character separating fields. */
+  char delimiter() const;
+
+  /**
+   * Sets the type of each column read by readBlock(). Columns beyond the end
+   * of @p types are ignored.
+   */
+  void setColumnTypes(const std::vector<ColumnType> &types);
+
+  /** Returns the type of each column read by readBlock(). */
+  std::vector<ColumnType> columnTypes() const;
+
+  /**
+   * Sets the approximate number of bytes of the file read by each call to
+   * readBlock(). The default is 16 MB.
+   */
+  void setBlockSize(size_t bytes);
+
+  /** Returns the approximate number of bytes read by readBlock(). */
+  size_t blockSize() const;
+
+  /**
+   * Reads the next record into @p fields. Returns @c false if there are no
+   * more records.
+   */
+  bool readRecord(std::vector<std::string> &fields);
+
+  /**
+   * Reads the next block of records into @p block. Returns @c false if there
+   * are no more records.
+   */
+  bool readBlock(Block &block);
+
+  /**
+   * Parses the record in [@p begin, @p end) into @p fields. Returns a pointer
+   * past the end of the record (including its line break).
+   */
+  static const char* parseRecord(const char *begin,
+                                 const char *end,
+                                 char delimiter,
+                                 std::vector<std::string> &fields);
+
+private:
+  /**
+   * Makes at least @p bytes of unread data available (unless the end of the
+   * file is reached first).
+   */
+  void fill(size_t bytes);
+
+  /**
+   * Returns a pointer past the end of the first complete record in
+   * [@p begin, @p end), or 0 if it is not complete.
+   */
+  const char* findRecordEnd(const char *begin, const char *end) const;
+
+private:
+  QFile m_file;
+  QString m_errorString;
+  char m_delimiter;
+  std::vector<ColumnType> m_columnTypes;
+  size_t m_blockSize;
+
+  // the unread data is [m_data + m_position, m_data + m_size). it points to
+  // either the mapped file or m_buffer.
+  uchar *m_map;
+  QByteArray m_buffer;
+  const char *m_data;
+  size_t m_size;
+  size_t m_position;
+  bool m_atEndOfFile;
+};
+
+} // end MongoChem namespace
+
+#endif // MONGOCHEM_CSVREADER_H
@@ -0,0 +1,297 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "depictionservice.h"
+
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QProcess>
+#include <QtCore/QRegExp>
+#include <QtCore/QRunnable>
+#include <QtCore/QSettings>
+#include <QtCore/QStringList>
+#include <QtCore/QTemporaryDir>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+
+namespace MongoChem {
+
+namespace {
+
+// The default number of molecules converted by a single obabel process.
+const int defaultBatchSize = 100;
+
+// Returns the number in the name of a file written by "obabel -m" (e.g.
+// "depiction12.svg").
+int fileNumber(const QString &fileName)
+{
+  QRegExp number("(\\d+)\\.svg$");
+  if (number.indexIn(fileName) == -1)
+    return 0;
+  return number.cap(1).toInt();
+}
+
+bool fileNumberLessThan(const QString &a, const QString &b)
+{
+  return fileNumber(a) < fileNumber(b);
+}
+
+// Removes the background from an SVG written by obabel.
+QByteArray removeBackground(const QByteArray &svg)
+{
+  QByteArray result;
+  foreach (const QByteArray &line, svg.split('\n')) {
+    if (line.startsWith("<rect"))
+      continue;
+
+    result += line + '\n';
+  }
+  return result;
+}
+
+// The maximum time (in milliseconds) a single obabel process may run for
+// before it is killed.
+const int processTimeout = 60000;
+
+// Converts the molecules in @p identifiers (in @p format) to diagrams and
+// stores them in @p svgs, which has one (possibly empty) entry for each
+// molecule. Returns false if some molecules failed to convert, in which case
+// the diagrams cannot be matched to the molecules and none are stored.
+// @p timedOut is set if obabel was killed for running too long.
+bool depictBatch(const QList<QByteArray> &identifiers,
+                 const QByteArray &format,
+                 QVector<QByteArray> &svgs,
+                 bool &timedOut)
+{
+  svgs = QVector<QByteArray>(identifiers.size());
+  timedOut = false;
+
+  QByteArray input;
+  foreach (const QByteArray &identifier, identifiers)
+    input += identifier + '\n';
+
+  // obabel writes each diagram to a separate numbered file
+  QTemporaryDir directory;
+  if (!directory.isValid())
+    return false;
+
+  QStringList options;
+  options << "-i" << format;
+  options << "-O" << QDir(directory.path()).filePath("depiction.svg");
+  options << "-m"; // one file per molecule
+  options << "-xC"; // no terminal carbons lines
+  options << "-xd"; // no molecule titles
+
+  QProcess process;
+  process.start("obabel", options);
+  if (!process.waitForStarted())
+    return false;
+
+  process.write(input);
+  process.closeWriteChannel();
+  if (!process.waitForFinished(processTimeout)) {
+    process.kill();
+    process.waitForFinished();
+    timedOut = true;
+    return false;
+  }
+
+  QDir outputDirectory(directory.path());
+  QStringList fileNames =
+    outputDirectory.entryList(QStringList() << "*.svg", QDir::Files);
+  if (fileNames.size() != identifiers.size())
+    return false;
+
+  qSort(fileNames.begin(), fileNames.end(), fileNumberLessThan);
+  for (int i = 0; i < fileNames.size(); i++) {
+    QFile file(outputDirectory.filePath(fileNames[i]));
+    if (file.open(QFile::ReadOnly))
+      svgs[i] = removeBackground(file.readAll());
+  }
+
+  return true;
+}
+
+// Converts the molecules in @p identifiers like depictBatch(). If some of
+// them fail to convert the batch is split in half and each half is tried
+// again, so each molecule which fails only costs a few more processes.
+// Returns false if obabel was killed for running too long, in which case
+// the molecules which have not been converted yet are left empty.
+bool depictSplitting(const QList<QByteArray> &identifiers,
+                     const QByteArray &format,
+                     QVector<QByteArray> &svgs)
+{
+  bool timedOut = false;
+  if (depictBatch(identifiers, format, svgs, timedOut))
+    return true;
+  if (timedOut)
+    return false;
+  if (identifiers.size() < 2)
+    return true;
+
+  int half = identifiers.size() / 2;
+  QVector<QByteArray> firstHalf;
+  QVector<QByteArray> secondHalf(identifiers.size() - half);
+  bool finished = depictSplitting(identifiers.mid(0, half), format, firstHalf);
+  if (finished)
+    finished = depictSplitting(identifiers.mid(half), format, secondHalf);
+
+  for (int i = 0; i < firstHalf.size(); i++)
+    svgs[i] = firstHalf[i];
+  for (int i = 0; i < secondHalf.size(); i++)
+    svgs[half + i] = secondHalf[i];
+
+  return finished;
+}
+
+} // end anonymous namespace
+
+class DepictionService::Worker : public QRunnable
+{
+public:
+  explicit Worker(DepictionService *service)
+    : m_service(service)
+  {
+  }
+
+  void run()
+  {
+    for (;;) {
+      QList<Request> batch = m_service->takeBatch();
+      if (batch.isEmpty())
+        break;
+
+      DepictionService::run(batch);
+    }
+  }
+
+private:
+  DepictionService *m_service;
+};
+
+DepictionService* DepictionService::instance()
+{
+  static DepictionService service;
+  return &service;
+}
+
+DepictionService::DepictionService()
+  : m_batchSize(defaultBatchSize),
+    m_workerCount(0)
+{
+  QSettings settings;
+  setMaximumWorkerCount(
+    settings.value("depictionWorkerCount",
+                   qMax(1, QThread::idealThreadCount())).toInt());
+}
+
+DepictionService::~DepictionService()
+{
+  // the workers use the queue until they finish
+  m_threadPool.waitForDone();
+}
+
+QFuture<QByteArray> DepictionService::depict(const QByteArray &identifier,
+                                             const QByteArray &format)
+{
+  Request request;
+  request.identifier = identifier.trimmed();
+  request.format = format;
+  request.result.reportStarted();
+  QFuture<QByteArray> future = request.result.future();
+
+  QMutexLocker locker(&m_mutex);
+  m_queue.append(request);
+
+  // each worker takes batches from the queue until it is empty so a new one
+  // is only started if there are less than the maximum
+  if (m_workerCount < m_threadPool.maxThreadCount()) {
+    m_workerCount++;
+    m_threadPool.start(new Worker(this));
+  }
+
+  return future;
+}
+
+void DepictionService::setMaximumWorkerCount(int count)
+{
+  m_threadPool.setMaxThreadCount(qMax(1, count));
+}
+
+int DepictionService::maximumWorkerCount() const
+{
+  return m_threadPool.maxThreadCount();
+}
+
+void DepictionService::setBatchSize(int count)
+{
+  QMutexLocker locker(&m_mutex);
+  m_batchSize = qMax(1, count);
+}
+
+int DepictionService::batchSize() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_batchSize;
+}
+
+QList<DepictionService::Request> DepictionService::takeBatch()
+{
+  QMutexLocker locker(&m_mutex);
+
+  QList<Request> batch;
+  if (m_queue.isEmpty()) {
+    // the worker finishes
+    m_workerCount--;
+    return batch;
+  }
+
+  // obabel reads a single input format per process
+  QByteArray format = m_queue.first().format;
+  QList<Request>::iterator iter = m_queue.begin();
+  while (iter != m_queue.end() && batch.size() < m_batchSize) {
+    if (iter->format == format) {
+      batch.append(*iter);
+      iter = m_queue.erase(iter);
+    }
+    else {
+      ++iter;
+    }
+  }
+
+  return batch;
+}
+
+void DepictionService::run(QList<Request> &batch)
+{
+  QList<QByteArray> identifiers;
+  foreach (const Request &request, batch)
+    identifiers.append(request.identifier);
+  QByteArray format = batch.first().format;
+
+  // obabel skips the molecules which fail to convert so the diagrams can no
+  // longer be matched up. the batch is split until the failures are isolated.
+  QVector<QByteArray> svgs;
+  depictSplitting(identifiers, format, svgs);
+
+  for (int i = 0; i < batch.size(); i++) {
+    batch[i].result.reportResult(svgs[i]);
+    batch[i].result.reportFinished();
+  }
+}
+
+} // end MongoChem namespace
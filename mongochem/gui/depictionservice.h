@@ -0,0 +1,119 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_DEPICTIONSERVICE_H
+#define MONGOCHEM_DEPICTIONSERVICE_H
+
+#include "mongochemguiexport.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QFuture>
+#include <QtCore/QFutureInterface>
+#include <QtCore/QList>
+#include <QtCore/QMutex>
+#include <QtCore/QThreadPool>
+
+namespace MongoChem {
+
+/**
+ * @class DepictionService
+ * @brief The DepictionService class generates 2D SVG diagrams for molecules
+ * in the background.
+ *
+ * Diagrams are generated with the obabel program. Rather than starting one
+ * process per molecule, requests are queued and each worker converts all of
+ * the queued molecules with the same input format (up to batchSize()) with a
+ * single obabel process. Workers run on a private thread pool whose size is
+ * set with setMaximumWorkerCount(). If some molecules in a batch fail to
+ * convert, the batch is split in half and each half is converted again.
+ *
+ * Each request returns a future which receives the SVG, or an empty byte
+ * array if the diagram could not be generated (including when obabel runs
+ * for longer than a minute and is killed). Use a QFutureWatcher to be
+ * notified on the GUI thread when it is ready.
+ *
+ * All methods in this class are thread-safe.
+ */
+class MONGOCHEMGUI_EXPORT DepictionService
+{
+public:
+  /** Returns the depiction service shared by the application. */
+  static DepictionService* instance();
+
+  /** Creates a new depiction service. */
+  DepictionService();
+
+  /** Destroys the depiction service after its pending requests finish. */
+  ~DepictionService();
+
+  /**
+   * Requests the diagram for the molecule with @p identifier in @p format
+   * (any input format supported by obabel, e.g. "inchi" or "smiles").
+   */
+  QFuture<QByteArray> depict(const QByteArray &identifier,
+                             const QByteArray &format);
+
+  /**
+   * Sets the maximum number of obabel processes run at once to @p count.
+   * The default is the number of processor cores and can be changed with
+   * the "depictionWorkerCount" setting.
+   */
+  void setMaximumWorkerCount(int count);
+
+  /** Returns the maximum number of obabel processes run at once. */
+  int maximumWorkerCount() const;
+
+  /**
+   * Sets the maximum number of molecules converted by a single obabel
+   * process to @p count. The default is 100.
+   */
+  void setBatchSize(int count);
+
+  /** Returns the maximum number of molecules converted by one process. */
+  int batchSize() const;
+
+private:
+  Q_DISABLE_COPY(DepictionService)
+
+  struct Request
+  {
+    QByteArray identifier;
+    QByteArray format;
+    QFutureInterface<QByteArray> result;
+  };
+
+  class Worker;
+  friend class Worker;
+
+  /**
+   * Removes the next batch of requests from the queue. Returns an empty list
+   * if the queue is empty.
+   */
+  QList<Request> takeBatch();
+
+  /** Converts the molecules in @p batch and reports their diagrams. */
+  static void run(QList<Request> &batch);
+
+  QThreadPool m_threadPool;
+  mutable QMutex m_mutex;
+  QList<Request> m_queue;
+  int m_batchSize;
+  int m_workerCount;
+};
+
+} // end MongoChem namespace
+
+#endif // MONGOCHEM_DEPICTIONSERVICE_H
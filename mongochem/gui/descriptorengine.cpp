@@ -0,0 +1,294 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "descriptorengine.h"
+
+#include "chemkit.h"
+#include "mongodatabase.h"
+
+#include <chemkit/molecule.h>
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
+#include <limits>
+
+namespace MongoChem {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// The number of molecules fetched and computed by each task.
+const size_t computeBatchSize = 256;
+
+// A batch of molecules to be computed on a single thread.
+struct ComputeTask
+{
+  QObject *engine;
+  const QAtomicInt *currentGeneration;
+  QAtomicInt *computed;
+  int generation;
+  int moleculeCount;
+  vector<string> descriptors;
+  vector<MoleculeRef> molecules;
+
+  // the cache shared with the engine
+  QReadWriteLock *lock;
+  std::map<string, std::map<string, float> > *values;
+};
+
+struct RunComputeTask
+{
+  void operator()(ComputeTask &task) const
+  {
+    if (task.currentGeneration->load() != task.generation)
+      return;
+
+    mongo::BSONObjBuilder fieldsBuilder;
+    fieldsBuilder.append("smiles", 1);
+    fieldsBuilder.append("inchi", 1);
+    vector<string> fieldNames;
+    for (size_t i = 0; i < task.descriptors.size(); i++) {
+      fieldNames.push_back("descriptors." + task.descriptors[i]);
+      fieldsBuilder.append(fieldNames.back(), 1);
+    }
+
+    vector<mongo::BSONObj> objs =
+      MongoDatabase::instance()->fetchMolecules(task.molecules,
+                                                fieldsBuilder.obj());
+
+    size_t descriptorCount = task.descriptors.size();
+    vector<float> values(task.molecules.size() * descriptorCount,
+                         std::numeric_limits<float>::quiet_NaN());
+
+    // the molecules which could not be fetched are not cached so that they
+    // are tried again by the next computation
+    vector<char> fetched(task.molecules.size(), 0);
+
+    for (size_t i = 0; i < objs.size(); i++) {
+      if (task.currentGeneration->load() != task.generation)
+        return;
+
+      const mongo::BSONObj &obj = objs[i];
+      if (obj.isEmpty())
+        continue;
+      fetched[i] = 1;
+
+      // the molecule is only created if a descriptor is not stored
+      boost::shared_ptr<chemkit::Molecule> molecule;
+      bool created = false;
+
+      for (size_t j = 0; j < descriptorCount; j++) {
+        mongo::BSONElement stored = obj.getFieldDotted(fieldNames[j]);
+        if (stored.isNumber()) {
+          values[i * descriptorCount + j] =
+            static_cast<float>(stored.numberDouble());
+          continue;
+        }
+
+        if (!created) {
+          molecule = ChemKit::createMolecule(obj);
+          created = true;
+        }
+
+        if (molecule && !molecule->isEmpty())
+          values[i * descriptorCount + j] =
+            molecule->descriptor(task.descriptors[j]).toFloat();
+      }
+    }
+
+    {
+      QWriteLocker locker(task.lock);
+      for (size_t j = 0; j < descriptorCount; j++) {
+        std::map<string, float> &descriptorValues =
+          (*task.values)[task.descriptors[j]];
+        for (size_t i = 0; i < task.molecules.size(); i++) {
+          if (fetched[i])
+            descriptorValues[task.molecules[i].id()] =
+              values[i * descriptorCount + j];
+        }
+      }
+    }
+
+    int computed = task.computed->fetchAndAddOrdered(
+      static_cast<int>(task.molecules.size())) +
+      static_cast<int>(task.molecules.size());
+    QMetaObject::invokeMethod(task.engine, "updateProgress",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, task.generation),
+                              Q_ARG(int, computed),
+                              Q_ARG(int, task.moleculeCount));
+  }
+};
+
+} // end anonymous namespace
+
+DescriptorEngine::DescriptorEngine(QObject *parent_)
+  : QObject(parent_),
+    m_generation(0),
+    m_running(false)
+{
+}
+
+DescriptorEngine::~DescriptorEngine()
+{
+  cancel();
+
+  // wait for the workers as they post their results to this object
+  foreach (QFuture<void> future, m_futures)
+    future.waitForFinished();
+}
+
+bool DescriptorEngine::compute(const vector<MoleculeRef> &molecules,
+                               const vector<string> &descriptors)
+{
+  cancel();
+
+  // forget the computations which have already finished
+  QList<QFuture<void> > running;
+  foreach (QFuture<void> future, m_futures) {
+    if (!future.isFinished())
+      running.append(future);
+  }
+  m_futures = running;
+
+  // only the values which are missing are computed. the molecules are
+  // grouped by the descriptors they are missing so that each batch fetches
+  // and calculates the same descriptors.
+  MoleculeGroups missing;
+  for (size_t i = 0; i < molecules.size(); i++) {
+    if (!molecules[i].isValid())
+      continue;
+
+    vector<string> missingDescriptors;
+    for (size_t j = 0; j < descriptors.size(); j++) {
+      if (!contains(molecules[i], descriptors[j]))
+        missingDescriptors.push_back(descriptors[j]);
+    }
+
+    if (!missingDescriptors.empty())
+      missing[missingDescriptors].push_back(molecules[i]);
+  }
+
+  if (missing.empty())
+    return false;
+
+  int generation = m_generation.fetchAndAddOrdered(1) + 1;
+  m_running = true;
+  m_futures.append(QtConcurrent::run(this, &DescriptorEngine::run,
+                                     generation, missing));
+
+  return true;
+}
+
+void DescriptorEngine::cancel()
+{
+  m_generation.fetchAndAddOrdered(1);
+  m_running = false;
+}
+
+bool DescriptorEngine::isRunning() const
+{
+  return m_running;
+}
+
+bool DescriptorEngine::contains(const MoleculeRef &molecule,
+                                const string &descriptor) const
+{
+  QReadLocker locker(&m_lock);
+
+  DescriptorMap::const_iterator values = m_values.find(descriptor);
+  if (values == m_values.end())
+    return false;
+
+  return values->second.find(molecule.id()) != values->second.end();
+}
+
+float DescriptorEngine::value(const MoleculeRef &molecule,
+                              const string &descriptor) const
+{
+  QReadLocker locker(&m_lock);
+
+  DescriptorMap::const_iterator values = m_values.find(descriptor);
+  if (values != m_values.end()) {
+    ValueMap::const_iterator iter = values->second.find(molecule.id());
+    if (iter != values->second.end())
+      return iter->second;
+  }
+
+  return std::numeric_limits<float>::quiet_NaN();
+}
+
+void DescriptorEngine::clear()
+{
+  QWriteLocker locker(&m_lock);
+  m_values.clear();
+}
+
+void DescriptorEngine::updateProgress(int generation, int value_, int maximum)
+{
+  if (generation == m_generation.load())
+    emit progress(value_, maximum);
+}
+
+void DescriptorEngine::computeFinished(int generation)
+{
+  if (generation != m_generation.load())
+    return;
+
+  m_running = false;
+  emit finished();
+}
+
+void DescriptorEngine::run(int generation, const MoleculeGroups &molecules)
+{
+  size_t moleculeCount = 0;
+  for (MoleculeGroups::const_iterator group = molecules.begin();
+       group != molecules.end(); ++group)
+    moleculeCount += group->second.size();
+
+  QAtomicInt computed(0);
+  vector<ComputeTask> tasks;
+  for (MoleculeGroups::const_iterator group = molecules.begin();
+       group != molecules.end(); ++group) {
+    const vector<MoleculeRef> &refs = group->second;
+    for (size_t i = 0; i < refs.size(); i += computeBatchSize) {
+      ComputeTask task;
+      task.engine = this;
+      task.currentGeneration = &m_generation;
+      task.computed = &computed;
+      task.generation = generation;
+      task.moleculeCount = static_cast<int>(moleculeCount);
+      task.descriptors = group->first;
+      task.molecules.assign(refs.begin() + i,
+                            refs.begin() +
+                              std::min(refs.size(), i + computeBatchSize));
+      task.lock = &m_lock;
+      task.values = &m_values;
+      tasks.push_back(task);
+    }
+  }
+
+  QtConcurrent::blockingMap(tasks, RunComputeTask());
+
+  QMetaObject::invokeMethod(this, "computeFinished", Qt::QueuedConnection,
+                            Q_ARG(int, generation));
+}
+
+} // end MongoChem namespace
@@ -0,0 +1,125 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_DESCRIPTORENGINE_H
+#define MONGOCHEM_DESCRIPTORENGINE_H
+
+#include "mongochemguiexport.h"
+#include "moleculeref.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QFuture>
+#include <QtCore/QList>
+#include <QtCore/QObject>
+#include <QtCore/QReadWriteLock>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace MongoChem {
+
+/**
+ * @class DescriptorEngine
+ * @brief The DescriptorEngine class computes molecular descriptors for sets
+ * of molecules on worker threads.
+ *
+ * The molecules are fetched from the database in batches and each batch is
+ * processed in parallel. The values stored in the "descriptors" field of each
+ * molecule are used when present; the molecule is only created with chemkit
+ * to calculate the descriptors which are not stored.
+ *
+ * Every value is cached per molecule and descriptor, so computing the same
+ * descriptors again (or adding another descriptor for the same molecules)
+ * only calculates the values which are missing. Values for molecules which
+ * could not be fetched are not cached.
+ */
+class MONGOCHEMGUI_EXPORT DescriptorEngine : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit DescriptorEngine(QObject *parent = 0);
+  ~DescriptorEngine();
+
+  /**
+   * Starts computing each of @p descriptors for each of @p molecules. The
+   * finished() signal is emitted once every value is available from value().
+   *
+   * Returns @c false (and does not emit any signals) if every value is
+   * already cached. Any computation already running is canceled.
+   */
+  bool compute(const std::vector<MoleculeRef> &molecules,
+               const std::vector<std::string> &descriptors);
+
+  /**
+   * Cancels the current computation. The values computed so far remain in
+   * the cache. No more signals are emitted for it.
+   */
+  void cancel();
+
+  /** Returns @c true if a computation is running. */
+  bool isRunning() const;
+
+  /** Returns @c true if the value of @p descriptor for @p molecule is cached. */
+  bool contains(const MoleculeRef &molecule,
+                const std::string &descriptor) const;
+
+  /**
+   * Returns the cached value of @p descriptor for @p molecule. Returns NaN
+   * if the value is not cached or could not be calculated.
+   */
+  float value(const MoleculeRef &molecule,
+              const std::string &descriptor) const;
+
+  /** Removes every value from the cache. */
+  void clear();
+
+signals:
+  /** Emitted after each batch of @p maximum molecules is computed. */
+  void progress(int value, int maximum);
+
+  /** Emitted when the computation has finished. */
+  void finished();
+
+private slots:
+  void updateProgress(int generation, int value, int maximum);
+  void computeFinished(int generation);
+
+private:
+  // map from the descriptors missing for a set of molecules to the molecules
+  typedef std::map<std::vector<std::string>,
+                   std::vector<MoleculeRef> > MoleculeGroups;
+
+  /** Runs the computation on a worker thread. */
+  void run(int generation, const MoleculeGroups &molecules);
+
+  // map from descriptor name to the values for each molecule id
+  typedef std::map<std::string, float> ValueMap;
+  typedef std::map<std::string, ValueMap> DescriptorMap;
+
+  mutable QReadWriteLock m_lock;
+  DescriptorMap m_values;
+
+  // incremented each time a computation is started or canceled
+  QAtomicInt m_generation;
+  bool m_running;
+  QList<QFuture<void> > m_futures;
+};
+
+} // end MongoChem namespace
+
+#endif // MONGOCHEM_DESCRIPTORENGINE_H
@@ -0,0 +1,249 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "descriptortable.h"
+
+#include "mongodatabase.h"
+
+#include <vtkFloatArray.h>
+#include <vtkStringArray.h>
+#include <vtkTable.h>
+
+#include <QtCore/QDebug>
+
+#include <limits>
+#include <map>
+
+namespace MongoChem {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+std::map<string, DescriptorTable *> instances;
+
+// hard coded (for now) descriptor names
+const char *defaultDescriptors[] = {"tpsa",
+                                    "xlogp3",
+                                    "mass",
+                                    "rotatable-bonds",
+                                    "vabc"};
+const size_t defaultDescriptorCount =
+  sizeof(defaultDescriptors) / sizeof(*defaultDescriptors);
+
+// The number of molecules returned by the server per round trip.
+const int refreshBatchSize = 10000;
+
+} // end anonymous namespace
+
+DescriptorTable* DescriptorTable::instance()
+{
+  string collection = MongoDatabase::instance()->moleculesCollectionName();
+
+  DescriptorTable *&table = instances[collection];
+  if (!table) {
+    vector<string> descriptors(defaultDescriptors,
+                               defaultDescriptors + defaultDescriptorCount);
+    table = new DescriptorTable(collection, descriptors);
+  }
+
+  return table;
+}
+
+DescriptorTable::DescriptorTable(const string &collection_,
+                                 const vector<string> &descriptors_)
+  : m_collection(collection_),
+    m_descriptors(descriptors_),
+    m_ids(vtkSmartPointer<vtkStringArray>::New()),
+    m_skippedCount(0),
+    m_reloadRequested(false)
+{
+  for (size_t i = 0; i < m_descriptors.size(); i++) {
+    vtkSmartPointer<vtkFloatArray> array =
+      vtkSmartPointer<vtkFloatArray>::New();
+    array->SetName(m_descriptors[i].c_str());
+    m_columns.push_back(array);
+  }
+
+  m_ids->SetName("id");
+}
+
+DescriptorTable::~DescriptorTable()
+{
+}
+
+string DescriptorTable::collection() const
+{
+  return m_collection;
+}
+
+vector<string> DescriptorTable::descriptors() const
+{
+  return m_descriptors;
+}
+
+bool DescriptorTable::refresh()
+{
+  MongoDatabase *db = MongoDatabase::instance();
+  if (!db->isConnected())
+    return false;
+
+  ScopedMongoConnection conn(db->connectionPool());
+  if (!conn)
+    return false;
+
+  if (!m_reloadRequested) {
+    if (!load(conn))
+      return false;
+
+    // the molecules inserted with a lower id than the last one loaded and
+    // the molecules removed are missed by loading only the new ones, in
+    // which case the number of molecules no longer matches
+    unsigned long long total = 0;
+    try {
+      total = conn->count(m_collection);
+    }
+    catch (mongo::DBException &e) {
+      qDebug() << "failed to count molecules: " << e.what();
+      conn.setFailed();
+      return false;
+    }
+
+    if (total == size() + m_skippedCount)
+      return true;
+  }
+
+  // a reload which fails is started over by the next refresh
+  clear();
+  m_reloadRequested = !load(conn);
+  return !m_reloadRequested;
+}
+
+void DescriptorTable::invalidate()
+{
+  m_reloadRequested = true;
+}
+
+void DescriptorTable::clear()
+{
+  for (size_t i = 0; i < m_columns.size(); i++) {
+    m_columns[i]->Initialize();
+    m_columns[i]->Modified();
+  }
+  m_ids->Initialize();
+  m_ids->Modified();
+  m_skippedCount = 0;
+}
+
+size_t DescriptorTable::size() const
+{
+  return static_cast<size_t>(m_ids->GetNumberOfValues());
+}
+
+vtkFloatArray* DescriptorTable::column(const string &descriptor) const
+{
+  for (size_t i = 0; i < m_descriptors.size(); i++) {
+    if (m_descriptors[i] == descriptor)
+      return m_columns[i];
+  }
+
+  return 0;
+}
+
+vtkStringArray* DescriptorTable::ids() const
+{
+  return m_ids;
+}
+
+void DescriptorTable::addColumns(vtkTable *table, bool includeIds) const
+{
+  for (size_t i = 0; i < m_columns.size(); i++)
+    table->AddColumn(m_columns[i]);
+
+  if (includeIds)
+    table->AddColumn(m_ids);
+}
+
+bool DescriptorTable::load(ScopedMongoConnection &conn)
+{
+  // only load the molecules added since the last refresh
+  mongo::Query query;
+  if (size() > 0)
+    query = QUERY("_id" << mongo::GT << m_lastId);
+  else
+    m_skippedCount = 0;
+  query.sort("_id");
+
+  // only fetch the descriptor values (and the id) rather than the whole
+  // document
+  mongo::BSONObjBuilder fieldsBuilder;
+  vector<string> fieldNames;
+  for (size_t i = 0; i < m_descriptors.size(); i++) {
+    fieldNames.push_back("descriptors." + m_descriptors[i]);
+    fieldsBuilder.append(fieldNames.back(), 1);
+  }
+  mongo::BSONObj fields = fieldsBuilder.obj();
+
+  size_t previousSize = size();
+  bool ok = true;
+
+  try {
+    std::auto_ptr<mongo::DBClientCursor> cursor =
+      conn->query(m_collection, query, 0, 0, &fields, 0, refreshBatchSize);
+    if (!cursor.get()) {
+      conn.setFailed();
+      ok = false;
+    }
+
+    while (ok && cursor->more()) {
+      mongo::BSONObj obj = cursor->next();
+
+      mongo::BSONElement idElement;
+      if (!obj.getObjectID(idElement) || idElement.type() != mongo::jstOID) {
+        m_skippedCount++;
+        continue;
+      }
+
+      for (size_t i = 0; i < m_columns.size(); i++) {
+        mongo::BSONElement value = obj.getFieldDotted(fieldNames[i]);
+        m_columns[i]->InsertNextValue(
+          value.isNumber() ? static_cast<float>(value.numberDouble())
+                           : std::numeric_limits<float>::quiet_NaN());
+      }
+
+      m_lastId = idElement.OID();
+      m_ids->InsertNextValue(m_lastId.str());
+    }
+  }
+  catch (mongo::DBException &e) {
+    qDebug() << "failed to refresh descriptors: " << e.what();
+    conn.setFailed();
+    ok = false;
+  }
+
+  // let the charts sharing the arrays know that they changed. the molecules
+  // loaded before a failure are kept and the next refresh continues after them.
+  if (size() != previousSize) {
+    for (size_t i = 0; i < m_columns.size(); i++)
+      m_columns[i]->Modified();
+    m_ids->Modified();
+  }
+
+  return ok;
+}
+
+} // end MongoChem namespace
@@ -0,0 +1,141 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_DESCRIPTORTABLE_H
+#define MONGOCHEM_DESCRIPTORTABLE_H
+
+#include "mongochemguiexport.h"
+
+#include <vtkSmartPointer.h>
+
+#include <mongo/client/dbclient.h>
+
+#include <string>
+#include <vector>
+
+class vtkFloatArray;
+class vtkStringArray;
+class vtkTable;
+
+namespace MongoChem {
+
+class ScopedMongoConnection;
+
+/**
+ * @class DescriptorTable
+ * @brief The DescriptorTable class keeps the descriptor values of every
+ * molecule in a collection in memory for the chart plugins.
+ *
+ * Each descriptor is stored as a contiguous vtkFloatArray with one value per
+ * molecule (NaN where the molecule does not have the descriptor) along with
+ * a vtkStringArray named "id" containing the object id of each molecule.
+ *
+ * The table is loaded from the database the first time refresh() is called.
+ * Later calls only load the molecules which were added since the last
+ * refresh (i.e. those with a greater object id), unless the number of
+ * molecules no longer matches or invalidate() was called.
+ *
+ * The arrays are shared rather than copied into the tables of each chart
+ * with addColumns(), so opening another chart does not reload or copy the
+ * values. Molecules loaded by a later refresh() appear in every table
+ * sharing the arrays.
+ *
+ * This class may only be used from the GUI thread.
+ */
+class MONGOCHEMGUI_EXPORT DescriptorTable
+{
+public:
+  /**
+   * Returns the descriptor table for the current molecules collection. The
+   * table is created (but not loaded) on the first call for each collection.
+   */
+  static DescriptorTable* instance();
+
+  /**
+   * Creates a new, empty, descriptor table for @p collection with a column
+   * for each of the descriptors in @p descriptors.
+   */
+  DescriptorTable(const std::string &collection,
+                  const std::vector<std::string> &descriptors);
+
+  /** Destroys the descriptor table. */
+  ~DescriptorTable();
+
+  /** Returns the name of the collection the table was created for. */
+  std::string collection() const;
+
+  /** Returns the names of the descriptors in the table. */
+  std::vector<std::string> descriptors() const;
+
+  /**
+   * Loads the descriptors for molecules added to the collection since the
+   * last refresh. If molecules were inserted out of order or removed (the
+   * number of molecules in the collection differs from the table) or
+   * invalidate() was called, the entire collection is reloaded. Returns
+   * @c false if the database could not be queried or the query failed part
+   * way through, in which case the molecules loaded before the failure are
+   * kept.
+   */
+  bool refresh();
+
+  /**
+   * Reloads the entire collection on the next call to refresh(). This is
+   * called after the descriptors of existing molecules have been changed,
+   * e.g. by an import.
+   */
+  void invalidate();
+
+  /**
+   * Removes all molecules from the table. The next call to refresh() will
+   * reload the entire collection.
+   */
+  void clear();
+
+  /** Returns the number of molecules in the table. */
+  size_t size() const;
+
+  /**
+   * Returns the column for @p descriptor, or 0 if it is not in the table.
+   * The values may be accessed directly with GetPointer(0).
+   */
+  vtkFloatArray* column(const std::string &descriptor) const;
+
+  /** Returns the column containing the object id of each molecule. */
+  vtkStringArray* ids() const;
+
+  /**
+   * Adds the descriptor columns to @p table. The arrays are shared with the
+   * descriptor table rather than copied. If @p includeIds is @c true the
+   * "id" column is added as well.
+   */
+  void addColumns(vtkTable *table, bool includeIds = false) const;
+
+private:
+  /** Loads the descriptors of the molecules added since the last refresh. */
+  bool load(ScopedMongoConnection &conn);
+
+  std::string m_collection;
+  std::vector<std::string> m_descriptors;
+  std::vector<vtkSmartPointer<vtkFloatArray> > m_columns;
+  vtkSmartPointer<vtkStringArray> m_ids;
+  mongo::OID m_lastId;
+  size_t m_skippedCount;
+  bool m_reloadRequested;
+};
+
+} // end MongoChem namespace
+
+#endif // MONGOCHEM_DESCRIPTORTABLE_H
@@ -0,0 +1,235 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "diagramtooltipcache.h"
+
+#include "mongodatabase.h"
+
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QFutureWatcher>
+#include <QtGui/QImage>
+#include <QtGui/QPainter>
+
+#include <vtkContextScene.h>
+#include <vtkImageData.h>
+#include <vtkNew.h>
+#include <vtkQImageToImageSource.h>
+#include <vtkRenderWindow.h>
+#include <vtkRenderer.h>
+
+namespace MongoChem {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// The default number of tooltips kept by the cache.
+const size_t defaultCapacity = 100;
+
+// The size of the tooltip images in pixels.
+const int tooltipSize = 300;
+
+// The height of the area below the diagram for the molecule's name.
+const int nameHeight = 50;
+
+struct RenderedTooltip
+{
+  string id;
+  bool found;
+  QImage image;
+};
+
+// Fetches the names and diagrams of the molecules with @p ids and renders
+// their tooltips. This runs on a worker thread.
+vector<RenderedTooltip> renderTooltips(const vector<string> &ids)
+{
+  vector<MoleculeRef> molecules;
+  for (size_t i = 0; i < ids.size(); i++)
+    molecules.push_back(MoleculeRef(ids[i]));
+
+  vector<mongo::BSONObj> objs =
+    MongoDatabase::instance()->fetchMolecules(molecules,
+                                              BSON("name" << 1 <<
+                                                   "diagram.png" << 1));
+
+  vector<RenderedTooltip> tooltips(ids.size());
+  for (size_t i = 0; i < ids.size(); i++) {
+    RenderedTooltip &tooltip = tooltips[i];
+    tooltip.id = ids[i];
+    tooltip.found = !objs[i].isEmpty();
+    if (!tooltip.found)
+      continue;
+
+    tooltip.image = QImage(tooltipSize, tooltipSize, QImage::Format_ARGB32);
+    tooltip.image.fill(Qt::white);
+
+    QPainter painter(&tooltip.image);
+    painter.setRenderHint(QPainter::SmoothPixmapTransform);
+
+    // draw the diagram scaled to fit above the name
+    mongo::BSONElement diagram =
+      objs[i].getObjectField("diagram").getField("png");
+    if (diagram.type() == mongo::BinData) {
+      int length = 0;
+      const char *data = diagram.binData(length);
+      QImage image =
+        QImage::fromData(reinterpret_cast<const uchar *>(data), length, "png");
+      if (!image.isNull()) {
+        QRect bounds(0, 0, tooltipSize, tooltipSize - nameHeight);
+        QSize size = image.size();
+        size.scale(bounds.size(), Qt::KeepAspectRatio);
+        QRect target(QPoint(0, 0), size);
+        target.moveCenter(bounds.center());
+        painter.drawImage(target, image);
+      }
+    }
+
+    // draw the name below the diagram
+    QRect nameBounds(5, tooltipSize - nameHeight, tooltipSize - 10, nameHeight);
+    painter.setPen(Qt::black);
+    painter.drawText(nameBounds,
+                     Qt::AlignHCenter | Qt::AlignVCenter | Qt::TextWordWrap,
+                     QString::fromStdString(objs[i].getStringField("name")));
+  }
+
+  return tooltips;
+}
+
+} // end anonymous namespace
+
+DiagramTooltipCache::DiagramTooltipCache(QObject *parent_)
+  : QObject(parent_),
+    m_capacity(defaultCapacity)
+{
+}
+
+DiagramTooltipCache::~DiagramTooltipCache()
+{
+  // wait for the workers so that their watchers can be deleted
+  foreach (QFutureWatcherBase *watcher, findChildren<QFutureWatcherBase *>())
+    watcher->waitForFinished();
+}
+
+bool DiagramTooltipCache::image(const string &id, vtkImageData *&image_)
+{
+  image_ = 0;
+
+  std::map<string, Entry>::iterator iter = m_entries.find(id);
+  if (iter == m_entries.end())
+    return false;
+
+  // move to the back of the lru list
+  m_lru.splice(m_lru.end(), m_lru, iter->second.lruPosition);
+
+  image_ = iter->second.image;
+  return true;
+}
+
+void DiagramTooltipCache::request(const vector<string> &ids)
+{
+  vector<string> missing;
+  for (size_t i = 0; i < ids.size(); i++) {
+    const string &id = ids[i];
+    if (id.empty() || m_entries.count(id) || m_loading.count(id))
+      continue;
+
+    m_loading.insert(id);
+    missing.push_back(id);
+  }
+
+  if (missing.empty())
+    return;
+
+  QFutureWatcher<vector<RenderedTooltip> > *watcher =
+    new QFutureWatcher<vector<RenderedTooltip> >(this);
+  connect(watcher, SIGNAL(finished()), this, SLOT(tooltipsLoaded()));
+  watcher->setFuture(QtConcurrent::run(renderTooltips, missing));
+}
+
+void DiagramTooltipCache::setScene(vtkContextScene *scene)
+{
+  m_scene = scene;
+}
+
+void DiagramTooltipCache::setCapacity(size_t count)
+{
+  m_capacity = count;
+
+  while (m_entries.size() > m_capacity) {
+    m_entries.erase(m_lru.front());
+    m_lru.pop_front();
+  }
+}
+
+size_t DiagramTooltipCache::capacity() const
+{
+  return m_capacity;
+}
+
+void DiagramTooltipCache::tooltipsLoaded()
+{
+  QFutureWatcher<vector<RenderedTooltip> > *watcher =
+    static_cast<QFutureWatcher<vector<RenderedTooltip> > *>(sender());
+  vector<RenderedTooltip> tooltips = watcher->result();
+  watcher->deleteLater();
+
+  for (size_t i = 0; i < tooltips.size(); i++) {
+    RenderedTooltip &tooltip = tooltips[i];
+    m_loading.erase(tooltip.id);
+
+    if (!tooltip.found) {
+      insert(tooltip.id, 0);
+      continue;
+    }
+
+    // the vtk image is created here as vtk is not thread-safe
+    vtkNew<vtkQImageToImageSource> converter;
+    converter->SetQImage(&tooltip.image);
+    converter->Update();
+    vtkSmartPointer<vtkImageData> image_ =
+      vtkSmartPointer<vtkImageData>::New();
+    image_->DeepCopy(converter->GetOutput());
+
+    insert(tooltip.id, image_);
+  }
+
+  // paint the tooltip which is waiting for its image
+  if (m_scene) {
+    m_scene->SetDirty(true);
+    vtkRenderer *renderer = m_scene->GetRenderer();
+    if (renderer && renderer->GetRenderWindow())
+      renderer->GetRenderWindow()->Render();
+  }
+}
+
+void DiagramTooltipCache::insert(const string &id, vtkImageData *image_)
+{
+  if (m_capacity == 0 || m_entries.count(id))
+    return;
+
+  // remove the least recently used tooltips
+  while (m_entries.size() >= m_capacity) {
+    m_entries.erase(m_lru.front());
+    m_lru.pop_front();
+  }
+
+  Entry &entry = m_entries[id];
+  entry.image = image_;
+  entry.lruPosition = m_lru.insert(m_lru.end(), id);
+}
+
+} // end MongoChem namespace
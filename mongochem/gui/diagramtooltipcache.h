@@ -0,0 +1,105 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_DIAGRAMTOOLTIPCACHE_H
+#define MONGOCHEM_DIAGRAMTOOLTIPCACHE_H
+
+#include "mongochemguiexport.h"
+
+#include <QtCore/QObject>
+
+#include <vtkSmartPointer.h>
+#include <vtkWeakPointer.h>
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+class vtkContextScene;
+class vtkImageData;
+
+namespace MongoChem {
+
+/**
+ * @class DiagramTooltipCache
+ * @brief The DiagramTooltipCache class keeps the most recently used tooltip
+ * images for DiagramTooltipItem.
+ *
+ * Each tooltip shows the 2D diagram and name of a molecule. Tooltips are
+ * requested by molecule id. They are fetched from the database and rendered
+ * on a worker thread. When they are ready the scene set with setScene() is
+ * rendered again, so painting a tooltip never waits for the database.
+ */
+class MONGOCHEMGUI_EXPORT DiagramTooltipCache : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit DiagramTooltipCache(QObject *parent = 0);
+  ~DiagramTooltipCache();
+
+  /**
+   * Returns @c true if the tooltip for the molecule with @p id has been
+   * loaded. The tooltip is stored in @p image, which is 0 if the molecule
+   * does not exist.
+   */
+  bool image(const std::string &id, vtkImageData *&image);
+
+  /**
+   * Starts loading the tooltips for the molecules in @p ids which are not
+   * already loaded or being loaded.
+   */
+  void request(const std::vector<std::string> &ids);
+
+  /** Sets the scene which is rendered when tooltips have been loaded. */
+  void setScene(vtkContextScene *scene);
+
+  /**
+   * Sets the maximum number of tooltips kept to @p count. The least recently
+   * used tooltips are removed first. The default is 100.
+   */
+  void setCapacity(size_t count);
+
+  /** Returns the maximum number of tooltips kept. */
+  size_t capacity() const;
+
+private slots:
+  void tooltipsLoaded();
+
+private:
+  void insert(const std::string &id, vtkImageData *image);
+
+  struct Entry
+  {
+    vtkSmartPointer<vtkImageData> image;
+    std::list<std::string>::iterator lruPosition;
+  };
+
+  std::map<std::string, Entry> m_entries;
+
+  // ids from least to most recently used
+  std::list<std::string> m_lru;
+
+  std::set<std::string> m_loading;
+  size_t m_capacity;
+  vtkWeakPointer<vtkContextScene> m_scene;
+};
+
+} // end MongoChem namespace
+
+#endif // MONGOCHEM_DIAGRAMTOOLTIPCACHE_H
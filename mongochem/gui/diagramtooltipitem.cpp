@@ -16,40 +16,50 @@
 
 #include "diagramtooltipitem.h"
 
-#include <mongo/client/dbclient.h>
+#include "diagramtooltipcache.h"
 
-#include <QtWidgets/QWidget>
-#include <QtWidgets/QVBoxLayout>
-#include <QtWidgets/QLabel>
-#include <QtGui/QPainter>
-#include <QtCore/QSettings>
+#include <QtCore/QRegExp>
+#include <QtCore/QString>
 
-#include "vtkNew.h"
 #include "vtkContext2D.h"
+#include "vtkContextScene.h"
+#include "vtkDataArray.h"
 #include "vtkImageData.h"
 #include "vtkObjectFactory.h"
-#include "vtkContextScene.h"
-#include "vtkQImageToImageSource.h"
+#include "vtkStringArray.h"
+
+#include <queue>
 
 namespace MongoChem {
 
-using namespace mongo;
+namespace {
+
+// The number of nearby tooltips loaded along with the one under the cursor.
+const size_t prefetchCount = 16;
+
+// Returns the molecule id in the tooltip @p text.
+std::string moleculeId(const std::string &text)
+{
+  QRegExp id("[0-9a-fA-F]{24}");
+  if (id.indexIn(QString::fromStdString(text)) == -1)
+    return std::string();
+  return id.cap(0).toStdString();
+}
+
+} // end anonymous namespace
 
 vtkStandardNewMacro(DiagramTooltipItem)
 
 DiagramTooltipItem::DiagramTooltipItem()
-  : vtkTooltipItem()
+  : vtkTooltipItem(),
+    m_cache(new DiagramTooltipCache),
+    m_rowsTime(0)
 {
-  QSettings settings;
-  std::string host = settings.value("hostname").toString().toStdString();
+}
 
-  try {
-    m_db.connect(host);
-  }
-  catch (DBException &e) {
-    std::cerr << "Failed to connect to MongoDB: " << e.what() << std::endl;
-    return;
-  }
+DiagramTooltipItem::~DiagramTooltipItem()
+{
+  delete m_cache;
 }
 
 void DiagramTooltipItem::PrintSelf(ostream &os, vtkIndent indent)
@@ -57,59 +67,41 @@ void DiagramTooltipItem::PrintSelf(ostream &os, vtkIndent indent)
   Superclass::PrintSelf(os, indent);
 }
 
+void DiagramTooltipItem::SetPrefetchData(vtkDataArray *x,
+                                         vtkDataArray *y,
+                                         vtkStringArray *ids)
+{
+  m_x = x;
+  m_y = y;
+  m_ids = ids;
+  m_rows.clear();
+  m_rowsTime = 0;
+}
+
 bool DiagramTooltipItem::Paint(vtkContext2D *painter)
 {
-  // Name of molecule corresponding to the point.
-  std::string name = this->GetText();
-  if (name.empty())
-    return false;
-
-  // query database
-  QSettings settings;
-  std::string collection = settings.value("collection").toString().toStdString();
-  std::string moleculesCollection = collection + ".molecules";
-
-  BSONObj obj = m_db.findOne(moleculesCollection, QUERY("name" << name));
-  if (obj.isEmpty()) {
-    // just paint the name using the superclass
+  // Id of the molecule corresponding to the point.
+  std::string id = moleculeId(this->GetText());
+  if (id.empty())
     return Superclass::Paint(painter);
-  }
 
-  BSONElement diagram = obj.getObjectField("diagram").getField("png");
-  if (diagram.eoo()) {
-    // Just paint the name using the superclass.
-    return Superclass::Paint(painter);
+  // The tooltip is painted once it is loaded.
+  m_cache->setScene(this->Scene);
+  vtkImageData *vtkImage = 0;
+  if (!m_cache->image(id, vtkImage)) {
+    std::vector<std::string> ids = NearestIds(id);
+    ids.insert(ids.begin(), id);
+    m_cache->request(ids);
+    return true;
   }
 
-  // Convert the BSON binary data in PNG format to a QImage.
-  int binDataLength = 0;
-  const char *binData = diagram.binData(binDataLength);
-  QImage image = QImage::fromData(reinterpret_cast<const unsigned char *>(binData),
-                                  binDataLength,
-                                  "png");
-
-  // Layout diagram and molecule name vertically and render to a QImage.
-  QWidget widget;
-  QVBoxLayout *layout = new QVBoxLayout;
-  QLabel imageLabel;
-  imageLabel.setPixmap(QPixmap::fromImage(image));
-  layout->addWidget(&imageLabel);
-  QLabel nameLabel(name.c_str());
-  nameLabel.setWordWrap(true);
-  nameLabel.setAlignment(Qt::AlignHCenter | Qt::AlignVCenter);
-  layout->addWidget(&nameLabel);
-  widget.setLayout(layout);
-  widget.resize(300, 300);
-
-  QImage tooltipImage(widget.width(), widget.height(), QImage::Format_ARGB32);
-  QPainter qpainter(&tooltipImage);
-  widget.render(&qpainter);
-
-  // Convert the QImage to a vtkImageData.
-  vtkNew<vtkQImageToImageSource> converter;
-  converter->SetQImage(&tooltipImage);
-  converter->Update();
-  vtkImageData *vtkImage = converter->GetOutput();
+  if (!vtkImage)
+    return true;
+
+  int dimensions[3];
+  vtkImage->GetDimensions(dimensions);
+  float width = static_cast<float>(dimensions[0]);
+  float height = static_cast<float>(dimensions[1]);
 
   // Setup painter.
   painter->ApplyPen(this->GetPen());
@@ -117,18 +109,13 @@ bool DiagramTooltipItem::Paint(vtkContext2D *painter)
 
   // Determine where the tooltip should be drawn.
   vtkVector2f drawPosition = this->GetPositionVector();
-  int drawPositionX = static_cast<int>(drawPosition.GetX());
-  int drawPositionY = static_cast<int>(drawPosition.GetY());
-  if (drawPositionX + tooltipImage.width() > this->Scene->GetViewWidth())
-    drawPosition[0] -= static_cast<float>(tooltipImage.width());
-  if (drawPositionY + tooltipImage.height() > this->Scene->GetViewHeight())
-    drawPosition[1] -= static_cast<float>(tooltipImage.height());
+  if (drawPosition.GetX() + width > this->Scene->GetViewWidth())
+    drawPosition[0] -= width;
+  if (drawPosition.GetY() + height > this->Scene->GetViewHeight())
+    drawPosition[1] -= height;
 
   // draw background rect
-  painter->DrawRect(drawPosition.GetX(),
-                    drawPosition.GetY(),
-                    static_cast<float>(tooltipImage.width()),
-                    static_cast<float>(tooltipImage.height()));
+  painter->DrawRect(drawPosition.GetX(), drawPosition.GetY(), width, height);
 
   // draw molecule diagram
   painter->DrawImage(drawPosition.GetX(),
@@ -138,4 +125,67 @@ bool DiagramTooltipItem::Paint(vtkContext2D *painter)
   return true;
 }
 
+std::vector<std::string> DiagramTooltipItem::NearestIds(const std::string &id)
+{
+  std::vector<std::string> ids;
+  if (!m_x || !m_y || !m_ids)
+    return ids;
+
+  vtkIdType count = m_ids->GetNumberOfValues();
+  if (m_x->GetNumberOfTuples() < count || m_y->GetNumberOfTuples() < count)
+    return ids;
+
+  if (m_rowsTime != m_ids->GetMTime()) {
+    m_rows.clear();
+    for (vtkIdType i = 0; i < count; i++)
+      m_rows[m_ids->GetValue(i)] = i;
+    m_rowsTime = m_ids->GetMTime();
+  }
+
+  std::map<std::string, vtkIdType>::const_iterator row = m_rows.find(id);
+  if (row == m_rows.end())
+    return ids;
+
+  // distances are scaled by the range of each axis so that the points
+  // nearest on the screen are chosen
+  double xRange[2];
+  double yRange[2];
+  m_x->GetRange(xRange);
+  m_y->GetRange(yRange);
+  double xScale = xRange[1] > xRange[0] ? 1.0 / (xRange[1] - xRange[0]) : 1.0;
+  double yScale = yRange[1] > yRange[0] ? 1.0 / (yRange[1] - yRange[0]) : 1.0;
+
+  double x = m_x->GetTuple1(row->second);
+  double y = m_y->GetTuple1(row->second);
+
+  // keep the nearest points in a max-heap
+  std::priority_queue<std::pair<double, vtkIdType> > nearest;
+  for (vtkIdType i = 0; i < count; i++) {
+    if (i == row->second)
+      continue;
+
+    double dx = (m_x->GetTuple1(i) - x) * xScale;
+    double dy = (m_y->GetTuple1(i) - y) * yScale;
+    double distance = dx * dx + dy * dy;
+
+    if (nearest.size() < prefetchCount) {
+      nearest.push(std::make_pair(distance, i));
+    }
+    else if (distance < nearest.top().first) {
+      nearest.pop();
+      nearest.push(std::make_pair(distance, i));
+    }
+  }
+
+  // points which are not molecules (e.g. aggregated points) are skipped
+  while (!nearest.empty()) {
+    std::string nearestId = moleculeId(m_ids->GetValue(nearest.top().second));
+    if (!nearestId.empty())
+      ids.push_back(nearestId);
+    nearest.pop();
+  }
+
+  return ids;
+}
+
 } // end MongoChem namespace
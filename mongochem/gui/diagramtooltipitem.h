@@ -20,13 +20,28 @@
 #include "mongochemguiexport.h"
 #include "vtkTooltipItem.h"
 
-#include <mongo/client/dbclient.h>
+#include <vtkSmartPointer.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class vtkDataArray;
+class vtkStringArray;
 
 namespace MongoChem {
 
+class DiagramTooltipCache;
+
 /**
  * A VTK class to override the default tooltip item with a custom one diplaying
  * the chemical name and 2D structure depiction.
+ *
+ * The text of the tooltip must contain the id of the molecule (e.g. by using
+ * the molecule ids as the indexed labels of the plot). Tooltips are loaded in
+ * the background and kept in a DiagramTooltipCache. If SetPrefetchData() is
+ * called the tooltips of the points nearest to the one under the cursor are
+ * loaded along with it.
  */
 
 class MONGOCHEMGUI_EXPORT DiagramTooltipItem : public vtkTooltipItem
@@ -38,13 +53,33 @@ public:
   /** Creates a 2D Chart object. */
   static DiagramTooltipItem *New();
 
+  /**
+   * Sets the coordinates of the points in the plot along with the molecule
+   * id for each point. These are used to find the tooltips to prefetch.
+   */
+  void SetPrefetchData(vtkDataArray *x, vtkDataArray *y, vtkStringArray *ids);
+
   bool Paint(vtkContext2D *painter);
 
 protected:
   DiagramTooltipItem();
+  ~DiagramTooltipItem();
 
 private:
-  mongo::DBClientConnection m_db;
+  DiagramTooltipItem(const DiagramTooltipItem &); // Not implemented.
+  void operator=(const DiagramTooltipItem &); // Not implemented.
+
+  /** Returns the ids of the molecules plotted nearest to @p id. */
+  std::vector<std::string> NearestIds(const std::string &id);
+
+  DiagramTooltipCache *m_cache;
+  vtkSmartPointer<vtkDataArray> m_x;
+  vtkSmartPointer<vtkDataArray> m_y;
+  vtkSmartPointer<vtkStringArray> m_ids;
+
+  // the row for each id, rebuilt when m_ids is modified
+  std::map<std::string, vtkIdType> m_rows;
+  unsigned long m_rowsTime;
 };
 
 } // end MongoChem namespace
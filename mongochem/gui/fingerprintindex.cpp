@@ -0,0 +1,625 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "fingerprintindex.h"
+
+#include "chemkit.h"
+#include "fingerprintstore.h"
+#include "mongodatabase.h"
+
+#include <chemkit/fingerprint.h>
+#include <chemkit/molecule.h>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtCore/QDebug>
+#include <QtCore/QThread>
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+namespace MongoChem {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Guards the creation of the indices in FingerprintIndex::instance().
+QMutex instancesMutex;
+std::map<string, FingerprintIndex *> instances;
+
+// The minimum number of fingerprints scored by each thread.
+const size_t minimumTaskSize = 16384;
+
+// The number of molecules loaded before they are added to the index.
+const size_t refreshBatchSize = 10000;
+
+// Resets the progress of a refresh when it returns.
+struct RefreshProgressReset
+{
+  QAtomicInt *refreshed;
+  QAtomicInt *total;
+
+  ~RefreshProgressReset()
+  {
+    refreshed->store(0);
+    total->store(0);
+  }
+};
+
+struct Candidate
+{
+  float similarity;
+  size_t position;
+};
+
+// Returns true if @p a is more similar than @p b. Equal similarity values
+// are ordered by their position in the index so that results are stable.
+inline bool moreSimilar(const Candidate &a, const Candidate &b)
+{
+  if (a.similarity != b.similarity)
+    return a.similarity > b.similarity;
+  return a.position < b.position;
+}
+
+// Keeps the best @p count candidates seen so far in a heap with the least
+// similar candidate at the front.
+class TopCandidates
+{
+public:
+  explicit TopCandidates(size_t count) : m_count(count)
+  {
+    m_heap.reserve(count);
+  }
+
+  bool isFull() const { return m_heap.size() >= m_count; }
+
+  // Returns the similarity of the least similar candidate kept.
+  float threshold() const { return m_heap.front().similarity; }
+
+  void insert(const Candidate &candidate)
+  {
+    if (m_heap.size() < m_count) {
+      m_heap.push_back(candidate);
+      std::push_heap(m_heap.begin(), m_heap.end(), moreSimilar);
+    }
+    else if (moreSimilar(candidate, m_heap.front())) {
+      std::pop_heap(m_heap.begin(), m_heap.end(), moreSimilar);
+      m_heap.back() = candidate;
+      std::push_heap(m_heap.begin(), m_heap.end(), moreSimilar);
+    }
+  }
+
+  vector<Candidate>& candidates() { return m_heap; }
+
+private:
+  size_t m_count;
+  vector<Candidate> m_heap;
+};
+
+// A range of the index to be scored on a single thread.
+struct ScoreTask
+{
+  const quint64 *query;
+  int queryBitsSet;
+  size_t wordCount;
+  const quint64 *words;
+  const int *bitsSet;
+  const size_t *positions;
+  size_t begin;
+  size_t end;
+  size_t count;
+  vector<Candidate> results;
+};
+
+struct RunScoreTask
+{
+  void operator()(ScoreTask &task) const
+  {
+    TopCandidates top(task.count);
+
+    for (size_t i = task.begin; i < task.end; i++) {
+      size_t position = task.positions ? task.positions[i] : i;
+      int bitsSet = task.bitsSet[position];
+
+      // skip fingerprints which cannot beat the current results. the
+      // tanimoto coefficient is bounded by min(a, b) / max(a, b) where a and
+      // b are the number of bits set in each fingerprint.
+      if (top.isFull()) {
+        int smaller = std::min(task.queryBitsSet, bitsSet);
+        int larger = std::max(task.queryBitsSet, bitsSet);
+        float bound = larger > 0 ? static_cast<float>(smaller) / larger : 0.0f;
+        if (bound < top.threshold())
+          continue;
+      }
+
+      const quint64 *fingerprint = task.words + position * task.wordCount;
+      int common = 0;
+      for (size_t j = 0; j < task.wordCount; j++)
+        common += FingerprintIndex::popcount(task.query[j] & fingerprint[j]);
+
+      int total = task.queryBitsSet + bitsSet - common;
+
+      Candidate candidate;
+      candidate.similarity =
+        total > 0 ? static_cast<float>(common) / total : 0.0f;
+      candidate.position = position;
+      top.insert(candidate);
+    }
+
+    task.results.swap(top.candidates());
+  }
+};
+
+// A range of the index to be screened on a single thread.
+struct ScreenTask
+{
+  const quint64 *query;
+  int queryBitsSet;
+  size_t wordCount;
+  const quint64 *words;
+  const int *bitsSet;
+  size_t begin;
+  size_t end;
+  vector<size_t> results;
+};
+
+struct RunScreenTask
+{
+  void operator()(ScreenTask &task) const
+  {
+    for (size_t i = task.begin; i < task.end; i++) {
+      // a fingerprint with fewer bits set cannot contain the query
+      if (task.bitsSet[i] < task.queryBitsSet)
+        continue;
+
+      const quint64 *fingerprint = task.words + i * task.wordCount;
+      bool contains = true;
+      for (size_t j = 0; j < task.wordCount && contains; j++)
+        contains = (task.query[j] & fingerprint[j]) == task.query[j];
+
+      if (contains)
+        task.results.push_back(i);
+    }
+  }
+};
+
+} // end anonymous namespace
+
+FingerprintIndex* FingerprintIndex::instance()
+{
+  string collection = MongoDatabase::instance()->moleculesCollectionName();
+
+  QMutexLocker locker(&instancesMutex);
+  FingerprintIndex *&index = instances[collection];
+  if (!index)
+    index = new FingerprintIndex(collection);
+
+  return index;
+}
+
+FingerprintIndex::FingerprintIndex(const string &collection_)
+  : m_collection(collection_),
+    m_bitCount(0),
+    m_wordCount(0),
+    m_skippedCount(0)
+{
+}
+
+FingerprintIndex::~FingerprintIndex()
+{
+}
+
+string FingerprintIndex::collection() const
+{
+  return m_collection;
+}
+
+bool FingerprintIndex::refresh()
+{
+  QMutexLocker refreshLocker(&m_refreshMutex);
+
+  MongoDatabase *db = MongoDatabase::instance();
+  if (!db->isConnected())
+    return false;
+
+  // determine the size of the fingerprints the first time through
+  if (m_wordCount == 0) {
+    size_t bitCount = FingerprintStore::fingerprintSize("fp2");
+    if (bitCount == 0)
+      return false;
+
+    QWriteLocker locker(&m_lock);
+    m_bitCount = bitCount;
+    m_wordCount = (bitCount + 63) / 64;
+  }
+
+  ScopedMongoConnection conn(db->connectionPool());
+  if (!conn)
+    return false;
+
+  if (m_reloadRequested.fetchAndStoreOrdered(0) == 0) {
+    if (!load(conn, false))
+      return false;
+
+    // the molecules inserted with a lower id than the last one loaded and
+    // the molecules removed are missed by loading only the new ones, in
+    // which case the number of molecules no longer matches
+    unsigned long long total = 0;
+    try {
+      total = conn->count(m_collection);
+    }
+    catch (mongo::DBException &e) {
+      qDebug() << "failed to count molecules: " << e.what();
+      conn.setFailed();
+      return false;
+    }
+
+    if (total == size() + m_skippedCount)
+      return true;
+  }
+
+  return load(conn, true);
+}
+
+void FingerprintIndex::invalidate()
+{
+  m_reloadRequested.store(1);
+}
+
+void FingerprintIndex::insert(const mongo::OID &id,
+                              const chemkit::Bitset &fingerprint)
+{
+  QMutexLocker refreshLocker(&m_refreshMutex);
+  QWriteLocker locker(&m_lock);
+
+  if (m_wordCount == 0) {
+    m_bitCount = fingerprint.size();
+    m_wordCount = (m_bitCount + 63) / 64;
+  }
+
+  vector<quint64> words(m_wordCount);
+  pack(fingerprint, &words[0]);
+
+  int count = 0;
+  for (size_t i = 0; i < m_wordCount; i++)
+    count += popcount(words[i]);
+
+  // keep the ids in ascending order
+  vector<mongo::OID>::iterator iter =
+    std::lower_bound(m_ids.begin(), m_ids.end(), id);
+  size_t position = static_cast<size_t>(iter - m_ids.begin());
+  if (iter == m_ids.end() || *iter != id) {
+    m_ids.insert(iter, id);
+    m_words.insert(m_words.begin() + position * m_wordCount,
+                   words.begin(), words.end());
+    m_bitsSet.insert(m_bitsSet.begin() + position, count);
+  }
+  else {
+    std::copy(words.begin(), words.end(),
+              m_words.begin() + position * m_wordCount);
+    m_bitsSet[position] = count;
+  }
+}
+
+int FingerprintIndex::refreshProgress(int *total) const
+{
+  if (total)
+    *total = m_refreshTotal.load();
+  return m_refreshed.load();
+}
+
+void FingerprintIndex::clear()
+{
+  QMutexLocker refreshLocker(&m_refreshMutex);
+  QWriteLocker locker(&m_lock);
+
+  vector<mongo::OID>().swap(m_ids);
+  vector<quint64>().swap(m_words);
+  vector<int>().swap(m_bitsSet);
+  m_skippedCount = 0;
+}
+
+size_t FingerprintIndex::size() const
+{
+  QReadLocker locker(&m_lock);
+  return m_ids.size();
+}
+
+vector<FingerprintIndex::Match>
+FingerprintIndex::search(const chemkit::Bitset &fingerprint, size_t count) const
+{
+  QReadLocker locker(&m_lock);
+  return score(fingerprint, 0, count);
+}
+
+vector<FingerprintIndex::Match>
+FingerprintIndex::search(const chemkit::Bitset &fingerprint,
+                         const vector<MoleculeRef> &molecules,
+                         size_t count) const
+{
+  QReadLocker locker(&m_lock);
+
+  // find the position of each molecule in the index. the ids are loaded in
+  // ascending order so they can be found with a binary search.
+  vector<size_t> positions;
+  positions.reserve(molecules.size());
+  for (size_t i = 0; i < molecules.size(); i++) {
+    if (!molecules[i].isValid())
+      continue;
+
+    mongo::OID id(molecules[i].id());
+    vector<mongo::OID>::const_iterator iter =
+      std::lower_bound(m_ids.begin(), m_ids.end(), id);
+    if (iter != m_ids.end() && *iter == id)
+      positions.push_back(static_cast<size_t>(iter - m_ids.begin()));
+  }
+
+  std::sort(positions.begin(), positions.end());
+  positions.erase(std::unique(positions.begin(), positions.end()),
+                  positions.end());
+
+  return score(fingerprint, &positions, count);
+}
+
+vector<MoleculeRef>
+FingerprintIndex::screen(const chemkit::Bitset &fingerprint) const
+{
+  QReadLocker locker(&m_lock);
+
+  vector<MoleculeRef> molecules;
+
+  size_t total = m_ids.size();
+  if (total == 0)
+    return molecules;
+
+  vector<quint64> query(m_wordCount);
+  pack(fingerprint, &query[0]);
+
+  int queryBitsSet = 0;
+  for (size_t i = 0; i < m_wordCount; i++)
+    queryBitsSet += popcount(query[i]);
+
+  // split the index into one or more ranges to be screened in parallel
+  size_t taskCount =
+    std::min(static_cast<size_t>(qMax(1, QThread::idealThreadCount())),
+             (total + minimumTaskSize - 1) / minimumTaskSize);
+  size_t taskSize = (total + taskCount - 1) / taskCount;
+
+  vector<ScreenTask> tasks(taskCount);
+  for (size_t i = 0; i < taskCount; i++) {
+    ScreenTask &task = tasks[i];
+    task.query = &query[0];
+    task.queryBitsSet = queryBitsSet;
+    task.wordCount = m_wordCount;
+    task.words = &m_words[0];
+    task.bitsSet = &m_bitsSet[0];
+    task.begin = i * taskSize;
+    task.end = std::min(total, task.begin + taskSize);
+  }
+
+  if (tasks.size() == 1)
+    RunScreenTask()(tasks[0]);
+  else
+    QtConcurrent::blockingMap(tasks, RunScreenTask());
+
+  for (size_t i = 0; i < tasks.size(); i++)
+    for (size_t j = 0; j < tasks[i].results.size(); j++)
+      molecules.push_back(MoleculeRef(m_ids[tasks[i].results[j]].str()));
+
+  return molecules;
+}
+
+bool FingerprintIndex::load(ScopedMongoConnection &conn, bool reload)
+{
+  boost::scoped_ptr<chemkit::Fingerprint>
+    fp2(chemkit::Fingerprint::create("fp2"));
+  if (!fp2)
+    return false;
+
+  // only load the molecules added since the last refresh unless reloading
+  mongo::BSONObj filter;
+  m_lock.lockForRead();
+  if (!reload && !m_ids.empty())
+    filter = BSON("_id" << mongo::GT << m_ids.back());
+  m_lock.unlock();
+  mongo::Query query(filter);
+  query.sort("_id");
+
+  RefreshProgressReset progressReset = { &m_refreshed, &m_refreshTotal };
+  try {
+    m_refreshTotal.store(static_cast<int>(conn->count(m_collection, filter)));
+  }
+  catch (mongo::DBException &e) {
+    qDebug() << "failed to count molecules: " << e.what();
+    conn.setFailed();
+    return false;
+  }
+
+  mongo::BSONObjBuilder fieldsBuilder;
+  fieldsBuilder.appendElements(FingerprintStore::fields("fp2"));
+  fieldsBuilder.append("inchi", 1);
+  mongo::BSONObj fields = fieldsBuilder.obj();
+  std::auto_ptr<mongo::DBClientCursor> cursor =
+    conn->query(m_collection, query, 0, 0, &fields, 0,
+                static_cast<int>(refreshBatchSize));
+  if (!cursor.get()) {
+    conn.setFailed();
+    return false;
+  }
+
+  vector<mongo::OID> ids;
+  vector<quint64> words;
+  vector<int> bitsSet;
+  vector<quint64> fingerprint(m_wordCount);
+  size_t skipped = 0;
+
+  while (cursor->more()) {
+    mongo::BSONObj obj = cursor->next();
+
+    mongo::BSONElement idElement;
+    if (!obj.getObjectID(idElement) || idElement.type() != mongo::jstOID) {
+      skipped++;
+      continue;
+    }
+
+    if (FingerprintStore::readFingerprint(obj, "fp2", &fingerprint[0],
+                                          m_wordCount)) {
+      clearPadding(&fingerprint[0]);
+    }
+    else {
+      // there is not a fingerprint stored for the molecule so calculate it
+      mongo::BSONElement inchiElement = obj.getField("inchi");
+      if (inchiElement.type() != mongo::String) {
+        skipped++;
+        continue;
+      }
+
+      boost::shared_ptr<chemkit::Molecule> molecule =
+        ChemKit::createMolecule(inchiElement.str(), "inchi");
+      pack(fp2->value(molecule.get()), &fingerprint[0]);
+    }
+
+    int count = 0;
+    for (size_t i = 0; i < m_wordCount; i++)
+      count += popcount(fingerprint[i]);
+
+    m_refreshed.fetchAndAddRelaxed(1);
+    ids.push_back(idElement.OID());
+    words.insert(words.end(), fingerprint.begin(), fingerprint.end());
+    bitsSet.push_back(count);
+
+    // add the loaded fingerprints to the index in batches so that they are
+    // not held in memory twice while loading a large collection. a reload
+    // keeps the old index for searches until it is complete.
+    if (!reload && ids.size() >= refreshBatchSize) {
+      QWriteLocker locker(&m_lock);
+      m_ids.insert(m_ids.end(), ids.begin(), ids.end());
+      m_words.insert(m_words.end(), words.begin(), words.end());
+      m_bitsSet.insert(m_bitsSet.end(), bitsSet.begin(), bitsSet.end());
+      ids.clear();
+      words.clear();
+      bitsSet.clear();
+    }
+  }
+
+  // remember the molecules which are not in the index so that they are not
+  // mistaken for changes to the collection
+  m_skippedCount = reload ? skipped : m_skippedCount + skipped;
+
+  QWriteLocker locker(&m_lock);
+  if (reload) {
+    m_ids.swap(ids);
+    m_words.swap(words);
+    m_bitsSet.swap(bitsSet);
+  }
+  else {
+    m_ids.insert(m_ids.end(), ids.begin(), ids.end());
+    m_words.insert(m_words.end(), words.begin(), words.end());
+    m_bitsSet.insert(m_bitsSet.end(), bitsSet.begin(), bitsSet.end());
+  }
+
+  return true;
+}
+
+void FingerprintIndex::clearPadding(quint64 *words) const
+{
+  size_t paddingBits = m_wordCount * 64 - m_bitCount;
+  if (paddingBits > 0)
+    words[m_wordCount - 1] &= ~Q_UINT64_C(0) >> paddingBits;
+}
+
+void FingerprintIndex::pack(const chemkit::Bitset &fingerprint,
+                            quint64 *words) const
+{
+  std::fill(words, words + m_wordCount, 0);
+  if (fingerprint.empty())
+    return;
+
+  vector<chemkit::Bitset::block_type> blocks(fingerprint.num_blocks());
+  boost::to_block_range(fingerprint, blocks.begin());
+  memcpy(words, &blocks[0],
+         std::min(blocks.size() * sizeof(chemkit::Bitset::block_type),
+                  m_wordCount * sizeof(quint64)));
+
+  clearPadding(words);
+}
+
+vector<FingerprintIndex::Match>
+FingerprintIndex::score(const chemkit::Bitset &fingerprint,
+                        const vector<size_t> *positions,
+                        size_t count) const
+{
+  vector<Match> matches;
+
+  size_t total = positions ? positions->size() : m_ids.size();
+  if (count == 0 || total == 0)
+    return matches;
+
+  vector<quint64> query(m_wordCount);
+  pack(fingerprint, &query[0]);
+
+  int queryBitsSet = 0;
+  for (size_t i = 0; i < m_wordCount; i++)
+    queryBitsSet += popcount(query[i]);
+
+  // split the index into one or more ranges to be scored in parallel
+  size_t taskCount =
+    std::min(static_cast<size_t>(qMax(1, QThread::idealThreadCount())),
+             (total + minimumTaskSize - 1) / minimumTaskSize);
+  size_t taskSize = (total + taskCount - 1) / taskCount;
+
+  vector<ScoreTask> tasks(taskCount);
+  for (size_t i = 0; i < taskCount; i++) {
+    ScoreTask &task = tasks[i];
+    task.query = &query[0];
+    task.queryBitsSet = queryBitsSet;
+    task.wordCount = m_wordCount;
+    task.words = &m_words[0];
+    task.bitsSet = &m_bitsSet[0];
+    task.positions = positions ? &(*positions)[0] : 0;
+    task.begin = i * taskSize;
+    task.end = std::min(total, task.begin + taskSize);
+    task.count = count;
+  }
+
+  if (tasks.size() == 1)
+    RunScoreTask()(tasks[0]);
+  else
+    QtConcurrent::blockingMap(tasks, RunScoreTask());
+
+  // merge the results from each task
+  TopCandidates top(count);
+  for (size_t i = 0; i < tasks.size(); i++)
+    for (size_t j = 0; j < tasks[i].results.size(); j++)
+      top.insert(tasks[i].results[j]);
+
+  vector<Candidate> &candidates = top.candidates();
+  std::sort(candidates.begin(), candidates.end(), moreSimilar);
+
+  matches.resize(candidates.size());
+  for (size_t i = 0; i < candidates.size(); i++) {
+    matches[i].molecule = MoleculeRef(m_ids[candidates[i].position].str());
+    matches[i].similarity = candidates[i].similarity;
+  }
+
+  return matches;
+}
+
+} // end MongoChem namespace
@@ -0,0 +1,205 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_FINGERPRINTINDEX_H
+#define MONGOCHEM_FINGERPRINTINDEX_H
+
+#include "mongochemguiexport.h"
+#include "moleculeref.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QMutex>
+#include <QtCore/QReadWriteLock>
+#include <QtCore/QtGlobal>
+
+#include <chemkit/bitset.h>
+
+#include <mongo/client/dbclient.h>
+
+#include <string>
+#include <vector>
+
+namespace MongoChem {
+
+class ScopedMongoConnection;
+
+/**
+ * @class FingerprintIndex
+ * @brief The FingerprintIndex class keeps the fp2 fingerprints of every
+ * molecule in a collection in memory for fast similarity searches.
+ *
+ * The fingerprints are stored as packed 64-bit words in a single contiguous
+ * array along with the bit count of each fingerprint. The index is loaded
+ * from the database the first time refresh() is called. Later calls only
+ * load the molecules which were added since the last refresh (i.e. those
+ * with a greater object id), unless the collection has changed in a way
+ * that requires reloading it.
+ *
+ * The fingerprints are read with FingerprintStore. Molecules without a
+ * stored fingerprint have their fingerprint calculated from their InChI while
+ * the index is loaded.
+ *
+ * The search() methods score the query fingerprint against the index using
+ * the Tanimoto coefficient on multiple threads and return the most similar
+ * molecules in order of decreasing similarity.
+ *
+ * All methods in this class are thread-safe.
+ */
+class MONGOCHEMGUI_EXPORT FingerprintIndex
+{
+public:
+  /** A molecule found by search() along with its similarity value. */
+  struct Match
+  {
+    MoleculeRef molecule;
+    float similarity;
+  };
+
+  /**
+   * Returns the fingerprint index for the current molecules collection. The
+   * index is created (but not loaded) on the first call for each collection.
+   */
+  static FingerprintIndex* instance();
+
+  /** Creates a new, empty, fingerprint index for @p collection. */
+  explicit FingerprintIndex(const std::string &collection);
+
+  /** Destroys the fingerprint index. */
+  ~FingerprintIndex();
+
+  /** Returns the name of the collection the index was created for. */
+  std::string collection() const;
+
+  /**
+   * Loads the fingerprints for molecules added to the collection since the
+   * last refresh. If molecules were inserted out of order or removed (the
+   * number of molecules in the collection differs from the index) or
+   * invalidate() was called, the entire collection is reloaded. Returns
+   * @c false if the database could not be queried.
+   */
+  bool refresh();
+
+  /**
+   * Reloads the entire collection on the next call to refresh(). This is
+   * called after the stored fingerprints of existing molecules have been
+   * changed. The current fingerprints are searched until the reload is
+   * finished.
+   */
+  void invalidate();
+
+  /**
+   * Adds the molecule with @p id and @p fingerprint to the index, or
+   * replaces its fingerprint if it is already in the index. The first
+   * fingerprint added to an empty index sets the fingerprint size.
+   *
+   * Molecules are normally loaded with refresh(). This builds an index
+   * without a database, e.g. for testing.
+   */
+  void insert(const mongo::OID &id, const chemkit::Bitset &fingerprint);
+
+  /**
+   * Returns the number of molecules loaded so far by the refresh() in
+   * progress and sets @p total to the number of molecules it will load. Both
+   * are 0 when the index is not being refreshed. This is used to show the
+   * progress of a refresh running on another thread.
+   */
+  int refreshProgress(int *total) const;
+
+  /**
+   * Removes all fingerprints from the index. The next call to refresh() will
+   * reload the entire collection.
+   */
+  void clear();
+
+  /** Returns the number of molecules in the index. */
+  size_t size() const;
+
+  /**
+   * Returns the @p count molecules in the index most similar to
+   * @p fingerprint.
+   */
+  std::vector<Match> search(const chemkit::Bitset &fingerprint,
+                            size_t count) const;
+
+  /**
+   * Returns the @p count molecules in @p molecules most similar to
+   * @p fingerprint. Molecules which are not in the index are ignored.
+   */
+  std::vector<Match> search(const chemkit::Bitset &fingerprint,
+                            const std::vector<MoleculeRef> &molecules,
+                            size_t count) const;
+
+  /**
+   * Returns the molecules in the index whose fingerprint has every bit set
+   * which is set in @p fingerprint. Every molecule containing the query
+   * molecule as a substructure passes this test, so it is used to screen
+   * candidates before running a substructure search.
+   */
+  std::vector<MoleculeRef> screen(const chemkit::Bitset &fingerprint) const;
+
+  /** Returns the number of bits set in @p word. */
+  static int popcount(quint64 word)
+  {
+#if defined(__POPCNT__) && defined(__GNUC__)
+    return __builtin_popcountll(word);
+#else
+    word = word - ((word >> 1) & Q_UINT64_C(0x5555555555555555));
+    word = (word & Q_UINT64_C(0x3333333333333333)) +
+           ((word >> 2) & Q_UINT64_C(0x3333333333333333));
+    word = (word + (word >> 4)) & Q_UINT64_C(0x0f0f0f0f0f0f0f0f);
+    return static_cast<int>((word * Q_UINT64_C(0x0101010101010101)) >> 56);
+#endif
+  }
+
+private:
+  /**
+   * Loads the fingerprints of the molecules added since the last refresh,
+   * or of every molecule if @p reload is @c true.
+   */
+  bool load(ScopedMongoConnection &conn, bool reload);
+
+  /** Clears any bits in @p words past the end of the fingerprint. */
+  void clearPadding(quint64 *words) const;
+
+  /** Copies the bits of @p fingerprint to @p words. */
+  void pack(const chemkit::Bitset &fingerprint, quint64 *words) const;
+
+  /**
+   * Scores @p fingerprint against the molecules at @p positions (or all
+   * molecules if @p positions is null). Must be called with m_lock held.
+   */
+  std::vector<Match> score(const chemkit::Bitset &fingerprint,
+                           const std::vector<size_t> *positions,
+                           size_t count) const;
+
+private:
+  mutable QReadWriteLock m_lock;
+  QMutex m_refreshMutex;
+  QAtomicInt m_refreshed;
+  QAtomicInt m_refreshTotal;
+  QAtomicInt m_reloadRequested;
+  std::string m_collection;
+  size_t m_bitCount;
+  size_t m_wordCount;
+  size_t m_skippedCount;
+  std::vector<mongo::OID> m_ids;
+  std::vector<quint64> m_words;
+  std::vector<int> m_bitsSet;
+};
+
+} // end MongoChem namespace
+
+#endif // MONGOCHEM_FINGERPRINTINDEX_H
@@ -0,0 +1,341 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "fingerprintstore.h"
+
+#include "chemkit.h"
+#include "fingerprintindex.h"
+#include "mongodatabase.h"
+
+#include <chemkit/fingerprint.h>
+#include <chemkit/molecule.h>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <map>
+
+namespace MongoChem {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// Guards the cache of fingerprint sizes.
+QMutex sizesMutex;
+std::map<string, size_t> sizes;
+
+// Encodes @p fingerprint as little-endian 64-bit words.
+vector<char> encode(const chemkit::Bitset &fingerprint)
+{
+  vector<char> bytes(((fingerprint.size() + 63) / 64) * 8, 0);
+
+  for (size_t i = fingerprint.find_first();
+       i != chemkit::Bitset::npos;
+       i = fingerprint.find_next(i)) {
+    bytes[i / 8] |= static_cast<char>(1 << (i % 8));
+  }
+
+  return bytes;
+}
+
+struct BackfillItem
+{
+  mongo::OID id;
+  mongo::BSONObj obj;
+};
+
+// A range of molecules to be updated on a single thread.
+struct BackfillTask
+{
+  string collection;
+  const BackfillItem *begin;
+  const BackfillItem *end;
+  long updated;
+};
+
+struct RunBackfillTask
+{
+  void operator()(BackfillTask &task) const
+  {
+    ScopedMongoConnection conn(MongoDatabase::instance()->connectionPool());
+    if (!conn)
+      return;
+
+    for (const BackfillItem *item = task.begin; item != task.end; ++item) {
+      boost::shared_ptr<chemkit::Molecule> molecule =
+        ChemKit::createMolecule(item->obj);
+      if (!molecule)
+        molecule.reset(new chemkit::Molecule);
+
+      mongo::BSONObj fingerprints =
+        FingerprintStore::createFingerprints(molecule.get());
+
+      try {
+        conn->update(task.collection,
+                     QUERY("_id" << item->id),
+                     BSON("$set" << BSON("fingerprints" << fingerprints)));
+      }
+      catch (mongo::DBException &e) {
+        std::cerr << "Error: Failed to store fingerprints: "
+                  << e.what() << std::endl;
+        conn.setFailed();
+        return;
+      }
+
+      task.updated++;
+    }
+  }
+};
+
+} // end anonymous namespace
+
+const int FingerprintStore::Version;
+
+vector<string> FingerprintStore::fingerprintNames()
+{
+  vector<string> names;
+  names.push_back("fp2");
+  names.push_back("pubchem");
+  return names;
+}
+
+size_t FingerprintStore::fingerprintSize(const string &name)
+{
+  QMutexLocker locker(&sizesMutex);
+
+  std::map<string, size_t>::const_iterator iter = sizes.find(name);
+  if (iter != sizes.end())
+    return iter->second;
+
+  boost::scoped_ptr<chemkit::Fingerprint>
+    fingerprint(chemkit::Fingerprint::create(name));
+
+  size_t size = 0;
+  if (fingerprint) {
+    chemkit::Molecule empty;
+    size = fingerprint->value(&empty).size();
+  }
+
+  sizes[name] = size;
+  return size;
+}
+
+mongo::BSONObj
+FingerprintStore::createFingerprints(const chemkit::Molecule *molecule)
+{
+  mongo::BSONObjBuilder builder;
+  builder.append("version", Version);
+
+  vector<string> names = fingerprintNames();
+  for (size_t i = 0; i < names.size(); i++) {
+    boost::scoped_ptr<chemkit::Fingerprint>
+      fingerprint(chemkit::Fingerprint::create(names[i]));
+    if (!fingerprint)
+      continue;
+
+    vector<char> bytes = encode(fingerprint->value(molecule));
+    if (bytes.empty())
+      continue;
+
+    builder.appendBinData(names[i],
+                          static_cast<int>(bytes.size()),
+                          mongo::BinDataGeneral,
+                          &bytes[0]);
+  }
+
+  return builder.obj();
+}
+
+mongo::BSONObj FingerprintStore::fields(const string &name)
+{
+  mongo::BSONObjBuilder builder;
+  builder.append("fingerprints." + name, 1);
+
+  // older documents store the fp2 fingerprint in its own field
+  if (name == "fp2")
+    builder.append("fp2_fingerprint", 1);
+
+  return builder.obj();
+}
+
+bool FingerprintStore::readFingerprint(const mongo::BSONObj &obj,
+                                       const string &name,
+                                       quint64 *words,
+                                       size_t wordCount)
+{
+  std::fill(words, words + wordCount, 0);
+
+  int length = 0;
+  mongo::BSONElement element = obj.getFieldDotted("fingerprints." + name);
+  if (element.type() == mongo::BinData) {
+    const unsigned char *data =
+      reinterpret_cast<const unsigned char *>(element.binData(length));
+
+    size_t byteCount = std::min(static_cast<size_t>(qMax(0, length)),
+                                wordCount * sizeof(quint64));
+    for (size_t i = 0; i < byteCount; i++)
+      words[i / 8] |= static_cast<quint64>(data[i]) << (8 * (i % 8));
+
+    return true;
+  }
+
+  if (name == "fp2") {
+    // the legacy layout is the raw (native endian) blocks of the bitset
+    element = obj.getField("fp2_fingerprint");
+    if (element.type() == mongo::BinData) {
+      const char *data = element.binData(length);
+      memcpy(words, data, std::min(static_cast<size_t>(qMax(0, length)),
+                                   wordCount * sizeof(quint64)));
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool FingerprintStore::readFingerprint(const mongo::BSONObj &obj,
+                                       const string &name,
+                                       chemkit::Bitset &fingerprint)
+{
+  size_t size = fingerprintSize(name);
+  if (size == 0)
+    return false;
+
+  vector<quint64> words((size + 63) / 64);
+  if (!readFingerprint(obj, name, &words[0], words.size()))
+    return false;
+
+  fingerprint.clear();
+  fingerprint.resize(size);
+  for (size_t i = 0; i < size; i++) {
+    if ((words[i / 64] >> (i % 64)) & 1)
+      fingerprint.set(i);
+  }
+
+  return true;
+}
+
+long FingerprintStore::backfill(size_t batchSize)
+{
+  MongoDatabase *db = MongoDatabase::instance();
+  if (!db->isConnected())
+    return -1;
+
+  batchSize = std::max(batchSize, static_cast<size_t>(1));
+
+  // create each fingerprint once before starting the worker threads
+  vector<string> names = fingerprintNames();
+  for (size_t i = 0; i < names.size(); i++)
+    fingerprintSize(names[i]);
+
+  string collection = db->moleculesCollectionName();
+  mongo::BSONObj fieldsToReturn = BSON("smiles" << 1 << "inchi" << 1);
+
+  long updated = 0;
+  mongo::OID lastId;
+  bool firstBatch = true;
+
+  for (;;) {
+    // find the next batch of molecules without the current fingerprints. the
+    // _id condition ensures that molecules which could not be updated are
+    // not returned again.
+    mongo::BSONObjBuilder queryBuilder;
+    queryBuilder.append("fingerprints.version", BSON("$ne" << Version));
+    queryBuilder.append("inchi", BSON("$exists" << true));
+    if (!firstBatch)
+      queryBuilder.append("_id", BSON("$gt" << lastId));
+    mongo::Query query(queryBuilder.obj());
+    query.sort("_id");
+
+    vector<BackfillItem> items;
+    items.reserve(batchSize);
+    {
+      ScopedMongoConnection conn(db->connectionPool());
+      if (!conn)
+        return -1;
+
+      std::auto_ptr<mongo::DBClientCursor> cursor =
+        conn->query(collection, query, static_cast<int>(batchSize), 0,
+                    &fieldsToReturn);
+      if (!cursor.get()) {
+        conn.setFailed();
+        return -1;
+      }
+
+      while (cursor->more()) {
+        mongo::BSONObj obj = cursor->next();
+
+        mongo::BSONElement idElement;
+        if (!obj.getObjectID(idElement) || idElement.type() != mongo::jstOID)
+          continue;
+
+        BackfillItem item;
+        item.id = idElement.OID();
+        item.obj = obj.getOwned();
+        items.push_back(item);
+      }
+    }
+
+    if (items.empty())
+      break;
+
+    lastId = items.back().id;
+    firstBatch = false;
+
+    // split the batch between the worker threads
+    size_t taskCount =
+      std::min(static_cast<size_t>(qMax(1, QThread::idealThreadCount())),
+               items.size());
+    size_t taskSize = (items.size() + taskCount - 1) / taskCount;
+
+    vector<BackfillTask> tasks;
+    for (size_t i = 0; i < items.size(); i += taskSize) {
+      BackfillTask task;
+      task.collection = collection;
+      task.begin = &items[i];
+      task.end = &items[0] + std::min(items.size(), i + taskSize);
+      task.updated = 0;
+      tasks.push_back(task);
+    }
+
+    QtConcurrent::blockingMap(tasks, RunBackfillTask());
+
+    for (size_t i = 0; i < tasks.size(); i++)
+      updated += tasks[i].updated;
+
+    std::cout << "\rupdated fingerprints for " << updated << " molecules"
+              << std::flush;
+  }
+
+  std::cout << std::endl;
+
+  // the index may hold fingerprints calculated before they were stored
+  if (updated > 0)
+    FingerprintIndex::instance()->invalidate();
+
+  return updated;
+}
+
+} // end MongoChem namespace
@@ -0,0 +1,125 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_FINGERPRINTSTORE_H
+#define MONGOCHEM_FINGERPRINTSTORE_H
+
+#include "mongochemguiexport.h"
+
+#include <QtCore/QtGlobal>
+
+#include <chemkit/bitset.h>
+
+#include <mongo/client/dbclient.h>
+
+#include <string>
+#include <vector>
+
+namespace chemkit {
+class Molecule;
+}
+
+namespace MongoChem {
+
+/**
+ * @class FingerprintStore
+ * @brief The FingerprintStore class reads and writes the fingerprints stored
+ * in molecule documents.
+ *
+ * Fingerprints are stored in a "fingerprints" sub-document with the
+ * following layout:
+ *
+ * @code
+   fingerprints: {
+     version: 1,
+     fp2: BinData(...),
+     pubchem: BinData(...)
+   }
+ * @endcode
+ *
+ * In version 1 each fingerprint is stored as a sequence of little-endian
+ * 64-bit words with bit @c i of the fingerprint in bit @c (i % 64) of word
+ * @c (i / 64).
+ *
+ * Documents written by older versions of MongoChem may instead contain a
+ * "fp2_fingerprint" field holding the raw blocks of a chemkit::Bitset. This
+ * is still read for the fp2 fingerprint if the new layout is not present.
+ */
+class MONGOCHEMGUI_EXPORT FingerprintStore
+{
+public:
+  /** The version of the fingerprint layout written by this class. */
+  static const int Version = 1;
+
+  /** Returns the names of the fingerprints which are stored. */
+  static std::vector<std::string> fingerprintNames();
+
+  /**
+   * Returns the number of bits in the fingerprint named @p name, or 0 if
+   * there is no such fingerprint.
+   */
+  static size_t fingerprintSize(const std::string &name);
+
+  /**
+   * Calculates each fingerprint in fingerprintNames() for @p molecule and
+   * returns the "fingerprints" sub-document to store with the molecule.
+   */
+  static mongo::BSONObj createFingerprints(const chemkit::Molecule *molecule);
+
+  /**
+   * Returns a projection which selects the fields needed to read the
+   * fingerprint named @p name with readFingerprint().
+   */
+  static mongo::BSONObj fields(const std::string &name);
+
+  /**
+   * Reads the fingerprint named @p name from the molecule document @p obj
+   * into @p words as @p wordCount 64-bit words. Returns @c false if the
+   * fingerprint is not stored in @p obj.
+   */
+  static bool readFingerprint(const mongo::BSONObj &obj,
+                              const std::string &name,
+                              quint64 *words,
+                              size_t wordCount);
+
+  /**
+   * Reads the fingerprint named @p name from the molecule document @p obj
+   * into @p fingerprint. Returns @c false if the fingerprint is not stored
+   * in @p obj.
+   */
+  static bool readFingerprint(const mongo::BSONObj &obj,
+                              const std::string &name,
+                              chemkit::Bitset &fingerprint);
+
+  /**
+   * Calculates and stores the fingerprints for each molecule in the
+   * molecules collection which does not have the current version of the
+   * fingerprints stored. Molecules are processed in batches of
+   * @p batchSize on multiple threads. The molecules are created from their
+   * SMILES where available as only one thread at a time can read an InChI.
+   *
+   * The backfill may be interrupted at any time. Running it again will
+   * continue with the molecules which have not been updated yet.
+   *
+   * Returns the number of molecules updated or -1 if the database could not
+   * be queried.
+   */
+  static long backfill(size_t batchSize = 1000);
+};
+
+} // end MongoChem namespace
+
+#endif // MONGOCHEM_FINGERPRINTSTORE_H
@@ -0,0 +1,274 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "mongoconnectionpool.h"
+
+#include "mongodatabase.h"
+
+#include <mongo/client/dbclient.h>
+
+#include <QtCore/QMutexLocker>
+
+#include <iostream>
+
+namespace MongoChem {
+
+using std::string;
+
+MongoConnectionPool::MongoConnectionPool(const string &host_,
+                                         size_t maximumSize_)
+  : m_host(host_),
+    m_maximumSize(maximumSize_ > 0 ? maximumSize_ : 1),
+    m_healthCheckInterval(30000),
+    m_connecting(0)
+{
+}
+
+MongoConnectionPool::~MongoConnectionPool()
+{
+  QMutexLocker locker(&m_mutex);
+  clearIdleConnections();
+}
+
+void MongoConnectionPool::setHost(const string &host_)
+{
+  QMutexLocker locker(&m_mutex);
+  if (host_ == m_host)
+    return;
+
+  m_host = host_;
+  clearIdleConnections();
+  m_stale.insert(m_checkedOut.begin(), m_checkedOut.end());
+}
+
+string MongoConnectionPool::host() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_host;
+}
+
+void MongoConnectionPool::setMaximumSize(size_t size_)
+{
+  QMutexLocker locker(&m_mutex);
+  m_maximumSize = size_ > 0 ? size_ : 1;
+
+  // close idle connections that no longer fit in the pool
+  while (!m_idle.empty() && openCount() > m_maximumSize) {
+    delete m_idle.back().connection;
+    m_idle.pop_back();
+  }
+
+  m_connectionReleased.wakeAll();
+}
+
+size_t MongoConnectionPool::maximumSize() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_maximumSize;
+}
+
+void MongoConnectionPool::setHealthCheckInterval(int msecs)
+{
+  QMutexLocker locker(&m_mutex);
+  m_healthCheckInterval = msecs;
+}
+
+int MongoConnectionPool::healthCheckInterval() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_healthCheckInterval;
+}
+
+size_t MongoConnectionPool::size() const
+{
+  QMutexLocker locker(&m_mutex);
+  return openCount();
+}
+
+size_t MongoConnectionPool::idleCount() const
+{
+  QMutexLocker locker(&m_mutex);
+  return m_idle.size();
+}
+
+mongo::DBClientConnection* MongoConnectionPool::acquire(int timeout)
+{
+  QElapsedTimer timer;
+  timer.start();
+
+  QMutexLocker locker(&m_mutex);
+
+  for (;;) {
+    // reuse an idle connection if there is a healthy one available
+    while (!m_idle.empty()) {
+      IdleConnection idle = m_idle.back();
+      m_idle.pop_back();
+
+      if (idle.connection->isFailed()) {
+        delete idle.connection;
+        continue;
+      }
+
+      // the connection is checked out while it is pinged so that it is
+      // marked stale if the host changes in the meantime
+      m_checkedOut.insert(idle.connection);
+
+      // only ping connections which have been sitting idle for a while, and
+      // without holding the lock as it waits for the server
+      if (idle.idleTime.elapsed() < m_healthCheckInterval)
+        return idle.connection;
+
+      locker.unlock();
+      bool healthy = ping(idle.connection);
+      locker.relock();
+
+      bool stale = m_stale.erase(idle.connection) > 0;
+      if (healthy && !stale)
+        return idle.connection;
+
+      m_checkedOut.erase(idle.connection);
+      delete idle.connection;
+    }
+
+    // open a new connection if the pool has room for one
+    if (openCount() < m_maximumSize)
+      break;
+
+    // otherwise wait for another thread to return its connection
+    if (timeout < 0) {
+      m_connectionReleased.wait(&m_mutex);
+    }
+    else {
+      qint64 remaining = timeout - timer.elapsed();
+      if (remaining <= 0 ||
+          !m_connectionReleased.wait(&m_mutex,
+                                     static_cast<unsigned long>(remaining)))
+        return 0;
+    }
+  }
+
+  // reserve a slot for the new connection and connect without holding the
+  // lock so that other threads are not blocked while the connection is made
+  string host_ = m_host;
+  m_connecting++;
+  locker.unlock();
+
+  mongo::DBClientConnection *connection = connect(host_);
+
+  locker.relock();
+  m_connecting--;
+  if (connection)
+    m_checkedOut.insert(connection);
+  else
+    m_connectionReleased.wakeOne();
+
+  return connection;
+}
+
+void MongoConnectionPool::release(mongo::DBClientConnection *connection,
+                                  bool failed)
+{
+  if (!connection)
+    return;
+
+  QMutexLocker locker(&m_mutex);
+
+  m_checkedOut.erase(connection);
+
+  bool stale = m_stale.erase(connection) > 0;
+  if (failed || stale || connection->isFailed() ||
+      openCount() >= m_maximumSize) {
+    delete connection;
+  }
+  else {
+    IdleConnection idle;
+    idle.connection = connection;
+    idle.idleTime.start();
+    m_idle.push_back(idle);
+  }
+
+  m_connectionReleased.wakeOne();
+}
+
+void MongoConnectionPool::clear()
+{
+  QMutexLocker locker(&m_mutex);
+  clearIdleConnections();
+  m_stale.insert(m_checkedOut.begin(), m_checkedOut.end());
+}
+
+mongo::DBClientConnection* MongoConnectionPool::connect(const string &host_) const
+{
+  mongo::DBClientConnection *connection = new mongo::DBClientConnection;
+
+  try {
+    connection->connect(host_);
+  }
+  catch (mongo::DBException &e) {
+    std::cerr << "Error: Failed to connect to MongoDB at '"
+              << host_
+              << "': "
+              << e.what()
+              << std::endl;
+    delete connection;
+    return 0;
+  }
+
+  return connection;
+}
+
+bool MongoConnectionPool::ping(mongo::DBClientConnection *connection) const
+{
+  try {
+    mongo::BSONObj info;
+    return connection->runCommand("admin", BSON("ping" << 1), info);
+  }
+  catch (mongo::DBException &) {
+    return false;
+  }
+}
+
+size_t MongoConnectionPool::openCount() const
+{
+  return m_idle.size() + m_checkedOut.size() + m_connecting;
+}
+
+void MongoConnectionPool::clearIdleConnections()
+{
+  for (size_t i = 0; i < m_idle.size(); i++)
+    delete m_idle[i].connection;
+  m_idle.clear();
+}
+
+ScopedMongoConnection::ScopedMongoConnection(MongoConnectionPool *pool,
+                                             int timeout)
+  : m_pool(pool),
+    m_connection(0),
+    m_failed(false)
+{
+  if (!m_pool)
+    m_pool = MongoDatabase::instance()->connectionPool();
+
+  m_connection = m_pool->acquire(timeout);
+}
+
+ScopedMongoConnection::~ScopedMongoConnection()
+{
+  if (m_connection)
+    m_pool->release(m_connection, m_failed);
+}
+
+} // end MongoChem namespace
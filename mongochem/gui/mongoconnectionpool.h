@@ -0,0 +1,220 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_MONGOCONNECTIONPOOL_H
+#define MONGOCHEM_MONGOCONNECTIONPOOL_H
+
+#include "mongochemguiexport.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QMutex>
+#include <QtCore/QWaitCondition>
+
+#include <set>
+#include <string>
+#include <vector>
+
+namespace mongo {
+class DBClientConnection;
+}
+
+namespace MongoChem {
+
+/**
+ * @class MongoConnectionPool
+ * @brief The MongoConnectionPool class manages a set of connections to a
+ * MongoDB server which can be shared between threads.
+ *
+ * A mongo::DBClientConnection may only be used by one thread at a time. The
+ * connection pool hands out a connection to each caller of acquire() and
+ * takes it back with release(). Connections are created lazily, up to
+ * maximumSize(), after which acquire() blocks until another thread returns
+ * a connection.
+ *
+ * Connections that report a failure are discarded when they are returned,
+ * and idle connections are pinged before being handed out again if they
+ * have not been used within healthCheckInterval() milliseconds.
+ *
+ * Most code should use the ScopedMongoConnection class rather than calling
+ * acquire() and release() directly.
+ *
+ * All methods in this class are thread-safe.
+ */
+class MONGOCHEMGUI_EXPORT MongoConnectionPool
+{
+public:
+  /**
+   * Creates a new connection pool for the server at @p host with at most
+   * @p maximumSize open connections.
+   */
+  explicit MongoConnectionPool(const std::string &host = std::string(),
+                               size_t maximumSize = 8);
+
+  /** Destroys the connection pool and closes all idle connections. */
+  ~MongoConnectionPool();
+
+  /**
+   * Sets the host to connect to. Idle connections to the previous host are
+   * closed and connections currently checked out are closed when returned.
+   */
+  void setHost(const std::string &host);
+
+  /** Returns the host that the pool connects to. */
+  std::string host() const;
+
+  /** Sets the maximum number of open connections to @p size. */
+  void setMaximumSize(size_t size);
+
+  /** Returns the maximum number of open connections. */
+  size_t maximumSize() const;
+
+  /**
+   * Sets the number of milliseconds a connection may sit idle before it is
+   * pinged prior to being handed out again. The default is 30 seconds.
+   */
+  void setHealthCheckInterval(int msecs);
+
+  /** Returns the health check interval in milliseconds. */
+  int healthCheckInterval() const;
+
+  /** Returns the number of open connections (both idle and checked out). */
+  size_t size() const;
+
+  /** Returns the number of idle connections waiting in the pool. */
+  size_t idleCount() const;
+
+  /**
+   * Checks out a connection from the pool. If the pool is at its maximum
+   * size this waits up to @p timeout milliseconds (or forever if @p timeout
+   * is negative) for a connection to be returned.
+   *
+   * Returns 0 if a connection could not be made or the timeout expired.
+   * Every connection returned from this method must be given back with
+   * release().
+   */
+  mongo::DBClientConnection* acquire(int timeout = -1);
+
+  /**
+   * Returns @p connection to the pool. If @p failed is @c true, or the
+   * connection reports a failure, it is closed instead of being reused.
+   */
+  void release(mongo::DBClientConnection *connection, bool failed = false);
+
+  /**
+   * Closes all idle connections. Connections currently checked out will be
+   * closed when they are returned.
+   */
+  void clear();
+
+private:
+  struct IdleConnection
+  {
+    mongo::DBClientConnection *connection;
+    QElapsedTimer idleTime;
+  };
+
+  /** Opens a new connection to host(). Returns 0 on failure. */
+  mongo::DBClientConnection* connect(const std::string &host) const;
+
+  /**
+   * Returns @c true if the server responds to a ping on @p connection. Must
+   * be called without m_mutex locked.
+   */
+  bool ping(mongo::DBClientConnection *connection) const;
+
+  /**
+   * Returns the number of idle, checked out and pending connections. Must be
+   * called with m_mutex locked.
+   */
+  size_t openCount() const;
+
+  /** Closes all idle connections. Must be called with m_mutex locked. */
+  void clearIdleConnections();
+
+private:
+  mutable QMutex m_mutex;
+  QWaitCondition m_connectionReleased;
+  std::string m_host;
+  size_t m_maximumSize;
+  int m_healthCheckInterval;
+  size_t m_connecting;
+  std::vector<IdleConnection> m_idle;
+  std::set<mongo::DBClientConnection *> m_checkedOut;
+  std::set<mongo::DBClientConnection *> m_stale;
+};
+
+/**
+ * @class ScopedMongoConnection
+ * @brief The ScopedMongoConnection class checks out a connection from a
+ * MongoConnectionPool for the lifetime of the object.
+ *
+ * @code
+   ScopedMongoConnection conn;
+   if (conn)
+     conn->update(collection, query, update);
+ * @endcode
+ *
+ * If no pool is given the connection pool of MongoDatabase::instance() is
+ * used.
+ */
+class MONGOCHEMGUI_EXPORT ScopedMongoConnection
+{
+private:
+  typedef void (ScopedMongoConnection::*boolType)();
+  void trueBoolType() { }
+
+public:
+  /**
+   * Checks out a connection from @p pool, waiting at most @p timeout
+   * milliseconds (or forever if @p timeout is negative).
+   */
+  explicit ScopedMongoConnection(MongoConnectionPool *pool = 0,
+                                 int timeout = -1);
+
+  /** Returns the connection to the pool. */
+  ~ScopedMongoConnection();
+
+  /** Returns the connection, or 0 if no connection could be made. */
+  mongo::DBClientConnection* get() const { return m_connection; }
+
+  mongo::DBClientConnection* operator->() const { return m_connection; }
+
+  /** Returns @c true if a connection was checked out. */
+  bool isValid() const { return m_connection != 0; }
+
+  /**
+   * Marks the connection as broken so that it is closed rather than being
+   * returned to the pool.
+   */
+  void setFailed() { m_failed = true; }
+
+  operator boolType() const
+  {
+    return isValid() ? &ScopedMongoConnection::trueBoolType : 0;
+  }
+
+private:
+  ScopedMongoConnection(const ScopedMongoConnection &);
+  ScopedMongoConnection& operator=(const ScopedMongoConnection &);
+
+  MongoConnectionPool *m_pool;
+  mongo::DBClientConnection *m_connection;
+  bool m_failed;
+};
+
+} // end MongoChem namespace
+
+#endif // MONGOCHEM_MONGOCONNECTIONPOOL_H
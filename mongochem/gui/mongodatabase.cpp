@@ -19,8 +19,12 @@
 #include <boost/range/algorithm.hpp>
 #include <boost/algorithm/string/predicate.hpp>
 
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
 #include <QtCore/QSettings>
+#include <QtCore/QThread>
 
+#include <map>
 #include <set>
 
 namespace MongoChem {
@@ -33,6 +37,18 @@ using std::endl;
 using std::flush;
 using std::vector;
 
+namespace {
+
+// Guards the creation and deletion of the main connection in
+// MongoDatabase::instance() and MongoDatabase::disconnect().
+QMutex instanceMutex;
+
+// The maximum number of molecules requested by a single query in
+// MongoDatabase::fetchMolecules().
+const size_t fetchMoleculesBatchSize = 1000;
+
+}
+
 MongoDatabase::MongoDatabase() : m_db(NULL)
 {
 }
@@ -46,12 +62,26 @@ MongoDatabase* MongoDatabase::instance()
 {
   static MongoDatabase singleton;
 
+  // the lock is only needed until the connection is made
+  if (singleton.isConnected())
+    return &singleton;
+
+  QMutexLocker locker(&instanceMutex);
+
   if (!singleton.isConnected()) {
     // Connect to the database.
     mongo::DBClientConnection *db = new mongo::DBClientConnection;
 
     QSettings settings;
     string host = settings.value("hostname").toString().toStdString();
+
+    // Setup the connection pool used by worker threads.
+    int poolSize =
+      settings.value("connectionPoolSize",
+                     qMax(4, QThread::idealThreadCount() + 2)).toInt();
+    singleton.m_pool.setHost(host);
+    singleton.m_pool.setMaximumSize(static_cast<size_t>(qMax(1, poolSize)));
+
     try {
       cout << "connecting to: " << host;
       flush(cout);
@@ -70,6 +100,7 @@ MongoDatabase* MongoDatabase::instance()
     }
 
     singleton.m_db = db;
+    singleton.m_connected.storeRelease(db ? 1 : 0);
   }
 
   return &singleton;
@@ -77,13 +108,21 @@ MongoDatabase* MongoDatabase::instance()
 
 void MongoDatabase::disconnect()
 {
+  QMutexLocker locker(&instanceMutex);
+
+  // stop new requests from worker threads and close the pooled connections
+  // before the main connection. the workers only use pooled connections and
+  // the ones still in use are closed when they are returned.
+  m_connected.storeRelease(0);
+  m_pool.clear();
+
   delete m_db;
   m_db = 0;
 }
 
 bool MongoDatabase::isConnected() const
 {
-  return m_db != 0;
+  return m_connected.loadAcquire() != 0;
 }
 
 mongo::DBClientConnection* MongoDatabase::connection() const
@@ -91,22 +130,37 @@ mongo::DBClientConnection* MongoDatabase::connection() const
   return m_db;
 }
 
+MongoConnectionPool* MongoDatabase::connectionPool()
+{
+  return &m_pool;
+}
+
 std::auto_ptr<mongo::DBClientCursor>
 MongoDatabase::query(const string &collection,
                      const mongo::Query &query_,
                      int limit,
-                     int skip)
+                     int skip,
+                     const mongo::BSONObj &fields,
+                     int batchSize)
 {
-  if(!m_db)
+  if (!isConnected())
     return std::auto_ptr<mongo::DBClientCursor>();
 
-  return m_db->query(collection, query_, limit, skip);
+  const mongo::BSONObj *fieldsToReturn = fields.isEmpty() ? 0 : &fields;
+
+  return m_db->query(collection, query_, limit, skip, fieldsToReturn, 0,
+                     batchSize);
 }
 
 std::auto_ptr<mongo::DBClientCursor>
-MongoDatabase::queryMolecules(const mongo::Query &query_, int limit, int skip)
+MongoDatabase::queryMolecules(const mongo::Query &query_,
+                              int limit,
+                              int skip,
+                              const mongo::BSONObj &fields,
+                              int batchSize)
 {
-  return query(moleculesCollectionName(), query_, limit, skip);
+  return query(moleculesCollectionName(), query_, limit, skip, fields,
+               batchSize);
 }
 
 string MongoDatabase::userName() const
@@ -118,14 +172,88 @@ string MongoDatabase::userName() const
 MoleculeRef MongoDatabase::findMoleculeFromIdentifier(const string &identifier,
                                                       const string &format)
 {
-  if (!m_db)
+  if (!isConnected())
+    return MoleculeRef();
+
+  ScopedMongoConnection conn(&m_pool);
+  if (!conn)
     return MoleculeRef();
 
   string collection = moleculesCollectionName();
-  mongo::BSONObj obj = m_db->findOne(collection, QUERY(format << identifier));
+  mongo::BSONObj obj = conn->findOne(collection, QUERY(format << identifier));
   return createMoleculeRefForBSONObj(obj);
 }
 
+vector<MoleculeRef>
+MongoDatabase::findMoleculesFromIdentifiers(const vector<string> &identifiers,
+                                            const string &format)
+{
+  vector<MoleculeRef> molecules(identifiers.size());
+  if (!isConnected() || identifiers.empty())
+    return molecules;
+
+  ScopedMongoConnection conn(&m_pool);
+  if (!conn)
+    return molecules;
+
+  string collection = moleculesCollectionName();
+  mongo::BSONObj fieldsToReturn = BSON("_id" << 1 << format << 1);
+
+  // The identifiers are looked up in chunks to keep each query document well
+  // below the maximum BSON document size.
+  size_t i = 0;
+  while (i < identifiers.size()) {
+    // map from identifier to the position(s) of the identifier in the input
+    std::map<string, vector<size_t> > positions;
+    mongo::BSONArrayBuilder values;
+
+    for (; i < identifiers.size() &&
+           positions.size() < fetchMoleculesBatchSize; i++) {
+      if (identifiers[i].empty())
+        continue;
+
+      vector<size_t> &identifierPositions = positions[identifiers[i]];
+      if (identifierPositions.empty())
+        values << identifiers[i];
+      identifierPositions.push_back(i);
+    }
+
+    if (positions.empty())
+      continue;
+
+    std::auto_ptr<mongo::DBClientCursor> cursor =
+      conn->query(collection,
+                  QUERY(format << BSON("$in" << values.arr())),
+                  0,
+                  0,
+                  &fieldsToReturn,
+                  0,
+                  static_cast<int>(positions.size()));
+    if (!cursor.get()) {
+      conn.setFailed();
+      break;
+    }
+
+    while (cursor->more()) {
+      mongo::BSONObj obj = cursor->next();
+
+      std::map<string, vector<size_t> >::iterator iter =
+        positions.find(obj.getStringField(format.c_str()));
+      if (iter == positions.end())
+        continue;
+
+      // the first molecule found for an identifier is used, the same as
+      // findMoleculeFromIdentifier()
+      MoleculeRef ref = createMoleculeRefForBSONObj(obj);
+      for (size_t j = 0; j < iter->second.size(); j++)
+        molecules[iter->second[j]] = ref;
+      positions.erase(iter);
+    }
+  }
+
+  return molecules;
+}
+
 MoleculeRef MongoDatabase::findMoleculeFromInChI(const string &inchi)
 {
   return findMoleculeFromIdentifier(inchi, "inchi");
@@ -138,7 +266,7 @@ MoleculeRef MongoDatabase::findMoleculeFromInChIKey(const string &inchikey)
 
 MoleculeRef MongoDatabase::findMoleculeFromBSONObj(const mongo::BSONObj *obj)
 {
-  if (!m_db)
+  if (!isConnected())
     return MoleculeRef();
 
   mongo::BSONElement inchikeyElement = obj->getField("inchikey");
@@ -150,19 +278,86 @@ MoleculeRef MongoDatabase::findMoleculeFromBSONObj(const mongo::BSONObj *obj)
 
 mongo::BSONObj MongoDatabase::fetchMolecule(const MoleculeRef &molecule)
 {
-  if (!m_db)
+  if (!isConnected() || !molecule.isValid())
+    return mongo::BSONObj();
+
+  ScopedMongoConnection conn(&m_pool);
+  if (!conn)
     return mongo::BSONObj();
 
   string collection = moleculesCollectionName();
-  return m_db->findOne(collection, QUERY("_id" << mongo::OID(molecule.id())));
+  return conn->findOne(collection, QUERY("_id" << mongo::OID(molecule.id())));
 }
 
-vector<mongo::BSONObj> MongoDatabase::fetchMolecules(const vector<MoleculeRef> &molecules)
+vector<mongo::BSONObj>
+MongoDatabase::fetchMolecules(const vector<MoleculeRef> &molecules,
+                              const mongo::BSONObj &fields)
 {
-  vector<mongo::BSONObj> objs;
+  vector<mongo::BSONObj> objs(molecules.size());
+  if (!isConnected() || molecules.empty())
+    return objs;
+
+  ScopedMongoConnection conn(&m_pool);
+  if (!conn)
+    return objs;
+
+  string collection = moleculesCollectionName();
+  const mongo::BSONObj *fieldsToReturn = fields.isEmpty() ? 0 : &fields;
+
+  // The molecules are fetched in chunks to keep each query document well
+  // below the maximum BSON document size.
+  size_t i = 0;
+  while (i < molecules.size()) {
+    // map from object id to the position(s) of the molecule in the input
+    std::map<string, vector<size_t> > positions;
+    mongo::BSONArrayBuilder ids;
+
+    for (; i < molecules.size() && positions.size() < fetchMoleculesBatchSize;
+         i++) {
+      const MoleculeRef &ref = molecules[i];
+      if (!ref.isValid())
+        continue;
+
+      vector<size_t> &refPositions = positions[ref.id()];
+      if (refPositions.empty())
+        ids << mongo::OID(ref.id());
+      refPositions.push_back(i);
+    }
+
+    if (positions.empty())
+      continue;
+
+    std::auto_ptr<mongo::DBClientCursor> cursor =
+      conn->query(collection,
+                  QUERY("_id" << BSON("$in" << ids.arr())),
+                  0,
+                  0,
+                  fieldsToReturn,
+                  0,
+                  static_cast<int>(positions.size()));
+    if (!cursor.get()) {
+      conn.setFailed();
+      break;
+    }
+
+    while (cursor->more()) {
+      mongo::BSONObj obj = cursor->next();
 
-  for (size_t i = 0; i < molecules.size(); ++i)
-    objs.push_back(fetchMolecule(molecules[i]));
+      mongo::BSONElement idElement;
+      if (!obj.getObjectID(idElement))
+        continue;
+
+      std::map<string, vector<size_t> >::const_iterator iter =
+        positions.find(idElement.OID().str());
+      if (iter == positions.end())
+        continue;
+
+      // the object is only valid as long as the cursor so make a copy
+      obj = obj.getOwned();
+      for (size_t j = 0; j < iter->second.size(); j++)
+        objs[iter->second[j]] = obj;
+    }
+  }
 
   return objs;
 }
@@ -173,13 +368,17 @@ void MongoDatabase::addAnnotation(const MoleculeRef &ref,
   if (!ref.isValid())
     return;
 
+  ScopedMongoConnection conn(&m_pool);
+  if (!conn)
+    return;
+
   // add new annotation
   mongo::BSONObjBuilder annotation;
   annotation.append("user", userName());
   annotation.append("comment", comment);
 
   // store annotations
-  m_db->update(moleculesCollectionName(),
+  conn->update(moleculesCollectionName(),
                QUERY("_id" << mongo::OID(ref.id())),
                BSON("$push" << BSON("annotations" << annotation.obj())),
                false,
@@ -191,12 +390,16 @@ void MongoDatabase::deleteAnnotation(const MoleculeRef &ref, size_t index)
   if (!ref.isValid())
     return;
 
+  ScopedMongoConnection conn(&m_pool);
+  if (!conn)
+    return;
+
   // identifer for the item in the annotations array
   stringstream id;
   id << "annotations." << index;
 
   // set the value at index to null
-  m_db->update(moleculesCollectionName(),
+  conn->update(moleculesCollectionName(),
                QUERY("_id" << mongo::OID(ref.id())),
                BSON("$unset" << BSON(id.str() << 1)),
                false,
@@ -205,7 +408,7 @@ void MongoDatabase::deleteAnnotation(const MoleculeRef &ref, size_t index)
   // remove all null entries from the list
   mongo::BSONObjBuilder builder;
   builder.appendNull("annotations");
-  m_db->update(moleculesCollectionName(),
+  conn->update(moleculesCollectionName(),
                QUERY("_id" << mongo::OID(ref.id())),
                BSON("$pull" << builder.obj()),
                false,
@@ -219,12 +422,16 @@ void MongoDatabase::updateAnnotation(const MoleculeRef &ref,
   if (!ref.isValid())
     return;
 
+  ScopedMongoConnection conn(&m_pool);
+  if (!conn)
+    return;
+
   // identifer for the item in the annotations array
   stringstream id;
   id << "annotations." << index << ".comment";
 
   // update the record with the new comment
-  m_db->update(moleculesCollectionName(),
+  conn->update(moleculesCollectionName(),
                QUERY("_id" << mongo::OID(ref.id())),
                BSON("$set" << BSON(id.str() << comment)),
                false,
@@ -236,7 +443,11 @@ void MongoDatabase::addTag(const MoleculeRef &ref, const string &tag)
   if (!ref.isValid())
     return;
 
-  m_db->update(moleculesCollectionName(),
+  ScopedMongoConnection conn(&m_pool);
+  if (!conn)
+    return;
+
+  conn->update(moleculesCollectionName(),
                QUERY("_id" << mongo::OID(ref.id())),
                BSON("$addToSet" << BSON("tags" << tag)),
                false,
@@ -248,7 +459,11 @@ void MongoDatabase::removeTag(const MoleculeRef &ref, const string &tag)
   if (!ref.isValid())
     return;
 
-  m_db->update(moleculesCollectionName(),
+  ScopedMongoConnection conn(&m_pool);
+  if (!conn)
+    return;
+
+  conn->update(moleculesCollectionName(),
                QUERY("_id" << mongo::OID(ref.id())),
                BSON("$pull" << BSON("tags" << tag)),
                false,
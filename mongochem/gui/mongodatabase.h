@@ -19,6 +19,9 @@
 
 #include "mongochemguiexport.h"
 #include "moleculeref.h"
+#include "mongoconnectionpool.h"
+
+#include <QtCore/QAtomicInt>
 
 #include <string>
 #include <vector>
@@ -41,9 +44,14 @@ namespace MongoChem {
  * The fetch*() methods take MoleculeRef's and return BSONObj's containing the
  * corresponding molecular data.
  *
+ * The find*(), fetch*(), tag and annotation methods check out a connection
+ * from connectionPool() for each call and may be used from any thread. Code
+ * running on a worker thread which needs a cursor should check out its own
+ * connection with ScopedMongoConnection.
+ *
  * @warning The first invocation of @p instance() forms a persistant connection
- * to the mongo database. This method is not reentrant and should be called only
- * from a single thread.
+ * to the mongo database. The connection returned by connection() and the
+ * cursors returned by query() must only be used from the GUI thread.
  */
 
 class MONGOCHEMGUI_EXPORT MongoDatabase
@@ -52,33 +60,60 @@ public:
   /** Returns an instance of the singleton mongo database. */
   static MongoDatabase* instance();
 
-  /** Disconnect from the currently connected MongoDB server. */
+  /**
+   * Disconnect from the currently connected MongoDB server. The idle pooled
+   * connections are closed, and the pooled connections still in use by
+   * worker threads are closed when they are returned.
+   */
   void disconnect();
 
   /**
    * Returns @c true if the database object is connected to the mongo database
-   * server.
+   * server. This may be called from any thread.
    */
   bool isConnected() const;
 
-  /** Returns the connection to the mongo database. */
+  /**
+   * Returns the connection to the mongo database. This connection must only
+   * be used from the GUI thread.
+   */
   mongo::DBClientConnection* connection() const;
 
+  /**
+   * Returns the pool of connections to the mongo database. Connections
+   * checked out from the pool may be used from any thread.
+   */
+  MongoConnectionPool* connectionPool();
+
   /**
    * Performs a query on @p collection and returns the cursor.
+   *
+   * If @p fields is not empty only the fields it specifies are returned for
+   * each document, e.g. BSON("name" << 1 << "descriptors.mass" << 1).
+   *
+   * If @p batchSize is not zero the server returns up to that many documents
+   * per round trip, otherwise the server's default is used.
    */
-  std::auto_ptr<mongo::DBClientCursor> query(const std::string &collection,
-                                             const mongo::Query &query_,
-                                             int limit = 0,
-                                             int skip = 0);
+  std::auto_ptr<mongo::DBClientCursor>
+  query(const std::string &collection,
+        const mongo::Query &query_,
+        int limit = 0,
+        int skip = 0,
+        const mongo::BSONObj &fields = mongo::BSONObj(),
+        int batchSize = 0);
 
   /**
    * Performs a query on the molecules collection and returns the cursor.
+   *
+   * If @p fields is not empty only the fields it specifies are returned for
+   * each molecule. See query() for @p batchSize.
    */
   std::auto_ptr<mongo::DBClientCursor>
   queryMolecules(const mongo::Query &query_,
                  int limit = 0,
-                 int skip = 0);
+                 int skip = 0,
+                 const mongo::BSONObj &fields = mongo::BSONObj(),
+                 int batchSize = 0);
 
   /** Returns the current user name. */
   std::string userName() const;
@@ -90,6 +125,18 @@ public:
   MoleculeRef findMoleculeFromIdentifier(const std::string &identifier,
                                          const std::string &format);
 
+  /**
+   * Queries the database for the molecules with @p identifiers in @p format.
+   * The molecules are looked up with a small number of batched queries rather
+   * than one query per identifier.
+   *
+   * The returned vector has the same size and order as @p identifiers.
+   * Identifiers which were not found are returned as null references.
+   */
+  std::vector<MoleculeRef>
+  findMoleculesFromIdentifiers(const std::vector<std::string> &identifiers,
+                               const std::string &format);
+
   /** Returns a molecule ref corresponding to the molecule with @p inchi. */
   MoleculeRef findMoleculeFromInChI(const std::string &inchi);
 
@@ -110,8 +157,19 @@ public:
   /**
    * Returns a vector of BSONObj's containing the data for the molecules
    * referenced by @p molecules.
+   *
+   * The molecules are fetched with a small number of batched queries rather
+   * than one query per molecule. The returned vector has the same size and
+   * order as @p molecules. Invalid references and molecules which could not
+   * be found are returned as empty BSONObj's.
+   *
+   * If @p fields is not empty only the fields it specifies (along with the
+   * "_id" field) are returned for each molecule, e.g.
+   * BSON("inchi" << 1 << "name" << 1).
    */
-  std::vector<mongo::BSONObj> fetchMolecules(const std::vector<MoleculeRef> &molecules);
+  std::vector<mongo::BSONObj>
+  fetchMolecules(const std::vector<MoleculeRef> &molecules,
+                 const mongo::BSONObj &fields = mongo::BSONObj());
 
   /**
    * Set the @p property for the molecule contained in @p ref to @p value. This
@@ -122,8 +180,15 @@ public:
                            const std::string &property,
                            const T &value)
   {
-    m_db->update(moleculesCollectionName(),
-                 QUERY("_id" << ref.id()),
+    if (!ref.isValid())
+      return;
+
+    ScopedMongoConnection conn(&m_pool);
+    if (!conn)
+      return;
+
+    conn->update(moleculesCollectionName(),
+                 QUERY("_id" << mongo::OID(ref.id())),
                  BSON("$set" << BSON(property << value)),
                  true,
                  true);
@@ -181,6 +246,8 @@ private:
 
 private:
   mongo::DBClientConnection *m_db;
+  QAtomicInt m_connected;
+  MongoConnectionPool m_pool;
 };
 
 } // end MongoChem namespace
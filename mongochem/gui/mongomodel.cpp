@@ -26,47 +26,442 @@
 #include <QtCore/QSize>
 #include <QtCore/QDebug>
 #include <QtGui/QColor>
+#include <QtGui/QImage>
 #include <QtGui/QPixmap>
+#include <QtGui/QPixmapCache>
 #include <QtCore/QSettings>
+#include <QtCore/QAtomicInt>
+#include <QtCore/QFutureWatcher>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QSet>
+#include <QtCore/QSharedPointer>
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <boost/scoped_ptr.hpp>
 
 #include <vtkNew.h>
 #include <vtkTable.h>
 #include <vtkFloatArray.h>
 #include <vtkStringArray.h>
 
+#include <algorithm>
+#include <deque>
+#include <list>
+#include <map>
+#include <set>
+
+#include "mongoconnectionpool.h"
 #include "mongodatabase.h"
 
 using namespace mongo;
 
 namespace MongoChem {
 
+namespace {
+
+// The cursor for a query run by the model. It is shared with the worker
+// threads which fetch its rows so that a fetch still in progress when the
+// query is replaced keeps it alive until it is done.
+struct QueryState
+{
+  QueryState(const std::string &collection_, const mongo::Query &query_)
+    : collection(collection_),
+      query(query_),
+      canceled(0)
+  {
+  }
+
+  QMutex mutex;
+  std::string collection;
+  mongo::Query query;
+  QAtomicInt canceled;
+  // the cursor must be destroyed before its connection is returned
+  boost::scoped_ptr<ScopedMongoConnection> connection;
+  std::auto_ptr<DBClientCursor> cursor;
+};
+
+struct FetchResult
+{
+  FetchResult() : more(false) { }
+
+  std::vector<BSONObj> rows;
+  bool more;
+};
+
+// The number of rows added to the model each time the view asks for more.
+const int fetchMoreCount = 100;
+
+// The number of rows fetched in the background ahead of those shown so that
+// they can be added without waiting for the server when the view scrolls.
+const int readAheadCount = 500;
+
+// Fetches the next @p count rows for @p state. This runs on a worker thread.
+// The query itself is sent with the first fetch.
+FetchResult fetchRows(QSharedPointer<QueryState> state, int count)
+{
+  QMutexLocker locker(&state->mutex);
+
+  FetchResult result;
+  if (state->canceled.load())
+    return result;
+
+  try {
+    if (!state->connection) {
+      state->connection.reset(
+        new ScopedMongoConnection(MongoDatabase::instance()->connectionPool()));
+      if (!*state->connection)
+        return result;
+
+      state->cursor = (*state->connection)->query(state->collection,
+                                                  state->query);
+      if (!state->cursor.get()) {
+        state->connection->setFailed();
+        return result;
+      }
+    }
+    else if (!state->cursor.get()) {
+      return result;
+    }
+
+    while (count-- > 0 && !state->canceled.load() && state->cursor->more())
+      result.rows.push_back(state->cursor->next().getOwned());
+
+    result.more = state->cursor->more();
+  }
+  catch (mongo::DBException &e) {
+    std::cerr << "Failed to query MongoDB: " << e.what() << std::endl;
+    state->cursor.reset();
+    state->connection->setFailed();
+    result.more = false;
+  }
+
+  return result;
+}
+
+// The number of rows in each page of the row cache.
+const int rowsPerPage = 100;
+
+// The number of most recently used pages which are never evicted. This keeps
+// the rows on screen in memory even with a very small memory budget.
+const size_t minimumResidentPages = 4;
+
+// The default memory budget for the row cache in megabytes.
+const int defaultMemoryBudget = 64;
+
+struct PageResult
+{
+  PageResult() : generation(0), page(0) { }
+
+  int generation;
+  int page;
+  std::vector<BSONObj> rows;
+};
+
+// Fetches the molecules in a page which was evicted from the row cache. This
+// runs on a worker thread.
+PageResult fetchPage(int generation, int page,
+                     const std::vector<MoleculeRef> &molecules)
+{
+  PageResult result;
+  result.generation = generation;
+  result.page = page;
+  result.rows = MongoDatabase::instance()->fetchMolecules(molecules);
+  return result;
+}
+
+// The size diagrams are shown at in the table.
+const int diagramSize = 250;
+
+// The minimum size of the pixmap cache in kilobytes. This holds a few
+// hundred decoded diagrams, enough to scroll back and forth over several
+// screens without decoding them again.
+const int minimumPixmapCacheLimit = 64 * 1024;
+
+struct DecodeResult
+{
+  DecodeResult() : generation(0), row(0) { }
+
+  int generation;
+  int row;
+  QString key;
+  QImage image;
+};
+
+// Decodes the PNG diagram for the molecule in @p row and scales it to fit
+// the diagram column. This runs on a worker thread. QPixmaps can only be
+// created on the GUI thread, so the result is returned as a QImage.
+DecodeResult decodeDiagram(int generation, int row, const QString &key,
+                           const QByteArray &png)
+{
+  DecodeResult result;
+  result.generation = generation;
+  result.row = row;
+  result.key = key;
+  result.image = QImage::fromData(png, "PNG");
+  if (result.image.width() > diagramSize ||
+      result.image.height() > diagramSize) {
+    result.image = result.image.scaled(diagramSize, diagramSize,
+                                       Qt::KeepAspectRatio,
+                                       Qt::SmoothTransformation);
+  }
+  return result;
+}
+
+/** Returns the pixmap cache key for the diagram of the molecule @p id. */
+QString diagramKey(const OID &id)
+{
+  return QString("mongochem-diagram-%1-%2")
+    .arg(QString::fromStdString(id.str())).arg(diagramSize);
+}
+
+} // end anonymous namespace
+
 class MongoModel::Private
 {
 public:
-  BSONObj * getRecord(unsigned int index)
+  // A run of rowsPerPage consecutive rows held in memory.
+  struct Page
   {
-    if (index < m_rowObjects.size()) {
-      return &m_rowObjects[index];
+    std::vector<BSONObj> rows;
+    size_t size;
+    std::list<int>::iterator lru;
+  };
+
+  explicit Private(MongoModel *q_)
+    : q(q_),
+      m_size(0),
+      m_memoryBudget(0),
+      m_generation(0),
+      m_watcher(0),
+      m_moreData(false),
+      m_requested(0),
+      m_sortDirection(1)
+  {
+  }
+
+  /**
+   * Returns the document for @p row, or 0 if it is not in memory. In that
+   * case its page is fetched in the background and dataChanged() is emitted
+   * for the page once it arrives.
+   */
+  const BSONObj* getRecord(int row)
+  {
+    if (row < 0 || static_cast<size_t>(row) >= m_ids.size())
+      return 0;
+
+    int pageIndex = row / rowsPerPage;
+    size_t offset = static_cast<size_t>(row % rowsPerPage);
+
+    std::map<int, Page>::iterator iter = m_pages.find(pageIndex);
+    if (iter != m_pages.end() && offset >= iter->second.rows.size()) {
+      // rows were added to the page while it was evicted
+      removePage(iter);
+      iter = m_pages.end();
     }
-//    else {
-//      while (index >= m_rowObjects.size() && m_cursor->more())
-//        m_rowObjects.push_back(m_cursor->next().getOwned());
-//      // If there are enough objects, return the one requested
-//      if (index < m_rowObjects.size())
-//        return &m_rowObjects[index];
-//      else
-//        return 0;
-//    }
-    return 0;
+
+    if (iter == m_pages.end()) {
+      loadPage(pageIndex);
+      return 0;
+    }
+
+    // mark the page as the most recently used
+    Page &page = iter->second;
+    m_lru.splice(m_lru.begin(), m_lru, page.lru);
+
+    return &page.rows[offset];
+  }
+
+  /**
+   * Adds a row for the molecule with @p id. If @p obj is given it is kept in
+   * memory as long as the rest of its page is.
+   */
+  void appendRow(const OID &id, const BSONObj *obj)
+  {
+    m_ids.push_back(id);
+
+    int row = static_cast<int>(m_ids.size()) - 1;
+    int pageIndex = row / rowsPerPage;
+    size_t offset = static_cast<size_t>(row % rowsPerPage);
+    if (!obj)
+      return;
+
+    std::map<int, Page>::iterator iter = m_pages.find(pageIndex);
+    if (iter == m_pages.end()) {
+      // the start of the page was evicted so it is fetched again when needed
+      if (offset != 0)
+        return;
+      iter = insertPage(pageIndex);
+    }
+
+    Page &page = iter->second;
+    if (page.rows.size() != offset)
+      return;
+
+    page.rows.push_back(*obj);
+    page.size += obj->objsize();
+    m_size += obj->objsize();
+  }
+
+  /** Replaces the document for @p row if it is in memory. */
+  void replaceRow(int row, const BSONObj &obj)
+  {
+    std::map<int, Page>::iterator iter = m_pages.find(row / rowsPerPage);
+    if (iter == m_pages.end())
+      return;
+
+    Page &page = iter->second;
+    size_t offset = static_cast<size_t>(row % rowsPerPage);
+    if (offset >= page.rows.size())
+      return;
+
+    page.size -= page.rows[offset].objsize();
+    m_size -= page.rows[offset].objsize();
+    page.rows[offset] = obj;
+    page.size += obj.objsize();
+    m_size += obj.objsize();
+  }
+
+  std::map<int, Page>::iterator insertPage(int pageIndex)
+  {
+    Page &page = m_pages[pageIndex];
+    page.size = 0;
+    m_lru.push_front(pageIndex);
+    page.lru = m_lru.begin();
+    return m_pages.find(pageIndex);
+  }
+
+  void removePage(std::map<int, Page>::iterator iter)
+  {
+    m_size -= iter->second.size;
+    m_lru.erase(iter->second.lru);
+    m_pages.erase(iter);
+  }
+
+  /** Evicts the least recently used pages until the cache fits the budget. */
+  void evict()
+  {
+    while (m_size > m_memoryBudget && m_lru.size() > minimumResidentPages)
+      removePage(m_pages.find(m_lru.back()));
+  }
+
+  /** Starts fetching the molecules in page @p pageIndex by their ids. */
+  void loadPage(int pageIndex)
+  {
+    if (m_loadingPages.count(pageIndex))
+      return;
+
+    size_t first = static_cast<size_t>(pageIndex) * rowsPerPage;
+    size_t last = std::min(m_ids.size(), first + rowsPerPage);
+
+    std::vector<MoleculeRef> molecules;
+    for (size_t i = first; i < last; i++)
+      molecules.push_back(m_ids[i].isSet() ? MoleculeRef(m_ids[i].str())
+                                           : MoleculeRef());
+
+    m_loadingPages.insert(pageIndex);
+
+    QFutureWatcher<PageResult> *watcher = new QFutureWatcher<PageResult>(q);
+    QObject::connect(watcher, SIGNAL(finished()), q, SLOT(pageFetched()));
+    watcher->setFuture(QtConcurrent::run(fetchPage, m_generation, pageIndex,
+                                         molecules));
+  }
+
+  /**
+   * Returns the decoded diagram for @p row from the pixmap cache. If it is
+   * not there the PNG in @p image is decoded in the background and a blank
+   * placeholder is returned until dataChanged() is emitted for the row.
+   */
+  QPixmap diagram(int row, const BSONElement &image)
+  {
+    OID id = m_ids[row];
+    QString key = id.isSet() ? diagramKey(id)
+                             : QString("mongochem-diagram-row-%1").arg(row);
+
+    QPixmap pixmap;
+    if (QPixmapCache::find(key, &pixmap))
+      return pixmap;
+
+    if (!m_decoding.contains(key)) {
+      int length = 0;
+      const char *data_ = image.binData(length);
+      QByteArray png(data_, length);
+
+      m_decoding.insert(key);
+
+      QFutureWatcher<DecodeResult> *watcher =
+        new QFutureWatcher<DecodeResult>(q);
+      QObject::connect(watcher, SIGNAL(finished()), q,
+                       SLOT(diagramDecoded()));
+      watcher->setFuture(QtConcurrent::run(decodeDiagram, m_generation, row,
+                                           key, png));
+    }
+
+    if (m_placeholder.isNull()) {
+      m_placeholder = QPixmap(diagramSize, diagramSize);
+      m_placeholder.fill(Qt::transparent);
+    }
+
+    return m_placeholder;
+  }
+
+  /** Removes all rows. Pages still being fetched are dropped. */
+  void clearRows()
+  {
+    m_ids.clear();
+    m_pages.clear();
+    m_lru.clear();
+    m_loadingPages.clear();
+    m_decoding.clear();
+    m_size = 0;
+    m_generation++;
   }
 
-  std::vector<BSONObj> m_rowObjects;
+  MongoModel *q;
+
+  // the object id of every row along with the pages of rows in memory. the
+  // ids are small enough to keep for every row while the documents (which
+  // may contain diagrams) are only kept for the most recently used pages.
+  std::deque<OID> m_ids;
+  std::map<int, Page> m_pages;
+  std::list<int> m_lru;
+  std::set<int> m_loadingPages;
+  size_t m_size;
+  size_t m_memoryBudget;
+  int m_generation;
+
+  // the keys of the diagrams being decoded
+  QSet<QString> m_decoding;
+  QPixmap m_placeholder;
 
   QStringList m_fields;
   QMap<QString, QString> m_titles;
   DBClientConnection *db;
-  auto_ptr<DBClientCursor> cursor;
   mongo::Query m_query;
+
+  // the running query and the fetch in progress for it (if any)
+  QSharedPointer<QueryState> m_state;
+  QFutureWatcher<FetchResult> *m_watcher;
+  bool m_moreData;
+
+  // rows which have been fetched but not yet inserted into the model
+  std::deque<BSONObj> m_prefetched;
+
+  // the number of rows which should be inserted as soon as they arrive
+  int m_requested;
+
+  /** Stops the running query. Rows still being fetched for it are dropped. */
+  void cancelQuery()
+  {
+    if (m_state)
+      m_state->canceled.fetchAndStoreOrdered(1);
+    m_state.clear();
+    m_watcher = 0;
+    m_moreData = false;
+    m_prefetched.clear();
+    m_requested = 0;
+  }
+
   std::string m_sortField;
   int m_sortDirection;
 };
@@ -74,9 +469,17 @@ public:
 MongoModel::MongoModel(mongo::DBClientConnection *db, QObject *parent_)
   : QAbstractItemModel(parent_)
 {
-  d = new MongoModel::Private;
+  d = new MongoModel::Private(this);
   d->db = db;
 
+  if (QPixmapCache::cacheLimit() < minimumPixmapCacheLimit)
+    QPixmapCache::setCacheLimit(minimumPixmapCacheLimit);
+
+  QSettings settings;
+  setMemoryBudget(static_cast<size_t>(
+    settings.value("tableMemoryBudget", defaultMemoryBudget).toInt()) *
+    1024 * 1024);
+
   // Show the entire database by default.
   setQuery(QUERY("diagram" << BSON("$exists" << true)));
 
@@ -97,32 +500,30 @@ MongoModel::~MongoModel()
 
 void MongoModel::setQuery(const mongo::Query &query)
 {
-  d->m_rowObjects.clear();
+  // Drop the rows from the previous query and stop any fetch in progress.
+  beginResetModel();
+  d->cancelQuery();
+  d->clearRows();
+  endResetModel();
+  emit queryReset();
 
   // Store the query.
   d->m_query = query;
 
-  try {
-    QSettings settings;
-    std::string collection =
-        settings.value("collection", "chem").toString().toStdString();
+  mongo::Query sortQuery = query;
+  if (!d->m_sortField.empty()) {
+    // Add sort criteria to query.
+    sortQuery.sort(d->m_sortField, d->m_sortDirection);
+  }
 
-    if (d->m_sortField.empty()) {
-      d->cursor = d->db->query(collection + ".molecules", query);
-    }
-    else {
-      // Add sort criteria to query.
-      mongo::Query sortQuery = query;
-      sortQuery.sort(d->m_sortField, d->m_sortDirection);
-      d->cursor = d->db->query(collection + ".molecules", sortQuery);
-    }
+  // The query is run on a worker thread. Rows are added to the model as
+  // they arrive.
+  std::string collection = MongoDatabase::instance()->moleculesCollectionName();
+  d->m_state = QSharedPointer<QueryState>(new QueryState(collection, sortQuery));
+  d->m_moreData = true;
 
-    // Load the first 50 rows.
-    loadMoreData(50);
-  }
-  catch (mongo::SocketException &e) {
-    std::cerr << "Failed to query MongoDB: " << e.what() << std::endl;
-  }
+  // Load the first 50 rows.
+  loadMoreData(50);
 }
 
 void MongoModel::setSortField(const std::string &field, int direction)
@@ -194,7 +595,7 @@ int MongoModel::rowCount(const QModelIndex &parent_) const
 {
   Q_UNUSED(parent_);
 
-  return static_cast<int>(d->m_rowObjects.size());
+  return static_cast<int>(d->m_ids.size());
 }
 
 int MongoModel::columnCount(const QModelIndex &parent_) const
@@ -227,7 +628,7 @@ QVariant MongoModel::data(const QModelIndex &index_, int role) const
   if (index_.column() < 0 || index_.column() >= d->m_fields.size())
     return QVariant();
 
-  BSONObj *obj = static_cast<BSONObj *>(index_.internalPointer());
+  const BSONObj *obj = d->getRecord(index_.row());
   if (obj) {
     if (role == Qt::DisplayRole) {
       if (d->m_fields[index_.column()] == "mass") {
@@ -259,14 +660,8 @@ QVariant MongoModel::data(const QModelIndex &index_, int role) const
     else if (role == Qt::DecorationRole) {
       if (d->m_fields[index_.column()] == "diagram") {
         BSONElement image = obj->getObjectField("diagram").getField("png");
-        if (!image.eoo()) {
-          int length = 0;
-          const char *data_ = image.binData(length);
-          QByteArray inData(data_, length);
-          QImage in = QImage::fromData(inData, "PNG");
-          QPixmap pix = QPixmap::fromImage(in);
-          return QVariant(pix);
-        }
+        if (!image.eoo())
+          return QVariant(d->diagram(index_.row(), image));
       }
     }
   }
@@ -295,20 +690,37 @@ QModelIndex MongoModel::index(int row, int column,
 {
   Q_UNUSED(parent_);
 
-  if (row >= 0 && static_cast<size_t>(row) < d->m_rowObjects.size())
-    return createIndex(row, column, &d->m_rowObjects[row]);
+  if (row >= 0 && static_cast<size_t>(row) < d->m_ids.size())
+    return createIndex(row, column);
 
   return QModelIndex();
 }
 
 void MongoModel::setMolecules(const std::vector<MoleculeRef> &molecules_)
 {
-  MongoDatabase *db = MongoDatabase::instance();
+  beginResetModel();
 
-  d->m_rowObjects.clear();
+  d->cancelQuery();
+  d->clearRows();
+
+  // the molecules themselves are fetched when their rows are shown
+  for (size_t i = 0; i < molecules_.size(); i++)
+    d->appendRow(molecules_[i].isValid() ? OID(molecules_[i].id()) : OID(), 0);
+
+  endResetModel();
+}
+
+void MongoModel::addMolecules(const std::vector<MoleculeRef> &molecules_)
+{
+  if (molecules_.empty())
+    return;
 
+  int first = static_cast<int>(d->m_ids.size());
+  beginInsertRows(QModelIndex(), first,
+                  first + static_cast<int>(molecules_.size()) - 1);
   for (size_t i = 0; i < molecules_.size(); i++)
-    d->m_rowObjects.push_back(db->fetchMolecule(molecules_[i]));
+    d->appendRow(molecules_[i].isValid() ? OID(molecules_[i].id()) : OID(), 0);
+  endInsertRows();
 }
 
 /// Returns a vector containing a reference to each molecule in the model.
@@ -316,65 +728,240 @@ std::vector<MoleculeRef> MongoModel::molecules() const
 {
   std::vector<MoleculeRef> molecules_;
 
-  for (size_t i = 0; i < d->m_rowObjects.size(); ++i) {
-    const mongo::BSONObj &obj = d->m_rowObjects[i];
-    mongo::BSONElement idElement;
-    if (obj.getObjectID(idElement))
-      molecules_.push_back(MoleculeRef(idElement.OID().str()));
+  for (size_t i = 0; i < d->m_ids.size(); ++i) {
+    if (d->m_ids[i].isSet())
+      molecules_.push_back(MoleculeRef(d->m_ids[i].str()));
   }
 
   return molecules_;
 }
 
+mongo::BSONObj MongoModel::rowObject(int row) const
+{
+  // rows which have been evicted are fetched in the background rather than
+  // blocking the GUI thread
+  if (const BSONObj *obj = d->getRecord(row))
+    return *obj;
+
+  return mongo::BSONObj();
+}
+
+MoleculeRef MongoModel::moleculeRef(int row) const
+{
+  if (row < 0 || static_cast<size_t>(row) >= d->m_ids.size() ||
+      !d->m_ids[row].isSet())
+    return MoleculeRef();
+
+  return MoleculeRef(d->m_ids[row].str());
+}
+
+void MongoModel::setMemoryBudget(size_t bytes)
+{
+  d->m_memoryBudget = bytes;
+  d->evict();
+}
+
+size_t MongoModel::memoryBudget() const
+{
+  return d->m_memoryBudget;
+}
+
 void MongoModel::clear()
 {
 }
 
 bool MongoModel::setImage2D(int row, const QByteArray &image)
 {
-  emit layoutAboutToBeChanged();
+  if (row < 0 || static_cast<size_t>(row) >= d->m_ids.size() ||
+      !d->m_ids[row].isSet())
+    return false;
+
+  MongoDatabase *db = MongoDatabase::instance();
+  std::string collection = db->moleculesCollectionName();
+  OID id = d->m_ids[row];
 
-  BSONObj *obj = d->getRecord(row);
   BSONObjBuilder b;
   b.appendBinData("diagram", image.length(), mongo::BinDataGeneral,
                   image.data());
   BSONObjBuilder updateSet;
   updateSet << "$set" << b.obj();
-  d->db->update("chem.molecules", *obj, updateSet.obj());
+  d->db->update(collection, QUERY("_id" << id), updateSet.obj());
 
-  BSONElement id;
-  obj->getObjectID(id);
-  *obj = d->db->findOne("chem.molecules", QUERY("_id" << id));
+  d->replaceRow(row, db->fetchMolecule(MoleculeRef(id.str())));
+  QPixmapCache::remove(diagramKey(id));
 
-  emit layoutChanged();
+  emit dataChanged(index(row, 0), index(row, columnCount() - 1));
 
   return true;
 }
 
 bool MongoModel::hasMoreData() const
 {
-  return d->cursor.get() && d->cursor->more();
+  return !d->m_prefetched.empty() ||
+         (d->m_state && (d->m_watcher || d->m_moreData));
+}
+
+bool MongoModel::isLoading() const
+{
+  return d->m_requested > 0;
 }
 
 void MongoModel::loadMoreData(int count)
 {
-  if(!d->cursor.get())
-    return;
+  d->m_requested += count;
 
-  emit layoutAboutToBeChanged();
+  insertPrefetchedRows();
+  prefetch();
+}
 
-  size_t initial = d->m_rowObjects.size();
+bool MongoModel::canFetchMore(const QModelIndex &parent_) const
+{
+  // the view is not asked to fetch more while a request is outstanding
+  return !parent_.isValid() && d->m_requested == 0 && hasMoreData();
+}
 
-  while(d->cursor->more() && count--)
-    d->m_rowObjects.push_back(d->cursor->next().copy());
+void MongoModel::fetchMore(const QModelIndex &parent_)
+{
+  if (!parent_.isValid())
+    loadMoreData(fetchMoreCount);
+}
+
+void MongoModel::insertPrefetchedRows()
+{
+  size_t count = std::min(static_cast<size_t>(qMax(0, d->m_requested)),
+                          d->m_prefetched.size());
+  if (count == 0)
+    return;
+
+  size_t initial = d->m_ids.size();
+
+  beginInsertRows(QModelIndex(), static_cast<int>(initial),
+                  static_cast<int>(initial + count) - 1);
+  for (size_t i = 0; i < count; i++) {
+    const BSONObj &obj = d->m_prefetched[i];
+    BSONElement idElement;
+    if (obj.getObjectID(idElement) && idElement.type() == jstOID)
+      d->appendRow(idElement.OID(), &obj);
+    else
+      d->appendRow(OID(), &obj);
+  }
+  d->m_prefetched.erase(d->m_prefetched.begin(),
+                        d->m_prefetched.begin() + count);
+  d->m_requested -= static_cast<int>(count);
+  d->evict();
+  endInsertRows();
 
   // TODO: show this in the status bar rather than the terminal
   std::cout << "Loaded "
-            << d->m_rowObjects.size() - initial
+            << count
             << (initial ? " more" : "") << " rows"
             << std::endl;
+}
 
-  emit layoutChanged();
+void MongoModel::prefetch()
+{
+  // only one batch is fetched at a time
+  if (!d->m_state || d->m_watcher || !d->m_moreData)
+    return;
+
+  // keep readAheadCount rows ready beyond those which have been requested
+  int wanted = d->m_requested + readAheadCount -
+               static_cast<int>(d->m_prefetched.size());
+  if (wanted <= 0)
+    return;
+
+  d->m_watcher = new QFutureWatcher<FetchResult>(this);
+  connect(d->m_watcher, SIGNAL(finished()), SLOT(rowsFetched()));
+  d->m_watcher->setFuture(QtConcurrent::run(fetchRows, d->m_state, wanted));
+}
+
+void MongoModel::rowsFetched()
+{
+  QFutureWatcher<FetchResult> *watcher =
+    static_cast<QFutureWatcher<FetchResult> *>(sender());
+  watcher->deleteLater();
+
+  // ignore the rows from a query which has been replaced
+  if (watcher != d->m_watcher)
+    return;
+
+  d->m_watcher = 0;
+
+  FetchResult result = watcher->result();
+  d->m_moreData = result.more;
+  d->m_prefetched.insert(d->m_prefetched.end(),
+                         result.rows.begin(), result.rows.end());
+
+  insertPrefetchedRows();
+
+  // the query is exhausted, so the rest of the request cannot be met
+  if (d->m_prefetched.empty() && !d->m_moreData)
+    d->m_requested = 0;
+
+  emit dataLoaded();
+
+  // read ahead of the rows which have been shown
+  prefetch();
+}
+
+void MongoModel::pageFetched()
+{
+  QFutureWatcher<PageResult> *watcher =
+    static_cast<QFutureWatcher<PageResult> *>(sender());
+  watcher->deleteLater();
+
+  // ignore pages for rows which have since been replaced
+  PageResult result = watcher->result();
+  if (result.generation != d->m_generation)
+    return;
+
+  d->m_loadingPages.erase(result.page);
+
+  std::map<int, Private::Page>::iterator iter = d->m_pages.find(result.page);
+  if (iter != d->m_pages.end())
+    d->removePage(iter);
+  iter = d->insertPage(result.page);
+
+  Private::Page &page = iter->second;
+  for (size_t i = 0; i < result.rows.size(); i++) {
+    page.rows.push_back(result.rows[i]);
+    page.size += result.rows[i].objsize();
+    d->m_size += result.rows[i].objsize();
+  }
+
+  d->evict();
+
+  int first = result.page * rowsPerPage;
+  int last = std::min(first + static_cast<int>(result.rows.size()),
+                      rowCount()) - 1;
+  if (last >= first)
+    emit dataChanged(index(first, 0), index(last, columnCount() - 1));
+}
+
+void MongoModel::diagramDecoded()
+{
+  QFutureWatcher<DecodeResult> *watcher =
+    static_cast<QFutureWatcher<DecodeResult> *>(sender());
+  watcher->deleteLater();
+
+  DecodeResult result = watcher->result();
+  if (result.generation != d->m_generation)
+    return;
+
+  d->m_decoding.remove(result.key);
+
+  // cache a blank pixmap for diagrams which could not be decoded so that
+  // they are not decoded again on the next paint
+  QPixmap pixmap = QPixmap::fromImage(result.image);
+  if (pixmap.isNull()) {
+    pixmap = QPixmap(1, 1);
+    pixmap.fill(Qt::transparent);
+  }
+  QPixmapCache::insert(result.key, pixmap);
+
+  int column = d->m_fields.indexOf("diagram");
+  if (column != -1 && result.row < rowCount())
+    emit dataChanged(index(result.row, column), index(result.row, column));
 }
 
 void MongoModel::sort(int column, Qt::SortOrder order)
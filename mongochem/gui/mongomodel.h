@@ -22,7 +22,10 @@
 
 #include <vector>
 
+#include "moleculeref.h"
+
 namespace mongo {
+class BSONObj;
 class DBClientConnection;
 class Query;
 }
@@ -31,8 +34,6 @@ class vtkTable;
 
 namespace MongoChem {
 
-class MoleculeRef;
-
 class MongoModel : public QAbstractItemModel
 {
   Q_OBJECT
@@ -68,6 +69,27 @@ public:
   /** Returns the molecules being displayed in the model. */
   std::vector<MoleculeRef> molecules() const;
 
+  /**
+   * Returns the document for @p row if it is in memory. Otherwise an empty
+   * object is returned and the row is fetched in the background, after
+   * which dataChanged() is emitted for it.
+   */
+  mongo::BSONObj rowObject(int row) const;
+
+  /** Returns a reference to the molecule in @p row. */
+  MoleculeRef moleculeRef(int row) const;
+
+  /**
+   * Sets the amount of memory in bytes used to keep the documents for rows
+   * in memory. Once it is exceeded the least recently shown rows are
+   * dropped and fetched again by their object id if they are shown again.
+   * The default is read from the "tableMemoryBudget" setting (in megabytes).
+   */
+  void setMemoryBudget(size_t bytes);
+
+  /** Returns the memory budget in bytes. */
+  size_t memoryBudget() const;
+
   void clear();
 
   /** Set the 2D image for the molecule at row. */
@@ -78,11 +100,27 @@ public:
    */
   bool hasMoreData() const;
 
+  /** Returns @c true if rows requested with loadMoreData() are still being
+   * loaded. */
+  bool isLoading() const;
+
   /**
-   * Requests that the model load @p count more rows of data.
+   * Requests that the model load @p count more rows of data. Rows which
+   * have already been read ahead are inserted immediately. The rest are
+   * fetched on a worker thread and inserted when they arrive, after which
+   * dataLoaded() is emitted.
    */
   void loadMoreData(int count = 100);
 
+  /**
+   * Returns @c true if the view may ask for more rows. This is @c false
+   * while rows requested earlier are still being fetched.
+   */
+  bool canFetchMore(const QModelIndex &parent) const;
+
+  /** Requests the next rows for the view with loadMoreData(). */
+  void fetchMore(const QModelIndex &parent);
+
   /**
    * Sorts the model by @p column in @order. column of -1 indicates
    * no sorting.
@@ -102,10 +140,32 @@ private:
    */
   void setSortColumn(int index, int direction = 1);
 
+  /** Moves the requested rows which have been read ahead into the model. */
+  void insertPrefetchedRows();
+
+  /** Starts fetching the next batch of rows in the background if needed. */
+  void prefetch();
+
   class Private;
   Private *d;
 
+public slots:
+  /** Appends @p molecules to the molecules displayed in the model. */
+  void addMolecules(const std::vector<MongoChem::MoleculeRef> &molecules);
+
+signals:
+  /** Emitted each time a batch of rows requested with loadMoreData() or
+   * setQuery() has been loaded. */
+  void dataLoaded();
+
+  /** Emitted when the rows are replaced by those of a query, for example
+   * when the model is sorted by another column. */
+  void queryReset();
+
 private slots:
+  void rowsFetched();
+  void pageFetched();
+  void diagramDecoded();
 };
 
 } // End namespace
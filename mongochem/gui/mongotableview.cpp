@@ -19,7 +19,6 @@
 #include "mongomodel.h"
 #include "openineditorhandler.h"
 #include "moleculedetaildialog.h"
-#include "mongodatabase.h"
 
 #include <boost/make_shared.hpp>
 
@@ -32,7 +31,6 @@
 #include <QtGui/QContextMenuEvent>
 #include <QtCore/QSortFilterProxyModel>
 #include <QtWidgets/QMessageBox>
-#include <QtWidgets/QScrollBar>
 #include <QtWidgets/QHeaderView>
 #include <QtWidgets/QInputDialog>
 #include <QtCore/QDir>
@@ -46,6 +44,34 @@
 
 namespace MongoChem {
 
+namespace {
+
+// Returns the document for the row of the MongoModel referred to by
+// @p index. An empty object is returned if the index is not from a
+// MongoModel.
+mongo::BSONObj rowObject(const QModelIndex &index)
+{
+  const MongoModel *model = qobject_cast<const MongoModel *>(index.model());
+  if (!model || !index.isValid())
+    return mongo::BSONObj();
+
+  return model->rowObject(index.row());
+}
+
+// Returns a reference to the molecule in the row of the MongoModel referred
+// to by @p index. The model already knows the id of every row, so this does
+// not query the database.
+MoleculeRef moleculeRef(const QModelIndex &index)
+{
+  const MongoModel *model = qobject_cast<const MongoModel *>(index.model());
+  if (!model || !index.isValid())
+    return MoleculeRef();
+
+  return model->moleculeRef(index.row());
+}
+
+} // end anonymous namespace
+
 MongoTableView::MongoTableView(QWidget *parent_) : QTableView(parent_),
   m_network(0),
   m_row(-1)
@@ -62,8 +88,6 @@ MongoTableView::MongoTableView(QWidget *parent_) : QTableView(parent_),
           this, SLOT(columnHeaderCustomContextMenuRequested(const QPoint&)));
   connect(horizontalHeader(), SIGNAL(sectionClicked(int)),
           this, SLOT(headerItemClicked(int)));
-  connect(verticalScrollBar(), SIGNAL(sliderMoved(int)),
-          this, SLOT(scollBarMoved(int)));
 
   setSortingEnabled(true);
   horizontalHeader()->setSectionsMovable(true);
@@ -75,7 +99,6 @@ MongoTableView::MongoTableView(QWidget *parent_) : QTableView(parent_),
 
 void MongoTableView::contextMenuEvent(QContextMenuEvent *e)
 {
-  MongoDatabase *db = MongoDatabase::instance();
   QModelIndex index = indexAt(e->pos());
 
   // convert index from filter model to source model
@@ -84,22 +107,22 @@ void MongoTableView::contextMenuEvent(QContextMenuEvent *e)
   }
 
   if (index.isValid()) {
-    mongo::BSONObj *obj = static_cast<mongo::BSONObj *>(index.internalPointer());
+    mongo::BSONObj obj = rowObject(index);
     QMenu *menu = new QMenu(this);
 
     QAction *action;
-    mongo::BSONElement inchi = obj->getField("inchi");
+    mongo::BSONElement inchi = obj.getField("inchi");
 
     // add open in editor action
     action = menu->addAction("&Open in Editor");
-    MoleculeRef ref = db->findMoleculeFromBSONObj(obj);
-    m_openInEditorHandler->setMolecule(ref);
+    m_openInEditorHandler->setMolecule(moleculeRef(index));
     connect(action, SIGNAL(triggered()),
             m_openInEditorHandler, SLOT(openInEditor()));
 
-    mongo::BSONElement diagram = obj->getField("diagram");
+    mongo::BSONElement diagram = obj.getField("diagram");
 
-    if (diagram.eoo()) {
+    // the document is empty if the row is still being fetched
+    if (!obj.isEmpty() && diagram.eoo()) {
       // The field exists, there is more we can do here!
       action = menu->addAction("&Fetch 2D depiction");
       action->setData(inchi.str().c_str());
@@ -110,9 +133,12 @@ void MongoTableView::contextMenuEvent(QContextMenuEvent *e)
     action = menu->addAction("Show &Details", this, SLOT(showMoleculeDetailsDialog()));
 
     // add copy inchi to clipboard action
-    menu->addAction("Copy &InChI to Clipboard",
-                    this,
-                    SLOT(copyInChIToClipboard()));
+    if (!inchi.eoo()) {
+      action = menu->addAction("Copy &InChI to Clipboard",
+                               this,
+                               SLOT(copyInChIToClipboard()));
+      action->setData(inchi.str().c_str());
+    }
 
     // add find similar molecules action
     menu->addAction("Find Similar Molecules",
@@ -188,12 +214,7 @@ void MongoTableView::fetchImage()
 
 void MongoTableView::showMoleculeDetailsDialog()
 {
-  MongoDatabase *db = MongoDatabase::instance();
-
-  QModelIndex index = currentSourceModelIndex();
-  mongo::BSONObj *obj =
-    static_cast<mongo::BSONObj *>(index.internalPointer());
-  MoleculeRef ref = db->findMoleculeFromBSONObj(obj);
+  MoleculeRef ref = moleculeRef(currentSourceModelIndex());
 
   if (ref.isValid()) {
     MoleculeDetailDialog *dialog = new MoleculeDetailDialog(this);
@@ -209,17 +230,12 @@ void MongoTableView::showMoleculeDetailsDialog()
 
 void MongoTableView::copyInChIToClipboard()
 {
-  QModelIndex index = currentSourceModelIndex();
-  mongo::BSONObj *obj =
-    static_cast<mongo::BSONObj *>(index.internalPointer());
-  if (obj) {
-    mongo::BSONElement inchiElement = obj->getField("inchi");
-
-    if (!inchiElement.eoo()) {
-      QClipboard *clipboard = QApplication::clipboard();
-      std::string inchi = inchiElement.str();
-      clipboard->setText(inchi.c_str());
-    }
+  // the inchi is read when the context menu is shown
+  QAction *action = static_cast<QAction*>(sender());
+  QString inchi = action->data().toString();
+  if (!inchi.isEmpty()) {
+    QClipboard *clipboard = QApplication::clipboard();
+    clipboard->setText(inchi);
   }
 }
 
@@ -275,11 +291,7 @@ void MongoTableView::replyFinished(QNetworkReply *reply)
 
 void MongoTableView::showSimilarMoleculesClicked()
 {
-  MongoDatabase *db = MongoDatabase::instance();
-  QModelIndex index = currentSourceModelIndex();
-  mongo::BSONObj *obj =
-    static_cast<mongo::BSONObj *>(index.internalPointer());
-  MoleculeRef ref = db->findMoleculeFromBSONObj(obj);
+  MoleculeRef ref = moleculeRef(currentSourceModelIndex());
 
   emit showSimilarMolecules(ref);
 }
@@ -288,31 +300,11 @@ void MongoTableView::moleculeDoubleClicked(const QModelIndex &index_)
 {
   Q_UNUSED(index_);
 
-  MongoDatabase *db = MongoDatabase::instance();
-  QModelIndex index = currentSourceModelIndex();
-  mongo::BSONObj *obj =
-    static_cast<mongo::BSONObj *>(index.internalPointer());
-  MoleculeRef ref = db->findMoleculeFromBSONObj(obj);
+  MoleculeRef ref = moleculeRef(currentSourceModelIndex());
 
   emit showMoleculeDetails(ref);
 }
 
-// this slot is called in response to the vertical scroll bar moving. if it
-// reaches the bottom (i.e. value == maximum) we request our model to load
-// more data.
-void MongoTableView::scollBarMoved(int value)
-{
-  QScrollBar *scrollBar = qobject_cast<QScrollBar *>(sender());
-  if(!scrollBar)
-    return;
-
-  if(value == scrollBar->maximum()){
-    MongoModel *mongoModel = qobject_cast<MongoModel *>(model());
-    if(mongoModel && mongoModel->hasMoreData())
-      mongoModel->loadMoreData();
-  }
-}
-
 QModelIndex MongoTableView::currentSourceModelIndex() const
 {
   QModelIndex index = currentIndex();
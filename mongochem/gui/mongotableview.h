@@ -70,11 +70,6 @@ protected slots:
   /** Called when the user double clicks on a molecule. */
   void moleculeDoubleClicked(const QModelIndex &index);
 
-  /**
-   * Called when the vertical scroll bar changes.
-   */
-  void scollBarMoved(int value);
-
   /**
    * Called when the user right-clicks on a column header.
    */
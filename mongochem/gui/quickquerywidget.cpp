@@ -56,6 +56,11 @@ QString QuickQueryWidget::value() const
   return ui->queryLineEdit->text();
 }
 
+QString QuickQueryWidget::mode() const
+{
+  return ui->modeComboBox->currentText();
+}
+
 mongo::Query QuickQueryWidget::query() const
 {
   QString field_ = ui->fieldComboBox->currentText().toLower();
@@ -39,6 +39,7 @@ public:
 
   QString field() const;
   QString value() const;
+  QString mode() const;
   mongo::Query query() const;
 
 signals:
@@ -0,0 +1,153 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "sdfreader.h"
+
+#include <boost/iostreams/filter/bzip2.hpp>
+#include <boost/iostreams/filter/gzip.hpp>
+#include <boost/iostreams/filtering_stream.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+
+#include <fstream>
+
+namespace MongoChem {
+
+class SdfReader::Private
+{
+public:
+  Private() : size(0) { }
+
+  std::ifstream file;
+  boost::scoped_ptr<boost::iostreams::filtering_istream> stream;
+  qint64 size;
+  QString errorString;
+};
+
+SdfReader::SdfReader()
+  : d(new Private)
+{
+}
+
+SdfReader::~SdfReader()
+{
+  close();
+  delete d;
+}
+
+bool SdfReader::open(const QString &fileName)
+{
+  close();
+
+  d->file.open(QFile::encodeName(fileName).constData(),
+               std::ios_base::in | std::ios_base::binary);
+  if (!d->file.is_open()) {
+    d->errorString = QString("Failed to open file: %1").arg(fileName);
+    return false;
+  }
+
+  d->size = QFileInfo(fileName).size();
+
+  d->stream.reset(new boost::iostreams::filtering_istream);
+  QString suffix = QFileInfo(fileName).suffix().toLower();
+  if (suffix == "gz")
+    d->stream->push(boost::iostreams::gzip_decompressor());
+  else if (suffix == "bz2")
+    d->stream->push(boost::iostreams::bzip2_decompressor());
+  d->stream->push(d->file);
+
+  return true;
+}
+
+void SdfReader::close()
+{
+  d->stream.reset();
+  if (d->file.is_open())
+    d->file.close();
+  d->file.clear();
+  d->size = 0;
+}
+
+bool SdfReader::isOpen() const
+{
+  return d->stream.get() != 0;
+}
+
+QString SdfReader::errorString() const
+{
+  return d->errorString;
+}
+
+bool SdfReader::readRecord(std::string &record)
+{
+  record.clear();
+  if (!d->stream)
+    return false;
+
+  bool blank = true;
+  std::string line;
+  try {
+    while (std::getline(*d->stream, line)) {
+      if (!line.empty() && line[line.size() - 1] == '\r')
+        line.erase(line.size() - 1);
+
+      record += line;
+      record += '\n';
+
+      if (line == "$$$$") {
+        // skip blank lines between records
+        if (!blank)
+          return true;
+        record.clear();
+      }
+      else if (line.find_first_not_of(" \t") != std::string::npos) {
+        blank = false;
+      }
+    }
+  }
+  catch (boost::iostreams::gzip_error &e) {
+    d->errorString = QString("Error decompressing file: %1").arg(e.what());
+    return false;
+  }
+  catch (boost::iostreams::bzip2_error &e) {
+    d->errorString = QString("Error decompressing file: %1").arg(e.what());
+    return false;
+  }
+
+  // the last record may not end with "$$$$"
+  return !blank;
+}
+
+qint64 SdfReader::size() const
+{
+  return d->size;
+}
+
+qint64 SdfReader::position() const
+{
+  if (!d->stream)
+    return 0;
+
+  std::streampos position = d->file.tellg();
+  if (position < 0)
+    return d->size;
+
+  return static_cast<qint64>(position);
+}
+
+} // end MongoChem namespace
@@ -0,0 +1,86 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_SDFREADER_H
+#define MONGOCHEM_SDFREADER_H
+
+#include "mongochemguiexport.h"
+
+#include <QtCore/QString>
+
+#include <string>
+
+namespace MongoChem {
+
+/**
+ * @class SdfReader
+ * @brief The SdfReader class reads the records of an SDF file one at a time.
+ *
+ * Each record is returned as text (up to and including its "$$$$" line) so
+ * that it can be parsed on another thread. Files ending with ".gz" or ".bz2"
+ * are decompressed while they are read. Only the current record is held in
+ * memory.
+ */
+class MONGOCHEMGUI_EXPORT SdfReader
+{
+public:
+  /** Creates a new SDF reader. */
+  SdfReader();
+
+  /** Destroys the SDF reader. */
+  ~SdfReader();
+
+  /**
+   * Opens the file @p fileName for reading. Returns @c false if the file
+   * could not be opened.
+   */
+  bool open(const QString &fileName);
+
+  /** Closes the file. */
+  void close();
+
+  /** Returns @c true if a file is open. */
+  bool isOpen() const;
+
+  /** Returns a description of the last error which occurred. */
+  QString errorString() const;
+
+  /**
+   * Reads the next record into @p record. Returns @c false if there are no
+   * more records.
+   */
+  bool readRecord(std::string &record);
+
+  /** Returns the size of the file in bytes (before decompression). */
+  qint64 size() const;
+
+  /**
+   * Returns the number of bytes of the file read so far (before
+   * decompression). This is only approximate for compressed files as they
+   * are decompressed in blocks.
+   */
+  qint64 position() const;
+
+private:
+  Q_DISABLE_COPY(SdfReader)
+
+  class Private;
+  Private *d;
+};
+
+} // end MongoChem namespace
+
+#endif // MONGOCHEM_SDFREADER_H
@@ -16,6 +16,8 @@
 
 #include "substructurefiltermodel.h"
 
+#include "mongomodel.h"
+
 #include <boost/make_shared.hpp>
 
 #include <mongo/client/dbclient.h>
@@ -65,13 +67,16 @@ bool SubstructureFilterModel::filterAcceptsRow(int sourceRow,
     return false;
 
   // get the bson object for the row
-  QModelIndex index_ = sourceModel()->index(sourceRow, 0, sourceParent);
-  BSONObj *obj = static_cast<BSONObj *>(index_.internalPointer());
-  if (!obj)
+  Q_UNUSED(sourceParent);
+  MongoModel *model = qobject_cast<MongoModel *>(sourceModel());
+  if (!model)
     return false;
+  // rows which are not in memory are rejected until they have been fetched.
+  // the model emits dataChanged() for them then, which filters them again.
+  BSONObj obj = model->rowObject(sourceRow);
 
   // get the molecule's inchi
-  BSONElement elem = obj->getField("inchi");
+  BSONElement elem = obj.getField("inchi");
   if (elem.eoo())
     return false;
 
@@ -0,0 +1,250 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "substructuresearch.h"
+
+#include "chemkit.h"
+#include "fingerprintindex.h"
+#include "mongodatabase.h"
+
+#include <chemkit/fingerprint.h>
+#include <chemkit/molecule.h>
+#include <chemkit/substructurequery.h>
+
+#include <boost/scoped_ptr.hpp>
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QMutexLocker>
+
+#include <algorithm>
+
+namespace MongoChem {
+
+using std::string;
+using std::vector;
+
+namespace {
+
+// The number of candidates fetched and matched by each task. This is small
+// enough that results start to appear quickly and large enough that the
+// molecules are fetched with few round trips to the server.
+const size_t matchBatchSize = 256;
+
+// A batch of candidate molecules to be matched on a single thread.
+struct MatchTask
+{
+  SubstructureSearch *search;
+  const QAtomicInt *currentGeneration;
+  QAtomicInt *matched;
+  int generation;
+  int candidateCount;
+  string identifier;
+  string format;
+  bool exact;
+  int heavyAtomCount;
+  vector<MoleculeRef> molecules;
+};
+
+int heavyAtomCount(const chemkit::Molecule *molecule)
+{
+  return static_cast<int>(molecule->atomCount() - molecule->atomCount("H"));
+}
+
+struct RunMatchTask
+{
+  void operator()(MatchTask &task) const
+  {
+    if (task.currentGeneration->load() != task.generation)
+      return;
+
+    mongo::BSONObj fields =
+      BSON("smiles" << 1 << "inchi" << 1 << "heavyAtomCount" << 1);
+    vector<mongo::BSONObj> objs =
+      MongoDatabase::instance()->fetchMolecules(task.molecules, fields);
+
+    chemkit::SubstructureQuery query;
+    {
+      QMutexLocker locker(task.format == "inchi" ? ChemKit::inchiMutex() : 0);
+      query.setMolecule(task.identifier, task.format);
+    }
+
+    vector<MoleculeRef> matches;
+    for (size_t i = 0; i < objs.size(); i++) {
+      if (task.currentGeneration->load() != task.generation)
+        return;
+
+      const mongo::BSONObj &obj = objs[i];
+      if (obj.isEmpty())
+        continue;
+
+      // skip molecules with a different size before creating them
+      mongo::BSONElement count = obj.getField("heavyAtomCount");
+      if (task.exact && count.isNumber() &&
+          count.numberInt() != task.heavyAtomCount)
+        continue;
+
+      boost::shared_ptr<chemkit::Molecule> molecule =
+        ChemKit::createMolecule(obj);
+      if (!molecule || molecule->isEmpty())
+        continue;
+
+      if (task.exact && heavyAtomCount(molecule.get()) != task.heavyAtomCount)
+        continue;
+
+      if (query.matches(molecule.get()))
+        matches.push_back(task.molecules[i]);
+    }
+
+    if (!matches.empty()) {
+      QMetaObject::invokeMethod(task.search, "addMatches",
+                                Qt::QueuedConnection,
+                                Q_ARG(int, task.generation),
+                                Q_ARG(std::vector<MongoChem::MoleculeRef>,
+                                      matches));
+    }
+
+    int matched = task.matched->fetchAndAddOrdered(
+      static_cast<int>(task.molecules.size())) +
+      static_cast<int>(task.molecules.size());
+    QMetaObject::invokeMethod(task.search, "updateProgress",
+                              Qt::QueuedConnection,
+                              Q_ARG(int, task.generation),
+                              Q_ARG(int, matched),
+                              Q_ARG(int, task.candidateCount));
+  }
+};
+
+} // end anonymous namespace
+
+SubstructureSearch::SubstructureSearch(QObject *parent_)
+  : QObject(parent_),
+    m_generation(0),
+    m_running(false)
+{
+  qRegisterMetaType<std::vector<MongoChem::MoleculeRef> >();
+}
+
+SubstructureSearch::~SubstructureSearch()
+{
+  cancel();
+
+  // wait for the workers as they post their results to this object
+  foreach (QFuture<void> future, m_futures)
+    future.waitForFinished();
+}
+
+void SubstructureSearch::start(const QString &identifier, bool exact)
+{
+  cancel();
+
+  // forget the searches which have already finished
+  QList<QFuture<void> > running;
+  foreach (QFuture<void> future, m_futures) {
+    if (!future.isFinished())
+      running.append(future);
+  }
+  m_futures = running;
+
+  int generation = m_generation.fetchAndAddOrdered(1) + 1;
+  m_running = true;
+  m_futures.append(QtConcurrent::run(this, &SubstructureSearch::run,
+                                     generation, identifier, exact));
+}
+
+void SubstructureSearch::cancel()
+{
+  m_generation.fetchAndAddOrdered(1);
+  m_running = false;
+}
+
+bool SubstructureSearch::isRunning() const
+{
+  return m_running;
+}
+
+void SubstructureSearch::addMatches(int generation,
+                                    const std::vector<MoleculeRef> &molecules)
+{
+  if (generation == m_generation.load())
+    emit moleculesFound(molecules);
+}
+
+void SubstructureSearch::updateProgress(int generation, int value, int maximum)
+{
+  if (generation == m_generation.load())
+    emit progress(value, maximum);
+}
+
+void SubstructureSearch::searchFinished(int generation)
+{
+  if (generation != m_generation.load())
+    return;
+
+  m_running = false;
+  emit finished();
+}
+
+void SubstructureSearch::run(int generation, const QString &identifier,
+                             bool exact)
+{
+  string format = identifier.startsWith("InChI=") ? "inchi" : "smiles";
+  string identifierString = identifier.toStdString();
+
+  vector<MoleculeRef> candidates;
+  int queryHeavyAtomCount = 0;
+
+  boost::shared_ptr<chemkit::Molecule> queryMolecule =
+    ChemKit::createMolecule(identifierString, format);
+  boost::scoped_ptr<chemkit::Fingerprint>
+    fp2(chemkit::Fingerprint::create("fp2"));
+
+  if (queryMolecule && !queryMolecule->isEmpty() && fp2) {
+    queryHeavyAtomCount = heavyAtomCount(queryMolecule.get());
+
+    // only the molecules which have every bit of the query's fingerprint set
+    // can contain it
+    FingerprintIndex *index = FingerprintIndex::instance();
+    index->refresh();
+    candidates = index->screen(fp2->value(queryMolecule.get()));
+  }
+
+  QAtomicInt matched(0);
+  vector<MatchTask> tasks;
+  for (size_t i = 0; i < candidates.size(); i += matchBatchSize) {
+    MatchTask task;
+    task.search = this;
+    task.currentGeneration = &m_generation;
+    task.matched = &matched;
+    task.generation = generation;
+    task.candidateCount = static_cast<int>(candidates.size());
+    task.identifier = identifierString;
+    task.format = format;
+    task.exact = exact;
+    task.heavyAtomCount = queryHeavyAtomCount;
+    task.molecules.assign(candidates.begin() + i,
+                          candidates.begin() +
+                            std::min(candidates.size(), i + matchBatchSize));
+    tasks.push_back(task);
+  }
+
+  QtConcurrent::blockingMap(tasks, RunMatchTask());
+
+  QMetaObject::invokeMethod(this, "searchFinished", Qt::QueuedConnection,
+                            Q_ARG(int, generation));
+}
+
+} // end MongoChem namespace
@@ -0,0 +1,104 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef MONGOCHEM_SUBSTRUCTURESEARCH_H
+#define MONGOCHEM_SUBSTRUCTURESEARCH_H
+
+#include "mongochemguiexport.h"
+#include "moleculeref.h"
+
+#include <QtCore/QAtomicInt>
+#include <QtCore/QFuture>
+#include <QtCore/QList>
+#include <QtCore/QMetaType>
+#include <QtCore/QObject>
+#include <QtCore/QString>
+
+#include <vector>
+
+namespace MongoChem {
+
+/**
+ * @class SubstructureSearch
+ * @brief The SubstructureSearch class searches the molecules collection for
+ * molecules which contain a query structure.
+ *
+ * The search runs in two stages on worker threads. First the fp2 fingerprint
+ * of the query is screened against the FingerprintIndex which discards every
+ * molecule whose fingerprint is missing one of the query's bits. The
+ * remaining candidates are then fetched in batches and matched exactly with
+ * chemkit::SubstructureQuery in parallel.
+ *
+ * Matching molecules are reported with the moleculesFound() signal as each
+ * batch is finished so that results can be shown before the search is done.
+ */
+class MONGOCHEMGUI_EXPORT SubstructureSearch : public QObject
+{
+  Q_OBJECT
+
+public:
+  explicit SubstructureSearch(QObject *parent = 0);
+  ~SubstructureSearch();
+
+  /**
+   * Starts searching for molecules which contain the structure given by
+   * @p identifier. If the identifier starts with "InChI=" it will be
+   * interpreted as an InChI, otherwise it will be interpreted as a SMILES.
+   *
+   * If @p exact is @c true only molecules with the same number of heavy atoms
+   * as the query structure are matched.
+   *
+   * Any search already running is canceled.
+   */
+  void start(const QString &identifier, bool exact = false);
+
+  /** Cancels the current search. No more signals are emitted for it. */
+  void cancel();
+
+  /** Returns @c true if a search is running. */
+  bool isRunning() const;
+
+signals:
+  /** Emitted with each batch of molecules matching the query structure. */
+  void moleculesFound(const std::vector<MongoChem::MoleculeRef> &molecules);
+
+  /** Emitted after each batch of @p maximum candidates is matched. */
+  void progress(int value, int maximum);
+
+  /** Emitted when the search has finished. */
+  void finished();
+
+private slots:
+  void addMatches(int generation,
+                  const std::vector<MongoChem::MoleculeRef> &molecules);
+  void updateProgress(int generation, int value, int maximum);
+  void searchFinished(int generation);
+
+private:
+  /** Runs the search on a worker thread. */
+  void run(int generation, const QString &identifier, bool exact);
+
+  // incremented each time a search is started or canceled
+  QAtomicInt m_generation;
+  bool m_running;
+  QList<QFuture<void> > m_futures;
+};
+
+} // end MongoChem namespace
+
+Q_DECLARE_METATYPE(std::vector<MongoChem::MoleculeRef>)
+
+#endif // MONGOCHEM_SUBSTRUCTURESEARCH_H
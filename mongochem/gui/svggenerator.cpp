@@ -16,27 +16,18 @@
 
 #include "svggenerator.h"
 
-#include <string>
-#include <sstream>
+#include "depictionservice.h"
 
 #include <QBuffer>
-#include <QWebView>
+#include <QPainter>
+#include <QSvgRenderer>
 
 namespace MongoChem {
 
-struct OBabelJob
-{
-    QProcess *process;
-    QStringList options;
-    QByteArray input;
-};
-
-QQueue<OBabelJob> SvgGenerator::m_jobs;
-int SvgGenerator::m_runningJobs = 0;
-
 SvgGenerator::SvgGenerator(QObject *parent_)
   : QObject(parent_)
 {
+  connect(&m_watcher, SIGNAL(finished()), this, SLOT(depictionFinished()));
 }
 
 SvgGenerator::~SvgGenerator()
@@ -70,115 +61,71 @@ QByteArray SvgGenerator::svg() const
 
 QByteArray SvgGenerator::png() const
 {
-  QByteArray png_;
-
-  if (m_svg.isEmpty())
-    return png_;
-
-  QImage image_ = image();
-  QBuffer buffer(&png_);
-  buffer.open(QIODevice::WriteOnly);
-  image_.save(&buffer, "PNG");
-  buffer.close();
-
-  return png_;
+  return renderPng(m_svg);
 }
 
 QImage SvgGenerator::image() const
 {
-  QImage img(250, 250, QImage::Format_ARGB32_Premultiplied);
-  if (m_svg.isEmpty())
-    return img;
-
-  // create web view
-  QWebView widget;
-
-  // set transparent background
-  QPalette palette_ = widget.palette();
-  palette_.setBrush(QPalette::Base, Qt::white);
-  widget.page()->setPalette(palette_);
-
-  // set content
-  std::stringstream html;
-  html << "<html>"
-       << "<head>"
-       << "<style type=\"text/css\">"
-       << "html, body { margin:0; padding:0; overflow:hidden }"
-       << "svg { top:0; left:0; height:100%; width:100% }"
-       << "</style>"
-       << "</head>"
-       << "<body>"
-       << m_svg.constData()
-       << "</body>"
-       << "</html>";
-  std::string content = html.str();
-  widget.setContent(QByteArray(content.c_str()));
-
-  // render to image
-  widget.render(&img);
-
-  return img;
+  return renderImage(m_svg);
 }
 
-void SvgGenerator::start()
+QImage SvgGenerator::renderImage(const QByteArray &svg, int size)
 {
-  // set the options
-  QStringList options;
-  options << "-i" << m_inputFormat;
-  options << "-osvg";
-  options << "-xC"; // no terminal carbons lines
-
-  // listen to the finished signal
-  connect(&m_process, SIGNAL(finished(int, QProcess::ExitStatus)),
-          this, SLOT(obabelFinished(int, QProcess::ExitStatus)));
-
-  OBabelJob job;
-  job.process = &m_process;
-  job.options = options;
-  job.input = m_inputData;
-
-  if (m_runningJobs < 5)
-    runJob(job);
-  else
-    m_jobs.enqueue(job);
-}
+  QImage img(size, size, QImage::Format_ARGB32_Premultiplied);
+  img.fill(Qt::white);
+  if (svg.isEmpty())
+    return img;
 
-void SvgGenerator::obabelFinished(int errorCode, QProcess::ExitStatus)
-{
-  m_runningJobs--;
+  QSvgRenderer renderer(svg);
+  if (!renderer.isValid())
+    return img;
 
-  // clear any previous data
-  m_svg.clear();
+  // scale the diagram to fit while keeping its aspect ratio
+  QSizeF diagramSize = renderer.viewBoxF().size();
+  if (diagramSize.isEmpty())
+    diagramSize = renderer.defaultSize();
+  diagramSize.scale(size, size, Qt::KeepAspectRatio);
+  QRectF bounds((size - diagramSize.width()) / 2,
+                (size - diagramSize.height()) / 2,
+                diagramSize.width(),
+                diagramSize.height());
+
+  QPainter painter(&img);
+  painter.setRenderHint(QPainter::Antialiasing);
+  renderer.render(&painter, bounds);
+  painter.end();
 
-  // get obabel output
-  QByteArray output = m_process.readAllStandardOutput();
+  return img;
+}
 
-  // read and store svg data
-  foreach (const QByteArray &line, output.split('\n')){
-    if (line.startsWith("<rect"))
-      continue;
+QByteArray SvgGenerator::renderPng(const QByteArray &svg, int size)
+{
+  QByteArray png_;
 
-    m_svg += line + '\n';
-  }
+  if (svg.isEmpty())
+    return png_;
 
-  emit finished(errorCode);
+  QImage image_ = renderImage(svg, size);
+  QBuffer buffer(&png_);
+  buffer.open(QIODevice::WriteOnly);
+  image_.save(&buffer, "PNG");
+  buffer.close();
 
-  // start next job in the queue
-  if (!m_jobs.empty() && m_runningJobs < 5) {
-    runJob(m_jobs.dequeue());
-  }
+  return png_;
 }
 
-void SvgGenerator::runJob(const OBabelJob &job)
+void SvgGenerator::start()
 {
-  QProcess *process = const_cast<QProcess *>(job.process);
+  m_svg.clear();
+  m_watcher.setFuture(
+    DepictionService::instance()->depict(m_inputData, m_inputFormat));
+}
 
-  // start the process and send the input data
-  process->start("obabel", job.options);
-  process->write(job.input);
-  process->closeWriteChannel();
+void SvgGenerator::depictionFinished()
+{
+  m_svg = m_watcher.result();
 
-  m_runningJobs++;
+  emit finished(m_svg.isEmpty() ? 1 : 0);
 }
 
 } // end MongoChem namespace
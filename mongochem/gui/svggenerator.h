@@ -17,18 +17,17 @@
 #ifndef SVGGENERATOR_H
 #define SVGGENERATOR_H
 
-#include <QQueue>
 #include <QObject>
-#include <QProcess>
+#include <QFutureWatcher>
 #include <QImage>
 #include <QByteArray>
 
 namespace MongoChem {
 
-struct OBabelJob;
-
 /**
  * The SvgGenerator class generates SVG diagrams for molecules.
+ *
+ * The diagrams are generated in batches by the shared DepictionService.
  */
 class SvgGenerator : public QObject
 {
@@ -80,6 +79,18 @@ public:
    */
   QImage image() const;
 
+  /**
+   * Renders @p svg onto a @p size by @p size image with a white background.
+   * This does not need a display and may be called from any thread.
+   */
+  static QImage renderImage(const QByteArray &svg, int size = 250);
+
+  /**
+   * Renders @p svg with renderImage() and returns the image in PNG format.
+   * Returns an empty byte array if @p svg is empty.
+   */
+  static QByteArray renderPng(const QByteArray &svg, int size = 250);
+
   /**
    * Starts the generation process. When finished, the finished() signal will
    * be emitted.
@@ -94,20 +105,15 @@ signals:
   void finished(int errorCode);
 
 private slots:
-  void obabelFinished(int errorCode, QProcess::ExitStatus exitStatus);
-
-private:
-  void runJob(const OBabelJob &job);
+  void depictionFinished();
 
 private:
   Q_DISABLE_COPY(SvgGenerator)
 
-  QProcess m_process;
+  QFutureWatcher<QByteArray> m_watcher;
   QByteArray m_inputData;
   QByteArray m_inputFormat;
   QByteArray m_svg;
-  static QQueue<OBabelJob> m_jobs;
-  static int m_runningJobs;
 };
 
 } // end MongoChem namespace
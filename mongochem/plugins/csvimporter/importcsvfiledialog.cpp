@@ -17,7 +17,6 @@
 #include "importcsvfiledialog.h"
 #include "ui_importcsvfiledialog.h"
 
-#include <QFile>
 #include <QDebug>
 #include <QString>
 #include <QComboBox>
@@ -25,11 +24,168 @@
 #include <QStringList>
 #include <QMessageBox>
 #include <QInputDialog>
+#include <QtNumeric>
+#include <QtConcurrentRun>
 
 #include <mongochem/gui/mongodatabase.h>
 #include <mongochem/gui/chemkit.h>
+#include <mongochem/gui/descriptortable.h>
+#include <mongochem/gui/csvreader.h>
 #include <mongochem/gui/svggenerator.h>
 
+#include <map>
+#include <set>
+
+namespace {
+
+// The number of rows imported together. The molecules in each batch are
+// looked up with one query and the new ones are written with one insert.
+const int importBatchSize = 1000;
+
+// A batch of rows read from the CSV file.
+struct ImportBatch
+{
+  std::string identifierName;
+  std::vector<std::string> descriptorNames;
+  std::vector<std::string> identifiers;
+  std::vector<std::vector<float> > values;
+};
+
+struct ImportResult
+{
+  ImportResult() : importedCount(0) { }
+
+  int importedCount;
+  std::vector<std::string> newIdentifiers;
+  std::vector<std::string> failedIdentifiers;
+};
+
+// Returns the descriptor values for @p row in @p batch with each name
+// prefixed with @p prefix. Values which are missing from the file (NaN) are
+// skipped.
+mongo::BSONObj descriptorsObject(const ImportBatch &batch, size_t row,
+                                 const std::string &prefix)
+{
+  mongo::BSONObjBuilder builder;
+  for (size_t i = 0; i < batch.descriptorNames.size(); i++) {
+    if (!qIsNaN(batch.values[row][i]))
+      builder.append(prefix + batch.descriptorNames[i], batch.values[row][i]);
+  }
+  return builder.obj();
+}
+
+// Imports the rows in @p batch. This runs on a worker thread while the next
+// batch is read from the file.
+ImportResult importBatch(const ImportBatch &batch)
+{
+  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
+  ImportResult result;
+
+  std::vector<MongoChem::MoleculeRef> molecules =
+    db->findMoleculesFromIdentifiers(batch.identifiers, batch.identifierName);
+
+  // create the molecules which were not found. their InChIKeys are looked up
+  // as well in case they were stored with a different identifier.
+  std::vector<mongo::BSONObj> newObjects;
+  std::vector<size_t> newRows;
+  std::vector<std::string> inchikeys;
+  for (size_t i = 0; i < molecules.size(); i++) {
+    if (molecules[i])
+      continue;
+
+    mongo::BSONObj obj =
+      MongoChem::ChemKit::createMoleculeObject(batch.identifiers[i],
+                                               batch.identifierName);
+    if (obj.isEmpty()) {
+      result.failedIdentifiers.push_back(batch.identifiers[i]);
+      continue;
+    }
+
+    newObjects.push_back(obj);
+    newRows.push_back(i);
+    inchikeys.push_back(obj.getStringField("inchikey"));
+  }
+
+  std::vector<MongoChem::MoleculeRef> existing =
+    db->findMoleculesFromIdentifiers(inchikeys, "inchikey");
+
+  // new molecules are inserted along with their descriptors. molecules which
+  // appear more than once in the batch are only inserted once.
+  std::vector<mongo::BSONObj> inserts;
+  std::set<size_t> insertedRows;
+  std::map<std::string, MongoChem::MoleculeRef> inserted;
+  for (size_t i = 0; i < newObjects.size(); i++) {
+    size_t row = newRows[i];
+
+    if (existing[i]) {
+      molecules[row] = existing[i];
+      continue;
+    }
+
+    std::map<std::string, MongoChem::MoleculeRef>::const_iterator iter =
+      inserted.find(inchikeys[i]);
+    if (iter != inserted.end()) {
+      molecules[row] = iter->second;
+      continue;
+    }
+
+    mongo::BSONObjBuilder builder;
+    builder.appendElements(newObjects[i]);
+    builder.append("descriptors", descriptorsObject(batch, row, ""));
+    inserts.push_back(builder.obj());
+
+    molecules[row] = MongoChem::MoleculeRef(newObjects[i]["_id"].OID().str());
+    inserted[inchikeys[i]] = molecules[row];
+    insertedRows.insert(row);
+    result.newIdentifiers.push_back(batch.identifiers[row]);
+  }
+
+  MongoChem::ScopedMongoConnection conn(db->connectionPool());
+  if (!conn)
+    return result;
+
+  std::string collection = db->moleculesCollectionName();
+
+  try {
+    if (!inserts.empty())
+      conn->insert(collection, inserts, mongo::InsertOption_ContinueOnError);
+
+    // all of the descriptors for a molecule are set with a single update
+    if (!batch.descriptorNames.empty()) {
+      for (size_t i = 0; i < molecules.size(); i++) {
+        if (!molecules[i] || insertedRows.count(i))
+          continue;
+
+        conn->update(collection,
+                     QUERY("_id" << mongo::OID(molecules[i].id())),
+                     BSON("$set" << descriptorsObject(batch, i,
+                                                      "descriptors.")));
+      }
+    }
+
+    // the writes above are not acknowledged individually. waiting for the
+    // last error once per batch keeps the reader from getting ahead of the
+    // server.
+    std::string error = conn->getLastError();
+    if (!error.empty())
+      qDebug() << "error importing molecules: " << error.c_str();
+  }
+  catch (mongo::DBException &e) {
+    qDebug() << "error importing molecules: " << e.what();
+    conn.setFailed();
+    return result;
+  }
+
+  for (size_t i = 0; i < molecules.size(); i++) {
+    if (molecules[i])
+      result.importedCount++;
+  }
+
+  return result;
+}
+
+} // end anonymous namespace
+
 ImportCsvFileDialog::ImportCsvFileDialog(QWidget *parent_)
   : AbstractImportDialog(parent_),
     ui(new Ui::ImportCsvFileDialog)
@@ -65,18 +221,20 @@ void ImportCsvFileDialog::setFileName(const QString &fileName_)
     ui->fileNameLineEdit->setText(m_fileName);
 
     // load preview data
-    QFile file(fileName_);
-    if (!file.open(QFile::ReadOnly)) {
-      qDebug() << "failed to open file: " << file.errorString();
+    MongoChem::CsvReader reader;
+    reader.setDelimiter(delimiterCharacter().toLatin1());
+    if (!reader.open(fileName_)) {
+      qDebug() << "failed to open file: " << reader.errorString();
       return;
     }
 
-    // get separator character (default to comma if none specified)
-    QChar separator = delimiterCharacter();
-
-    // first line is titles
-    QString titles = file.readLine().trimmed();
-    QStringList titlesList = titles.split(separator, QString::SkipEmptyParts);
+    // first record is titles. empty titles are kept so that the columns line
+    // up with the data.
+    std::vector<std::string> titles;
+    reader.readRecord(titles);
+    QStringList titlesList;
+    for (size_t i = 0; i < titles.size(); i++)
+      titlesList.append(QString::fromStdString(titles[i]).trimmed());
     ui->tableWidget->setColumnCount(titlesList.size());
     ui->tableWidget->setHorizontalHeaderLabels(titlesList);
 
@@ -130,47 +288,21 @@ void ImportCsvFileDialog::setFileName(const QString &fileName_)
       }
     }
 
-    // read first 25 data lines
-    for (int index = 0; index < 25; index++) {
-      // read line from file
-      QString line = file.readLine().trimmed();
-      if (line.isEmpty())
-        break;
-
+    // read first 25 data records
+    std::vector<std::string> items;
+    for (int index = 0; index < 25 && reader.readRecord(items); index++) {
       // make space for the new row
       ui->tableWidget->setRowCount(index + 1);
 
-      // parse each item in line into a list of strings
-      QStringList items;
-      QString current;
-      bool inQuotes = false;
-
-      foreach (const QChar &ch, line) {
-        if (ch == '"') {
-          inQuotes = !inQuotes;
-        }
-        else if (ch == separator && !inQuotes) {
-          items.append(current);
-          current.clear();
-        }
-        else {
-          current.append(ch);
-        }
-      }
-
-      // add final item
-      if (!current.isEmpty())
-        items.append(current);
-
       // add items to the table
-      int column = 0;
-      foreach (const QString &string, items) {
-        if (column >= ui->tableWidget->columnCount())
+      int columnCount = ui->tableWidget->columnCount();
+      for (int column = 0; column < columnCount; column++) {
+        if (static_cast<size_t>(column) >= items.size())
           break;
 
-        QTableWidgetItem *item = new QTableWidgetItem(string);
+        QTableWidgetItem *item =
+          new QTableWidgetItem(QString::fromStdString(items[column]));
         ui->tableWidget->setItem(index, column, item);
-        ++column;
       }
     }
   }
@@ -193,8 +325,6 @@ void ImportCsvFileDialog::openFile()
 
 void ImportCsvFileDialog::import()
 {
-  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
-
   // find the identifier column
   int identifierColumn = -1;
   QString identifierName;
@@ -237,106 +367,107 @@ void ImportCsvFileDialog::import()
   }
 
   // open the file
-  QFile file(m_fileName);
-  if (!file.open(QFile::ReadOnly)) {
+  MongoChem::CsvReader reader;
+  reader.setDelimiter(delimiterCharacter().toLatin1());
+  if (!reader.open(m_fileName)) {
     QMessageBox::critical(this,
                           tr("Error"),
                           tr("Failed to open file: %1")
-                            .arg(file.errorString()));
+                            .arg(reader.errorString()));
     return;
   }
 
+  // skip the titles
+  std::vector<std::string> titles;
+  reader.readRecord(titles);
+
+  // only the identifier and descriptor columns are parsed
+  std::vector<MongoChem::CsvReader::ColumnType> columnTypes(
+    ui->mappingTableWidget->rowCount(), MongoChem::CsvReader::Ignored);
+  columnTypes[identifierColumn] = MongoChem::CsvReader::String;
+  foreach (int j, descriptorColumns)
+    columnTypes[j] = MongoChem::CsvReader::Number;
+  reader.setColumnTypes(columnTypes);
+
   // import data
-  QChar separator = delimiterCharacter();
   int importedMoleculeCount = 0;
 
-  // skip first line
-  file.readLine();
+  ImportBatch batch;
+  batch.identifierName = identifierName.toStdString();
+  foreach (int j, descriptorColumns) {
+    QString name = ui->tableWidget->horizontalHeaderItem(j)->text();
+    batch.descriptorNames.push_back(name.toStdString());
+  }
+
+  // each batch is imported in the background while the next one is read.
+  // only one batch is in flight at a time.
+  QFuture<ImportResult> pendingBatch;
+  bool batchPending = false;
+
+  // the file is parsed in blocks much larger than a batch
+  MongoChem::CsvReader::Block block;
+  size_t blockRow = 0;
+  bool endOfFile = false;
+
+  for (;;) {
+    // store the identifier and descriptor values for the next batch
+    while (batch.identifiers.size() < static_cast<size_t>(importBatchSize) &&
+           !endOfFile) {
+      if (blockRow >= block.rowCount) {
+        endOfFile = !reader.readBlock(block);
+        blockRow = 0;
+        continue;
+      }
 
-  while (!file.atEnd()) {
-    // read line from file
-    QString line = file.readLine().trimmed();
-    if (line.isEmpty())
-      break;
+      batch.identifiers.push_back(block.strings[identifierColumn][blockRow]);
 
-    // parse each item in line into a list of strings
-    QStringList items;
-    QString current;
-    bool inQuotes = false;
+      std::vector<float> values;
+      foreach (int j, descriptorColumns)
+        values.push_back(static_cast<float>(block.numbers[j][blockRow]));
+      batch.values.push_back(values);
 
-    foreach (const QChar &ch, line) {
-      if (ch == '"') {
-        inQuotes = !inQuotes;
-      }
-      else if (ch == separator && !inQuotes) {
-        items.append(current);
-        current.clear();
-      }
-      else {
-        current.append(ch);
-      }
+      blockRow++;
     }
 
-    // add final item
-    if (!current.isEmpty())
-      items.append(current);
-
-    // look up molecule from identifier
-    QString key = items.value(identifierColumn, QString());
-    MongoChem::MoleculeRef molecule =
-        db->findMoleculeFromIdentifier(key.toStdString(),
-                                       identifierName.toStdString());
-
-    // if not found, import the molecule
-    if (!molecule) {
-      molecule =
-        MongoChem::ChemKit::importMoleculeFromIdentifier(key.toStdString(),
-                                                         identifierName.toStdString());
-
-      // automatically generate diagram (if possible)
-      if (molecule) {
-        // create and setup svg generator
-        MongoChem::SvgGenerator *svgGenerator =
-          new MongoChem::SvgGenerator(this);
-        svgGenerator->setInputData(key.toLatin1());
-        svgGenerator->setInputFormat(identifierName.toLatin1());
-
-        // listen to finished signal
-        connect(svgGenerator, SIGNAL(finished(int)),
-                this, SLOT(moleculeDiagramReady(int)));
-
-        // store generator so we can clean it up later
-        m_svgGenerators.insert(svgGenerator);
-
-        // start the generation process in the background
-        svgGenerator->start();
+    // wait for the previous batch to finish
+    if (batchPending) {
+      ImportResult result = pendingBatch.result();
+      batchPending = false;
+
+      importedMoleculeCount += result.importedCount;
+
+      // if we failed to import, print an error.
+      //
+      // @todo refactor this and display to the user in the gui
+      for (size_t i = 0; i < result.failedIdentifiers.size(); i++) {
+        qDebug() << "failed to import molecule from " <<
+                 identifierName <<
+                  " identifier: " <<
+                  result.failedIdentifiers[i].c_str();
       }
-    }
 
-    // if we failed to import, print an error.
-    //
-    // @todo refactor this and display to the user in the gui
-    if (!molecule) {
-      qDebug() << "failed to import molecule from " <<
-               identifierName <<
-                " identifier: " <<
-                key;
-      continue;
+      // automatically generate diagrams (if possible)
+      for (size_t i = 0; i < result.newIdentifiers.size(); i++) {
+        generateDiagram(QByteArray(result.newIdentifiers[i].c_str()),
+                        identifierName.toLatin1());
+      }
     }
 
-    // add descriptor values
-    foreach (int j, descriptorColumns) {
-      QString name = ui->tableWidget->horizontalHeaderItem(j)->text();
-      QString value = items.value(j);
-
-      db->setMoleculeProperty(molecule,
-                              "descriptors." + name.toStdString(),
-                              value.toFloat());
+    if (!batch.identifiers.empty()) {
+      pendingBatch = QtConcurrent::run(importBatch, batch);
+      batchPending = true;
+      batch.identifiers.clear();
+      batch.values.clear();
     }
 
-    importedMoleculeCount++;
+    if (endOfFile && !batchPending)
+      break;
   }
 
+  // the descriptors of existing molecules may have changed so the charts
+  // reload them the next time they are shown
+  MongoChem::DescriptorTable::instance()->invalidate();
+
   // clear the preview
   closeCurrentFile();
 
@@ -357,6 +488,25 @@ void ImportCsvFileDialog::import()
   accept();
 }
 
+void ImportCsvFileDialog::generateDiagram(const QByteArray &identifier,
+                                          const QByteArray &format)
+{
+  // create and setup svg generator
+  MongoChem::SvgGenerator *svgGenerator = new MongoChem::SvgGenerator(this);
+  svgGenerator->setInputData(identifier);
+  svgGenerator->setInputFormat(format);
+
+  // listen to finished signal
+  connect(svgGenerator, SIGNAL(finished(int)),
+          this, SLOT(moleculeDiagramReady(int)));
+
+  // store generator so we can clean it up later
+  m_svgGenerators.insert(svgGenerator);
+
+  // start the generation process in the background
+  svgGenerator->start();
+}
+
 void ImportCsvFileDialog::columnMappingTableCellChanged(int row, int column)
 {
   // get table item
@@ -497,6 +647,10 @@ void ImportCsvFileDialog::moleculeDiagramReady(int errorCode)
 
   if (errorCode != 0 || svg.isEmpty()) {
     qDebug() << "error generating svg";
+
+    // remove and delete generator so import() does not wait for it
+    m_svgGenerators.remove(svgGenerator);
+    svgGenerator->deleteLater();
     return;
   }
 
@@ -58,6 +58,12 @@ private slots:
   void moleculeDiagramReady(int errorCode);
 
 private:
+  /**
+   * Generates the diagram for the molecule with @p identifier in @p format
+   * in the background and stores it when it is ready.
+   */
+  void generateDiagram(const QByteArray &identifier, const QByteArray &format);
+
   Ui::ImportCsvFileDialog *ui;
   QString m_fileName;
   QSet<MongoChem::SvgGenerator *> m_svgGenerators;
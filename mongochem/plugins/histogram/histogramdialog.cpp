@@ -17,6 +17,7 @@
 #include "histogramdialog.h"
 #include "ui_histogramdialog.h"
 
+#include <mongochem/gui/descriptortable.h>
 #include <mongochem/gui/mongodatabase.h>
 
 #include <QVTKInteractor.h>
@@ -32,85 +33,120 @@
 #include <vtkChartXY.h>
 #include <vtkIntArray.h>
 #include <vtkAxis.h>
-#include <vtkStringArray.h>
-#include <vtkMathUtilities.h>
 #include <vtkAnnotationLink.h>
 #include <vtkEventQtSlotConnect.h>
 
+#include <QDebug>
+
+#include <algorithm>
+#include <limits>
+
 using namespace mongo;
 
 namespace {
 
-// Copied from vtkScatterPlotMatrix
-bool PopulateHistograms(vtkTable *input,
-                        vtkTable *output,
-                        vtkStringArray *s,
-                        int NumberOfBins)
+// The number of bins shown when the dialog is opened.
+const int defaultBinCount = 10;
+
+// The number of values whose bin indices are computed at once before the
+// bins are incremented. The index computation has no branches or memory
+// dependencies so the compiler can vectorize it.
+const size_t binIndexBlockSize = 1024;
+
+// Computes the range of the values in @p values which are not NaN. Returns
+// false if every value is NaN.
+bool valueRange(const float *values, size_t valueCount, double range[2])
+{
+  float min = std::numeric_limits<float>::max();
+  float max = -std::numeric_limits<float>::max();
+  for (size_t i = 0; i < valueCount; i++) {
+    min = std::min(min, values[i]);
+    max = std::max(max, values[i]);
+  }
+
+  range[0] = min;
+  range[1] = max;
+  return min <= max;
+}
+
+// Adds the values in @p values to the @p binCount equal width bins spanning
+// [min, max] in @p counts. NaN values (i.e. molecules without the
+// descriptor) are counted in an extra bin at the end of @p counts. Every
+// other value must be within the range.
+void binValues(const float *values,
+               size_t valueCount,
+               double min,
+               double max,
+               int binCount,
+               int *counts)
+{
+  const float origin = static_cast<float>(min);
+  const float scale = static_cast<float>(binCount / (max - min));
+  const int lastBin = binCount - 1;
+
+  int indices[binIndexBlockSize];
+  for (size_t i = 0; i < valueCount; i += binIndexBlockSize) {
+    size_t blockSize = std::min(binIndexBlockSize, valueCount - i);
+    const float *block = values + i;
+
+    for (size_t j = 0; j < blockSize; j++) {
+      float value = block[j];
+      bool isNumber = value == value;
+      int index = static_cast<int>(isNumber ? (value - origin) * scale : 0.0f);
+      indices[j] = isNumber ? std::min(index, lastBin) : binCount;
+    }
+
+    for (size_t j = 0; j < blockSize; j++)
+      counts[indices[j]]++;
+  }
+}
+
+// Returns the query matching the documents where @p field is a number.
+BSONObj numberFilter(const std::string &field)
 {
-  // The output table will have the twice the number of columns, they will be
-  // the x and y for input column. This is the bin centers, and the population.
-  for (vtkIdType i = 0; i < s->GetNumberOfTuples(); ++i)
-    {
-    double minmax[2] = { 0.0, 0.0 };
-    vtkStdString name(s->GetValue(i));
-    vtkDataArray *in =
-        vtkDataArray::SafeDownCast(input->GetColumnByName(name.c_str()));
-    if (in)
-      {
-      // The bin values are the centers, extending +/- half an inc either side
-      in->GetRange(minmax);
-      if (minmax[0] == minmax[1])
-        {
-        minmax[1] = minmax[0] + 1.0;
-        }
-      double inc = (minmax[1] - minmax[0]) / (NumberOfBins) * 1.001;
-      double halfInc = inc / 2.0;
-      vtkSmartPointer<vtkFloatArray> extents =
-          vtkFloatArray::SafeDownCast(
-            output->GetColumnByName(vtkStdString(name + "_extents").c_str()));
-      if (!extents)
-        {
-        extents = vtkSmartPointer<vtkFloatArray>::New();
-        extents->SetName(vtkStdString(name + "_extents").c_str());
-        }
-      extents->SetNumberOfTuples(NumberOfBins);
-      float *centers = static_cast<float *>(extents->GetVoidPointer(0));
-      double min = minmax[0] - 0.0005 * inc + halfInc;
-      for (int j = 0; j < NumberOfBins; ++j)
-        {
-        extents->SetValue(j, static_cast<float>(min + j * inc));
-        }
-      vtkSmartPointer<vtkIntArray> populations =
-          vtkIntArray::SafeDownCast(
-            output->GetColumnByName(vtkStdString(name + "_pops").c_str()));
-      if (!populations)
-        {
-        populations = vtkSmartPointer<vtkIntArray>::New();
-        populations->SetName(vtkStdString(name + "_pops").c_str());
-        }
-      populations->SetNumberOfTuples(NumberOfBins);
-      int *pops = static_cast<int *>(populations->GetVoidPointer(0));
-      for (int k = 0; k < NumberOfBins; ++k)
-        {
-        pops[k] = 0;
-        }
-      for (vtkIdType j = 0; j < in->GetNumberOfTuples(); ++j)
-        {
-        double v(0.0);
-        in->GetTuple(j, &v);
-        for (int k = 0; k < NumberOfBins; ++k)
-          {
-          if (vtkMathUtilities::FuzzyCompare(v, double(centers[k]), halfInc))
-            {
-            ++pops[k];
-            break;
-            }
-          }
-        }
-      output->AddColumn(extents.GetPointer());
-      output->AddColumn(populations.GetPointer());
-      }
+  return BSON(field << BSON("$gte" << -std::numeric_limits<double>::infinity()));
+}
+
+// Runs the aggregation @p pipeline on the molecules collection and returns
+// the resulting documents. Returns false if the server could not run it.
+bool aggregateMolecules(const BSONArray &pipeline,
+                        int batchSize,
+                        std::vector<BSONObj> &results)
+{
+  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
+
+  MongoChem::ScopedMongoConnection conn(db->connectionPool());
+  if (!conn)
+    return false;
+
+  std::string database = db->databaseName();
+  std::string collection =
+    db->moleculesCollectionName().substr(database.size() + 1);
+
+  BSONObj command = BSON("aggregate" << collection
+                         << "pipeline" << pipeline
+                         << "cursor" << BSON("batchSize" << batchSize));
+
+  try {
+    BSONObj info;
+    if (!conn->runCommand(database, command, info)) {
+      qDebug() << "failed to aggregate histogram: "
+               << info.getStringField("errmsg");
+      return false;
     }
+
+    // the results are small enough to fit in the first batch
+    std::vector<BSONElement> batch =
+      info.getObjectField("cursor").getField("firstBatch").Array();
+    for (size_t i = 0; i < batch.size(); i++)
+      results.push_back(batch[i].Obj().getOwned());
+  }
+  catch (DBException &e) {
+    qDebug() << "failed to aggregate histogram: " << e.what();
+    conn.setFailed();
+    return false;
+  }
+
   return true;
 }
 
@@ -118,27 +154,29 @@ bool PopulateHistograms(vtkTable *input,
 
 HistogramDialog::HistogramDialog(QWidget *parent_)
   : MongoChem::AbstractVtkChartWidget(parent_),
-    ui(new Ui::HistogramDialog)
+    ui(new Ui::HistogramDialog),
+    m_tableLoaded(false)
 {
   ui->setupUi(this);
+  ui->binCountSpinBox->setValue(defaultBinCount);
 
   m_vtkWidget = new QVTKWidget(this);
   m_chartView->SetInteractor(m_vtkWidget->GetInteractor());
   m_vtkWidget->SetRenderWindow(m_chartView->GetRenderWindow());
 
-  setupTable();
+  vtkFloatArray *extents = vtkFloatArray::New();
+  extents->SetName("extents");
+  m_histogramTable->AddColumn(extents);
+  extents->Delete();
 
-  vtkStringArray *names = vtkStringArray::New();
-  names->InsertNextValue("tpsa");
-  names->InsertNextValue("xlogp3");
-  names->InsertNextValue("mass");
-  names->InsertNextValue("rotatable-bonds");
-  names->InsertNextValue("vabc");
-  PopulateHistograms(m_table.GetPointer(), m_histogramTable.GetPointer(), names, 10);
-  names->Delete();
+  vtkIntArray *populations = vtkIntArray::New();
+  populations->SetName("pops");
+  m_histogramTable->AddColumn(populations);
+  populations->Delete();
 
   vtkPlotBar *plot = vtkPlotBar::New();
   m_chart->AddPlot(plot);
+  plot->SetInputData(m_histogramTable.GetPointer(), "extents", "pops");
 
   // show the count in the tooltip
   plot->SetTooltipLabelFormat("Count: %y");
@@ -154,6 +192,8 @@ HistogramDialog::HistogramDialog(QWidget *parent_)
   ui->histogramFrame->setLayout(chartLayout);
 
   connect(ui->comboBox, SIGNAL(currentIndexChanged(QString)), SLOT(setDescriptor(QString)));
+  connect(ui->binCountSpinBox, SIGNAL(valueChanged(int)), SLOT(updateHistogram()));
+  connect(ui->serverCheckBox, SIGNAL(toggled(bool)), SLOT(updateHistogram()));
 }
 
 HistogramDialog::~HistogramDialog()
@@ -184,56 +224,143 @@ void HistogramDialog::setSelectionLink(vtkAnnotationLink *link)
 
 void HistogramDialog::setDescriptor(const QString &name)
 {
-  vtkPlotBar *plot = vtkPlotBar::SafeDownCast(m_chart->GetPlot(0));
+  m_chart->GetAxis(0)->SetTitle("Count");
+  m_chart->GetAxis(1)->SetTitle(name.toLatin1().constData());
 
-  QByteArray extentsArrayName = (name.toLower() + "_extents").toLatin1();
-  QByteArray popsArrayName = (name.toLower() + "_pops").toLatin1();
+  updateHistogram();
+}
 
-  plot->SetInputData(m_histogramTable.GetPointer(),
-                     extentsArrayName.constData(),
-                     popsArrayName.constData());
+void HistogramDialog::setupTable()
+{
+  // try again the next time the histogram is updated if the query failed
+  m_tableLoaded = MongoChem::DescriptorTable::instance()->refresh();
+}
 
-  m_chart->GetAxis(0)->SetTitle("Count");
-  m_chart->GetAxis(1)->SetTitle(name.toLatin1().constData());
+void HistogramDialog::updateHistogram()
+{
+  QString descriptor = ui->comboBox->currentText().toLower();
+  int binCount = ui->binCountSpinBox->value();
+
+  double range[2] = { 0.0, 1.0 };
+  std::vector<int> counts;
+  bool ok;
+  if(ui->serverCheckBox->isChecked())
+    ok = computeServerHistogram(descriptor, binCount, range, counts);
+  else
+    ok = computeLocalHistogram(descriptor, binCount, range, counts);
+  if(!ok)
+    counts.assign(binCount, 0);
+
+  // the bars are placed at the centers of the bins
+  double width = (range[1] - range[0]) / binCount;
+
+  vtkFloatArray *extents =
+    vtkFloatArray::SafeDownCast(m_histogramTable->GetColumnByName("extents"));
+  vtkIntArray *populations =
+    vtkIntArray::SafeDownCast(m_histogramTable->GetColumnByName("pops"));
+  extents->SetNumberOfTuples(binCount);
+  populations->SetNumberOfTuples(binCount);
+  for(int i = 0; i < binCount; i++){
+    extents->SetValue(i, static_cast<float>(range[0] + (i + 0.5) * width));
+    populations->SetValue(i, counts[i]);
+  }
+  m_histogramTable->Modified();
 
   m_chart->RecalculateBounds();
   m_chartView->ResetCamera();
   m_vtkWidget->update();
 }
 
-void HistogramDialog::setupTable()
+bool HistogramDialog::computeLocalHistogram(const QString &descriptor,
+                                            int binCount,
+                                            double range[2],
+                                            std::vector<int> &counts)
 {
-  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
+  // the descriptor values are loaded once and then re-binned from memory
+  if(!m_tableLoaded)
+    setupTable();
 
-  // hard coded (for now) descriptor names
-  const char *descriptors[] = {"tpsa",
-                               "xlogp3",
-                               "mass",
-                               "rotatable-bonds",
-                               "vabc"};
-  size_t descriptorCount = sizeof(descriptors) / sizeof(*descriptors);
-
-  // add table columns
-  for(size_t i = 0; i < descriptorCount; i++){
-    vtkFloatArray *array = vtkFloatArray::New();
-    array->SetName(descriptors[i]);
-    m_table->AddColumn(array);
-    array->Delete();
-  }
+  vtkFloatArray *column =
+    MongoChem::DescriptorTable::instance()->column(descriptor.toStdString());
+  if(!column)
+    return false;
 
-  // query molecules collection
-  std::auto_ptr<DBClientCursor> cursor_ = db->queryMolecules(mongo::Query());
+  const float *values = column->GetPointer(0);
+  size_t valueCount = static_cast<size_t>(column->GetNumberOfTuples());
 
-  while(cursor_->more()){
-    BSONObj obj = cursor_->next();
-    if(obj.isEmpty()){
-      continue;
-    }
+  if(!valueRange(values, valueCount, range))
+    range[0] = range[1] = 0.0;
+  if(range[0] == range[1])
+    range[1] = range[0] + 1.0;
 
-    for(size_t i = 0; i < descriptorCount; i++){
-      BSONElement value = obj.getFieldDotted(std::string("descriptors.") + descriptors[i]);
-      vtkFloatArray *array = vtkFloatArray::SafeDownCast(m_table->GetColumn(i));
-      array->InsertNextValue(static_cast<float>(value.numberDouble()));
-    }
+  // the extra bin counts the molecules without the descriptor
+  counts.assign(binCount + 1, 0);
+  binValues(values, valueCount, range[0], range[1], binCount, &counts[0]);
+  counts.pop_back();
+
+  return true;
+}
+
+bool HistogramDialog::computeServerHistogram(const QString &descriptor,
+                                             int binCount,
+                                             double range[2],
+                                             std::vector<int> &counts)
+{
+  std::string field = "descriptors." + descriptor.toStdString();
+  std::string fieldPath = "$" + field;
+
+  // the range only depends on the descriptor so it is cached to re-bin with
+  // a single aggregation
+  if(!m_serverRanges.contains(descriptor)){
+    BSONArrayBuilder pipeline;
+    pipeline << BSON("$match" << numberFilter(field));
+    pipeline << BSON("$group" << BSON("_id" << BSONNULL
+                                      << "min" << BSON("$min" << fieldPath)
+                                      << "max" << BSON("$max" << fieldPath)));
+
+    std::vector<BSONObj> results;
+    if(!aggregateMolecules(pipeline.arr(), 1, results))
+      return false;
+
+    if(results.empty())
+      m_serverRanges[descriptor] = qMakePair(0.0, 0.0);
+    else
+      m_serverRanges[descriptor] =
+        qMakePair(results[0].getField("min").numberDouble(),
+                  results[0].getField("max").numberDouble());
+  }
+
+  QPair<double, double> serverRange = m_serverRanges.value(descriptor);
+  range[0] = serverRange.first;
+  range[1] = serverRange.second;
+  if(range[0] == range[1])
+    range[1] = range[0] + 1.0;
+
+  // bin = floor((value - min) * binCount / (max - min)). $floor is not
+  // available on older servers so the fraction is subtracted instead.
+  BSONObj scaled =
+    BSON("$multiply" << BSON_ARRAY(BSON("$subtract" << BSON_ARRAY(fieldPath << range[0]))
+                                   << binCount / (range[1] - range[0])));
+  BSONObj bin =
+    BSON("$subtract" << BSON_ARRAY(scaled << BSON("$mod" << BSON_ARRAY(scaled << 1))));
+
+  BSONArrayBuilder pipeline;
+  pipeline << BSON("$match" << numberFilter(field));
+  pipeline << BSON("$project" << BSON("bin" << bin));
+  pipeline << BSON("$group" << BSON("_id" << "$bin"
+                                    << "count" << BSON("$sum" << 1)));
+
+  // the maximum value is in its own bin past the last one
+  std::vector<BSONObj> results;
+  if(!aggregateMolecules(pipeline.arr(), binCount + 1, results))
+    return false;
+
+  counts.assign(binCount, 0);
+  for(size_t i = 0; i < results.size(); i++){
+    int index = static_cast<int>(results[i].getField("_id").numberDouble());
+    index = std::max(0, std::min(index, binCount - 1));
+    counts[index] += results[i].getField("count").numberInt();
   }
+
+  return true;
 }
@@ -21,6 +21,10 @@
 
 #include <vtkNew.h>
 
+#include <QMap>
+
+#include <vector>
+
 class QVTKWidget;
 class vtkChartXY;
 class vtkContextView;
@@ -44,14 +48,20 @@ public:
 
 private slots:
   void setDescriptor(const QString &name);
+  void updateHistogram();
 
 private:
   void setupTable();
+  bool computeLocalHistogram(const QString &descriptor, int binCount,
+                             double range[2], std::vector<int> &counts);
+  bool computeServerHistogram(const QString &descriptor, int binCount,
+                              double range[2], std::vector<int> &counts);
 
 private:
   Ui::HistogramDialog *ui;
   QVTKWidget *m_vtkWidget;
-  vtkNew<vtkTable> m_table;
+  bool m_tableLoaded;
+  QMap<QString, QPair<double, double> > m_serverRanges;
   vtkNew<vtkTable> m_histogramTable;
   vtkNew<vtkContextView> m_chartView;
   vtkNew<vtkChartXY> m_chart;
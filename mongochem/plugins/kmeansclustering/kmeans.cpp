@@ -0,0 +1,528 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "kmeans.h"
+
+#include <QtConcurrentMap>
+#include <QThread>
+
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+// The number of points whose distances are computed together. The
+// distances for a block are kept in arrays on the stack so that the inner
+// loops have no dependencies between points and can be vectorized.
+const size_t distanceBlockSize = 256;
+
+// The minimum number of points processed by a single thread.
+const size_t minimumTaskSize = 16384;
+
+// The clustering has converged when fewer than this fraction of the points
+// change cluster in an iteration.
+const double convergedFraction = 0.0001;
+
+// The seed for the random numbers, fixed so that clustering the same points
+// twice gives the same result.
+const unsigned int randomSeed = 2463534242u;
+
+// Returns a random number in [0, 1) and advances @p state (xorshift).
+double nextRandom(unsigned int &state)
+{
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state / 4294967296.0;
+}
+
+// A range of points to be processed on a single thread.
+struct PointTask
+{
+  size_t begin;
+  size_t end;
+  size_t dimension;
+  const float * const *columns;
+  const float *centroids;
+  int centroidCount;
+
+  // for assignment tasks
+  int *assignments;
+  std::vector<double> sums;
+  std::vector<size_t> counts;
+  size_t changed;
+
+  // for seeding tasks, the squared distance from each point to the nearest
+  // centroid and their total
+  float *distances;
+  double totalDistance;
+};
+
+// Finds the nearest of the centroids to each point in [begin, begin + count)
+// and stores the squared distance to it in @p nearestDistances.
+void nearestCentroids(const PointTask &task,
+                      size_t begin,
+                      size_t count,
+                      int *nearest,
+                      float *nearestDistances)
+{
+  float distances[distanceBlockSize];
+
+  for (size_t j = 0; j < count; j++) {
+    nearest[j] = 0;
+    nearestDistances[j] = std::numeric_limits<float>::max();
+  }
+
+  for (int c = 0; c < task.centroidCount; c++) {
+    const float *centroid = task.centroids + c * task.dimension;
+
+    for (size_t j = 0; j < count; j++)
+      distances[j] = 0;
+
+    for (size_t d = 0; d < task.dimension; d++) {
+      const float *x = task.columns[d] + begin;
+      float center = centroid[d];
+      for (size_t j = 0; j < count; j++) {
+        float difference = x[j] - center;
+        distances[j] += difference * difference;
+      }
+    }
+
+    for (size_t j = 0; j < count; j++) {
+      bool closer = distances[j] < nearestDistances[j];
+      nearestDistances[j] = closer ? distances[j] : nearestDistances[j];
+      nearest[j] = closer ? c : nearest[j];
+    }
+  }
+}
+
+struct RunAssignTask
+{
+  void operator()(PointTask &task) const
+  {
+    task.sums.assign(task.centroidCount * task.dimension, 0.0);
+    task.counts.assign(task.centroidCount, 0);
+    task.changed = 0;
+
+    int nearest[distanceBlockSize];
+    float nearestDistances[distanceBlockSize];
+
+    for (size_t i = task.begin; i < task.end; i += distanceBlockSize) {
+      size_t count = std::min(distanceBlockSize, task.end - i);
+      nearestCentroids(task, i, count, nearest, nearestDistances);
+
+      for (size_t j = 0; j < count; j++) {
+        int cluster = nearest[j];
+        if (task.assignments[i + j] != cluster) {
+          task.assignments[i + j] = cluster;
+          task.changed++;
+        }
+
+        task.counts[cluster]++;
+        for (size_t d = 0; d < task.dimension; d++)
+          task.sums[cluster * task.dimension + d] += task.columns[d][i + j];
+      }
+    }
+  }
+};
+
+struct RunSeedTask
+{
+  void operator()(PointTask &task) const
+  {
+    task.totalDistance = 0;
+
+    int nearest[distanceBlockSize];
+    float nearestDistances[distanceBlockSize];
+
+    for (size_t i = task.begin; i < task.end; i += distanceBlockSize) {
+      size_t count = std::min(distanceBlockSize, task.end - i);
+      nearestCentroids(task, i, count, nearest, nearestDistances);
+
+      for (size_t j = 0; j < count; j++) {
+        float distance = std::min(task.distances[i + j], nearestDistances[j]);
+        task.distances[i + j] = distance;
+        task.totalDistance += distance;
+      }
+    }
+  }
+};
+
+// Splits the points into ranges to be processed in parallel.
+std::vector<PointTask> createTasks(size_t pointCount,
+                                   size_t dimension,
+                                   const std::vector<const float *> &columns)
+{
+  size_t taskCount =
+    std::min(static_cast<size_t>(qMax(1, QThread::idealThreadCount())),
+             (pointCount + minimumTaskSize - 1) / minimumTaskSize);
+  taskCount = std::max(taskCount, static_cast<size_t>(1));
+  size_t taskSize = (pointCount + taskCount - 1) / taskCount;
+
+  std::vector<PointTask> tasks(taskCount);
+  for (size_t i = 0; i < taskCount; i++) {
+    PointTask &task = tasks[i];
+    task.begin = std::min(i * taskSize, pointCount);
+    task.end = std::min(task.begin + taskSize, pointCount);
+    task.dimension = dimension;
+    task.columns = columns.empty() ? 0 : &columns[0];
+    task.centroids = 0;
+    task.centroidCount = 0;
+    task.assignments = 0;
+    task.changed = 0;
+    task.distances = 0;
+    task.totalDistance = 0;
+  }
+
+  return tasks;
+}
+
+template<typename Function>
+void runTasks(std::vector<PointTask> &tasks, Function function)
+{
+  if (tasks.size() == 1)
+    function(tasks[0]);
+  else
+    QtConcurrent::blockingMap(tasks, function);
+}
+
+} // end anonymous namespace
+
+KMeans::KMeans()
+  : m_dimension(0),
+    m_pointCount(0),
+    m_miniBatchSize(0),
+    m_maximumIterations(100),
+    m_randomState(randomSeed)
+{
+}
+
+void KMeans::setPoints(const std::vector<const float *> &columns,
+                       size_t pointCount_)
+{
+  m_dimension = columns.size();
+  m_pointCount = pointCount_;
+
+  m_columns.resize(m_dimension);
+  for (size_t d = 0; d < m_dimension; d++)
+    m_columns[d].assign(columns[d], columns[d] + m_pointCount);
+
+  m_centroids.clear();
+  m_assignments.clear();
+  m_clusterSizes.clear();
+}
+
+size_t KMeans::pointCount() const
+{
+  return m_pointCount;
+}
+
+void KMeans::setMiniBatchSize(size_t size)
+{
+  m_miniBatchSize = size;
+}
+
+size_t KMeans::miniBatchSize() const
+{
+  return m_miniBatchSize;
+}
+
+void KMeans::setMaximumIterations(int iterations)
+{
+  m_maximumIterations = std::max(iterations, 1);
+}
+
+int KMeans::maximumIterations() const
+{
+  return m_maximumIterations;
+}
+
+void KMeans::cluster(int k, bool warmStart)
+{
+  k = std::max(k, 1);
+  m_randomState = randomSeed;
+
+  if (!warmStart)
+    m_centroids.clear();
+
+  if (m_pointCount == 0) {
+    m_centroids.assign(k * m_dimension, 0.0f);
+    m_assignments.clear();
+    m_clusterSizes.assign(k, 0);
+    return;
+  }
+
+  // the centroids kept from the previous run come first
+  int keptCount = std::min(clusterCount(), k);
+
+  if (clusterCount() > k)
+    keepLargestClusters(k);
+  else if (clusterCount() < k)
+    seed(k);
+
+  m_assignments.assign(m_pointCount, -1);
+
+  if (m_miniBatchSize > 0 && m_miniBatchSize < m_pointCount) {
+    // the kept centroids start with the weight of a full batch so that the
+    // first samples do not pull them away from their previous positions
+    std::vector<double> centroidCounts(k, 0.0);
+    for (int c = 0; c < keptCount; c++)
+      centroidCounts[c] = static_cast<double>(m_miniBatchSize);
+
+    for (int i = 0; i < m_maximumIterations; i++)
+      miniBatchStep(centroidCounts);
+
+    assign(false);
+    if (relocateEmptyClusters())
+      assign(false);
+  }
+  else {
+    size_t converged = static_cast<size_t>(convergedFraction * m_pointCount);
+    for (int i = 0; i < m_maximumIterations; i++) {
+      size_t changed = assign(true);
+      if (relocateEmptyClusters())
+        continue;
+      if (changed <= converged)
+        break;
+    }
+  }
+}
+
+int KMeans::clusterCount() const
+{
+  return m_dimension > 0 ? static_cast<int>(m_centroids.size() / m_dimension)
+                         : 0;
+}
+
+const std::vector<int>& KMeans::assignments() const
+{
+  return m_assignments;
+}
+
+const std::vector<size_t>& KMeans::clusterSizes() const
+{
+  return m_clusterSizes;
+}
+
+const std::vector<float>& KMeans::centroids() const
+{
+  return m_centroids;
+}
+
+void KMeans::seed(int k)
+{
+  std::vector<const float *> columns;
+  for (size_t d = 0; d < m_dimension; d++)
+    columns.push_back(&m_columns[d][0]);
+
+  // the first centroid is a random point
+  if (m_centroids.empty()) {
+    size_t point = static_cast<size_t>(nextRandom(m_randomState) * m_pointCount);
+    for (size_t d = 0; d < m_dimension; d++)
+      m_centroids.push_back(m_columns[d][point]);
+  }
+
+  std::vector<float> distances(m_pointCount,
+                               std::numeric_limits<float>::max());
+  std::vector<PointTask> tasks = createTasks(m_pointCount, m_dimension,
+                                             columns);
+
+  // compute the distances to the existing centroids
+  int seeded = 0;
+  for (;;) {
+    for (size_t i = 0; i < tasks.size(); i++) {
+      tasks[i].centroids = &m_centroids[seeded * m_dimension];
+      tasks[i].centroidCount = clusterCount() - seeded;
+      tasks[i].distances = &distances[0];
+    }
+    runTasks(tasks, RunSeedTask());
+    seeded = clusterCount();
+
+    if (seeded >= k)
+      break;
+
+    double totalDistance = 0;
+    for (size_t i = 0; i < tasks.size(); i++)
+      totalDistance += tasks[i].totalDistance;
+
+    // choose the next centroid with a probability proportional to the
+    // squared distance to the nearest existing centroid
+    size_t point = 0;
+    if (totalDistance > 0) {
+      double target = nextRandom(m_randomState) * totalDistance;
+      double sum = 0;
+      for (point = 0; point < m_pointCount - 1; point++) {
+        sum += distances[point];
+        if (sum > target)
+          break;
+      }
+    }
+    else {
+      // every point is at an existing centroid
+      point = static_cast<size_t>(nextRandom(m_randomState) * m_pointCount);
+    }
+
+    for (size_t d = 0; d < m_dimension; d++)
+      m_centroids.push_back(m_columns[d][point]);
+  }
+}
+
+void KMeans::keepLargestClusters(int k)
+{
+  int count = clusterCount();
+
+  std::vector<std::pair<size_t, int> > clusters;
+  for (int c = 0; c < count; c++) {
+    size_t size = c < static_cast<int>(m_clusterSizes.size()) ?
+                  m_clusterSizes[c] : 0;
+    clusters.push_back(std::make_pair(size, -c));
+  }
+
+  // sort by decreasing size and then increasing index
+  std::sort(clusters.begin(), clusters.end());
+  std::reverse(clusters.begin(), clusters.end());
+
+  std::vector<float> centroids_;
+  for (int i = 0; i < k; i++) {
+    int c = -clusters[i].second;
+    centroids_.insert(centroids_.end(),
+                      m_centroids.begin() + c * m_dimension,
+                      m_centroids.begin() + (c + 1) * m_dimension);
+  }
+
+  m_centroids.swap(centroids_);
+}
+
+bool KMeans::relocateEmptyClusters()
+{
+  int k = clusterCount();
+
+  bool relocated = false;
+  for (int c = 0; c < k; c++) {
+    if (m_clusterSizes[c] > 0)
+      continue;
+
+    // move the centroid to a random point of the largest cluster, which
+    // splits it on the next assignment
+    int largest = static_cast<int>(
+      std::max_element(m_clusterSizes.begin(), m_clusterSizes.end()) -
+      m_clusterSizes.begin());
+    if (m_clusterSizes[largest] < 2)
+      break;
+
+    size_t point = static_cast<size_t>(nextRandom(m_randomState) * m_pointCount);
+    while (m_assignments[point] != largest)
+      point = (point + 1) % m_pointCount;
+
+    for (size_t d = 0; d < m_dimension; d++)
+      m_centroids[c * m_dimension + d] = m_columns[d][point];
+
+    m_assignments[point] = c;
+    m_clusterSizes[largest]--;
+    m_clusterSizes[c]++;
+    relocated = true;
+  }
+
+  return relocated;
+}
+
+size_t KMeans::assign(bool update)
+{
+  std::vector<const float *> columns;
+  for (size_t d = 0; d < m_dimension; d++)
+    columns.push_back(&m_columns[d][0]);
+
+  int k = clusterCount();
+
+  std::vector<PointTask> tasks = createTasks(m_pointCount, m_dimension,
+                                             columns);
+  for (size_t i = 0; i < tasks.size(); i++) {
+    tasks[i].centroids = &m_centroids[0];
+    tasks[i].centroidCount = k;
+    tasks[i].assignments = &m_assignments[0];
+  }
+  runTasks(tasks, RunAssignTask());
+
+  // combine the results of each task
+  size_t changed = 0;
+  std::vector<double> sums(k * m_dimension, 0.0);
+  m_clusterSizes.assign(k, 0);
+  for (size_t i = 0; i < tasks.size(); i++) {
+    changed += tasks[i].changed;
+    for (int c = 0; c < k; c++)
+      m_clusterSizes[c] += tasks[i].counts[c];
+    for (size_t j = 0; j < sums.size(); j++)
+      sums[j] += tasks[i].sums[j];
+  }
+
+  // move the centroids to the mean of their points. the centroids of empty
+  // clusters are left where they are.
+  if (update) {
+    for (int c = 0; c < k; c++) {
+      if (m_clusterSizes[c] == 0)
+        continue;
+
+      for (size_t d = 0; d < m_dimension; d++)
+        m_centroids[c * m_dimension + d] =
+          static_cast<float>(sums[c * m_dimension + d] / m_clusterSizes[c]);
+    }
+  }
+
+  return changed;
+}
+
+void KMeans::miniBatchStep(std::vector<double> &centroidCounts)
+{
+  size_t batchSize = m_miniBatchSize;
+
+  // gather the sampled points into contiguous columns
+  std::vector<std::vector<float> > batch(m_dimension,
+                                         std::vector<float>(batchSize));
+  for (size_t j = 0; j < batchSize; j++) {
+    size_t point = static_cast<size_t>(nextRandom(m_randomState) * m_pointCount);
+    for (size_t d = 0; d < m_dimension; d++)
+      batch[d][j] = m_columns[d][point];
+  }
+
+  std::vector<const float *> columns;
+  for (size_t d = 0; d < m_dimension; d++)
+    columns.push_back(&batch[d][0]);
+
+  PointTask task = createTasks(batchSize, m_dimension, columns)[0];
+  task.columns = &columns[0];
+  task.centroids = &m_centroids[0];
+  task.centroidCount = clusterCount();
+
+  // find the nearest centroids before moving any of them
+  std::vector<int> nearest(batchSize);
+  std::vector<float> nearestDistances(batchSize);
+  for (size_t i = 0; i < batchSize; i += distanceBlockSize) {
+    size_t count = std::min(distanceBlockSize, batchSize - i);
+    nearestCentroids(task, i, count, &nearest[i], &nearestDistances[i]);
+  }
+
+  // move each centroid towards its points with a learning rate of one over
+  // the number of points it has been moved towards
+  for (size_t j = 0; j < batchSize; j++) {
+    int c = nearest[j];
+    centroidCounts[c] += 1.0;
+    float rate = static_cast<float>(1.0 / centroidCounts[c]);
+    for (size_t d = 0; d < m_dimension; d++) {
+      float &center = m_centroids[c * m_dimension + d];
+      center += rate * (batch[d][j] - center);
+    }
+  }
+}
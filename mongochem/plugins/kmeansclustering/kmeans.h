@@ -0,0 +1,127 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef KMEANS_H
+#define KMEANS_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * The KMeans class clusters points with the k-means algorithm.
+ *
+ * The points are stored as one contiguous column per coordinate. The initial
+ * centroids are chosen with k-means++ seeding. Each assignment step computes
+ * the distances from a block of points to every centroid at once (which the
+ * compiler vectorizes) and the blocks are processed on multiple threads.
+ *
+ * If a mini-batch size is set the centroids are refined with the mini-batch
+ * variant (Sculley, 2010) which only looks at a small random sample of the
+ * points in each iteration, followed by a single assignment of every point.
+ * This is much faster for large sets of points.
+ *
+ * Clustering again with warm start enabled begins with the centroids of the
+ * previous run. When the number of clusters increases the extra centroids
+ * are seeded with k-means++ and when it decreases the centroids of the
+ * largest clusters are kept.
+ */
+class KMeans
+{
+public:
+  /** Creates a new k-means object without any points. */
+  KMeans();
+
+  /**
+   * Sets the points to cluster. @p columns contains a pointer to each of
+   * the coordinates of the @p pointCount points. The values are copied.
+   * This discards the previous centroids.
+   */
+  void setPoints(const std::vector<const float *> &columns, size_t pointCount);
+
+  /** Returns the number of points. */
+  size_t pointCount() const;
+
+  /**
+   * Sets the number of points sampled in each iteration of the mini-batch
+   * variant. If @p size is 0 (the default) every point is used in each
+   * iteration.
+   */
+  void setMiniBatchSize(size_t size);
+
+  /** Returns the mini-batch size. */
+  size_t miniBatchSize() const;
+
+  /** Sets the maximum number of iterations (default 100). */
+  void setMaximumIterations(int iterations);
+
+  /** Returns the maximum number of iterations. */
+  int maximumIterations() const;
+
+  /**
+   * Clusters the points into @p k clusters. If @p warmStart is @c true the
+   * centroids from the previous run are used as the starting point.
+   */
+  void cluster(int k, bool warmStart = true);
+
+  /** Returns the number of clusters. */
+  int clusterCount() const;
+
+  /** Returns the cluster of each point. */
+  const std::vector<int>& assignments() const;
+
+  /** Returns the number of points in each cluster. */
+  const std::vector<size_t>& clusterSizes() const;
+
+  /** Returns the coordinates of each centroid, one centroid after another. */
+  const std::vector<float>& centroids() const;
+
+private:
+  /** Adds centroids chosen with k-means++ until there are @p k of them. */
+  void seed(int k);
+
+  /** Keeps the centroids of the @p k largest clusters. */
+  void keepLargestClusters(int k);
+
+  /**
+   * Assigns every point to its nearest centroid and moves each centroid to
+   * the mean of its points if @p update is @c true. Returns the number of
+   * points whose cluster changed.
+   */
+  size_t assign(bool update);
+
+  /**
+   * Moves the centroid of each empty cluster to a point in the largest
+   * cluster. Returns @c true if any centroid was moved.
+   */
+  bool relocateEmptyClusters();
+
+  /** Refines the centroids with one mini-batch. */
+  void miniBatchStep(std::vector<double> &centroidCounts);
+
+private:
+  size_t m_dimension;
+  size_t m_pointCount;
+  std::vector<std::vector<float> > m_columns;
+  size_t m_miniBatchSize;
+  int m_maximumIterations;
+  unsigned int m_randomState;
+
+  std::vector<float> m_centroids;
+  std::vector<int> m_assignments;
+  std::vector<size_t> m_clusterSizes;
+};
+
+#endif // KMEANS_H
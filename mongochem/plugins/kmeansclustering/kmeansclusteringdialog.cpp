@@ -15,11 +15,13 @@
 ******************************************************************************/
 
 #include "mongodatabase.h"
-#include "chemkit.h"
+#include "descriptorengine.h"
 
 #include "kmeansclusteringdialog.h"
 #include "ui_kmeansclusteringdialog.h"
 
+#include "kmeans.h"
+
 #include <QtWidgets/QProgressDialog>
 #include <QtGui/QStandardItemModel>
 
@@ -36,7 +38,6 @@
 #include <vtkPlotPoints3D.h>
 #include <vtkRenderWindow.h>
 #include <vtkSmartPointer.h>
-#include <vtkKMeansStatistics.h>
 
 #include <boost/array.hpp>
 
@@ -48,6 +49,16 @@
 #include <boost/foreach.hpp>
 #define foreach BOOST_FOREACH
 
+namespace {
+
+// Sets with more molecules than this are clustered with mini-batches.
+const size_t miniBatchThreshold = 100000;
+
+// The number of molecules sampled in each mini-batch.
+const size_t miniBatchSize = 4096;
+
+} // end anonymous namespace
+
 class KMeansClusteringDialogPrivate
 {
 public:
@@ -60,6 +71,9 @@ public:
   vtkPlotPoints3D *plot;
   boost::array<std::string, 3> descriptors;
   vtkNew<vtkLookupTable> lut;
+  KMeans kmeans;
+  MongoChem::DescriptorEngine *engine;
+  QProgressDialog *progressDialog;
 };
 
 KMeansClusteringDialog::KMeansClusteringDialog(QWidget *parent_)
@@ -73,6 +87,17 @@ KMeansClusteringDialog::KMeansClusteringDialog(QWidget *parent_)
   // setup descriptors
   setupDescriptors();
 
+  // setup descriptor calculation
+  d->engine = new MongoChem::DescriptorEngine(this);
+  d->progressDialog = new QProgressDialog(tr("Calculating Descriptors"),
+                                          tr("Cancel"),
+                                          0,
+                                          0,
+                                          this);
+  d->progressDialog->setWindowModality(Qt::WindowModal);
+  d->progressDialog->setMinimumDuration(0);
+  d->progressDialog->reset();
+
   // setup vtk widget
   d->vtkWidget = new QVTKWidget(this);
   d->chartView->SetInteractor(d->vtkWidget->GetInteractor());
@@ -106,6 +131,12 @@ KMeansClusteringDialog::KMeansClusteringDialog(QWidget *parent_)
           this, SLOT(zDescriptorChanged(QString)));
   connect(d->vtkWidget, SIGNAL(mouseEvent(QMouseEvent*)),
           this, SLOT(viewMouseEvent(QMouseEvent*)));
+  connect(d->engine, SIGNAL(progress(int,int)),
+          this, SLOT(descriptorsProgress(int,int)));
+  connect(d->engine, SIGNAL(finished()),
+          this, SLOT(descriptorsFinished()));
+  connect(d->progressDialog, SIGNAL(canceled()),
+          this, SLOT(descriptorsCanceled()));
 }
 
 KMeansClusteringDialog::~KMeansClusteringDialog()
@@ -119,19 +150,51 @@ void KMeansClusteringDialog::setMolecules(const std::vector<MongoChem::MoleculeR
   // call super-class
   MongoChem::AbstractClusteringWidget::setMolecules(molecules_);
 
-  // display progress dialog
-  QProgressDialog progressDialog("Calculating Descriptors",
-                                 "Cancel",
-                                 0,
-                                 molecules_.size(),
-                                 this);
+  // set molecules
+  d->molecules = molecules_;
+
+  // calculate descriptors
+  updateDescriptors();
+}
+
+void KMeansClusteringDialog::updateDescriptors()
+{
+  std::vector<std::string> descriptors(d->descriptors.begin(),
+                                       d->descriptors.end());
+
+  // only the values which are not already cached are calculated
+  if (!d->engine->compute(d->molecules, descriptors)) {
+    d->progressDialog->reset();
+    updateTable();
+    return;
+  }
 
   // pop-up progress dialog immediately
-  progressDialog.setMinimumDuration(0);
+  d->progressDialog->setRange(0, static_cast<int>(d->molecules.size()));
+  d->progressDialog->setValue(0);
+}
 
-  // set molecules
-  d->molecules = molecules_;
+void KMeansClusteringDialog::descriptorsProgress(int value, int maximum)
+{
+  d->progressDialog->setRange(0, maximum);
+  d->progressDialog->setValue(value);
+}
 
+void KMeansClusteringDialog::descriptorsFinished()
+{
+  d->progressDialog->reset();
+  updateTable();
+}
+
+void KMeansClusteringDialog::descriptorsCanceled()
+{
+  // show the molecules whose descriptors were calculated before canceling
+  d->engine->cancel();
+  updateTable();
+}
+
+void KMeansClusteringDialog::updateTable()
+{
   // remove old plot
   if (d->plot) {
     d->chart->ClearPlots();
@@ -159,27 +222,34 @@ void KMeansClusteringDialog::setMolecules(const std::vector<MongoChem::MoleculeR
   d->table->AddColumn(colorArray);
   colorArray->Delete();
 
-  // calculate descriptors
-  foreach (const MongoChem::MoleculeRef &ref, molecules_) {
-    // stop calculating if the user clicked cancel
-    if(progressDialog.wasCanceled())
-      break;
-
-    // create molecule object
-    boost::shared_ptr<const chemkit::Molecule> molecule =
-        MongoChem::ChemKit::createMolecule(ref);
+  foreach (const MongoChem::MoleculeRef &molecule, d->molecules) {
+    // skip molecules whose descriptors could not be calculated (or were
+    // not calculated before canceling)
+    boost::array<float, 3> values;
+    bool valid = true;
+    for (size_t i = 0; i < 3 && valid; i++) {
+      values[i] = d->engine->value(molecule, d->descriptors[i]);
+      valid = values[i] == values[i];
+    }
+    if (!valid)
+      continue;
 
-    // calculate descriptors for the molecule
     for (size_t i = 0; i < 3; i++)
-      arrays[i]->InsertNextValue(molecule->descriptor(d->descriptors[i]).toFloat());
+      arrays[i]->InsertNextValue(values[i]);
 
     // set cluster to 0 (will be set to its real value later by running k-means)
     colorArray->InsertNextValue(0);
-
-    // update progress dialog
-    progressDialog.setValue(progressDialog.value() + 1);
   }
 
+  // cluster the new points from scratch
+  std::vector<const float *> columns;
+  for (size_t i = 0; i < 3; i++)
+    columns.push_back(arrays[i]->GetPointer(0));
+  size_t pointCount = static_cast<size_t>(d->table->GetNumberOfRows());
+  d->kmeans.setPoints(columns, pointCount);
+  d->kmeans.setMiniBatchSize(pointCount > miniBatchThreshold ? miniBatchSize
+                                                             : 0);
+
   // run k-means statstics
   runKMeansStatistics();
 
@@ -239,7 +309,7 @@ void KMeansClusteringDialog::setDescriptor(int index, const QString &descriptor_
   d->descriptors[index] = descriptor_.toStdString();
 
   // update
-  setMolecules(d->molecules);
+  updateDescriptors();
 }
 
 QString KMeansClusteringDialog::descriptor(int index)
@@ -374,34 +444,11 @@ void KMeansClusteringDialog::setupDescriptors()
 
 void KMeansClusteringDialog::runKMeansStatistics()
 {
-  // run k-means statistics
-  vtkNew<vtkKMeansStatistics> kMeansStatistics;
-  kMeansStatistics->RequestSelectedColumns();
-  kMeansStatistics->SetAssessOption(true);
-  kMeansStatistics->SetDefaultNumberOfClusters(d->kValue);
-  kMeansStatistics->SetInputData(vtkStatisticsAlgorithm::INPUT_DATA,
-                                 d->table.GetPointer());
-
-  for (size_t i = 0; i < 3; i++)
-    kMeansStatistics->SetColumnStatus(d->descriptors[i].c_str(), 1);
+  // run k-means starting from the centroids for the previous k value
+  d->kmeans.cluster(d->kValue);
 
-  kMeansStatistics->RequestSelectedColumns();
-  kMeansStatistics->Update();
-
-  // assign molecules to clusters
-  vtkNew<vtkIntArray> clusterAssignments;
-  clusterAssignments->SetNumberOfComponents(1);
-
-  size_t clusterCount = kMeansStatistics->GetOutput()->GetNumberOfColumns();
-  std::vector<size_t> clusterSizes(clusterCount);
-
-  for (vtkIdType r = 0; r < kMeansStatistics->GetOutput()->GetNumberOfRows(); r++) {
-    vtkVariant v = kMeansStatistics->GetOutput()->GetValue(r, clusterCount - 1);
-
-    int cluster = v.ToInt();
-    clusterAssignments->InsertNextValue(cluster);
-    clusterSizes[cluster]++;
-  }
+  const std::vector<int> &clusterAssignments = d->kmeans.assignments();
+  const std::vector<size_t> &clusterSizes = d->kmeans.clusterSizes();
 
   // update lookup table
   d->lut->SetNumberOfTableValues(d->kValue);
@@ -411,7 +458,7 @@ void KMeansClusteringDialog::runKMeansStatistics()
   vtkIntArray *colorArray =
     vtkIntArray::SafeDownCast(d->table->GetColumnByName("color"));
   for(vtkIdType i = 0; i < colorArray->GetNumberOfTuples(); i++){
-    colorArray->SetValue(i, clusterAssignments->GetValue(i));
+    colorArray->SetValue(i, clusterAssignments[i]);
   }
   d->table->Modified();
 
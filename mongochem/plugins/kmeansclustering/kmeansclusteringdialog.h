@@ -54,9 +54,14 @@ private slots:
   void yDescriptorChanged(const QString &descriptor);
   void zDescriptorChanged(const QString &descriptor);
   void viewMouseEvent(QMouseEvent *event);
+  void descriptorsProgress(int value, int maximum);
+  void descriptorsFinished();
+  void descriptorsCanceled();
 
 private:
   void setupDescriptors();
+  void updateDescriptors();
+  void updateTable();
   void runKMeansStatistics();
 
 private:
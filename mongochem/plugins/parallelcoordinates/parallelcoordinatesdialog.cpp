@@ -17,7 +17,7 @@
 #include "parallelcoordinatesdialog.h"
 #include "ui_parallelcoordinatesdialog.h"
 
-#include <mongochem/gui/mongodatabase.h>
+#include <mongochem/gui/descriptortable.h>
 
 #include <QVTKInteractor.h>
 #include <vtkContextView.h>
@@ -26,11 +26,9 @@
 #include <vtkChartParallelCoordinates.h>
 #include <vtkPlotParallelCoordinates.h>
 #include <vtkContextScene.h>
-#include <vtkFloatArray.h>
 #include <vtkAnnotationLink.h>
 #include <vtkEventQtSlotConnect.h>
 
-using namespace mongo;
 using MongoChem::AbstractVtkChartWidget;
 
 ParallelCoordinatesDialog::ParallelCoordinatesDialog(QWidget *parent_)
@@ -82,38 +80,8 @@ void ParallelCoordinatesDialog::setSelectionLink(vtkAnnotationLink *link)
 
 void ParallelCoordinatesDialog::setupTable()
 {
-  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
-
-  // hard coded (for now) descriptor names
-  const char *descriptors[] = {"tpsa",
-                               "xlogp3",
-                               "mass",
-                               "rotatable-bonds",
-                               "vabc"};
-  size_t descriptorCount = sizeof(descriptors) / sizeof(*descriptors);
-
-  // add table columns
-  for (size_t i = 0; i < descriptorCount; i++) {
-    vtkFloatArray *array = vtkFloatArray::New();
-    array->SetName(descriptors[i]);
-    m_table->AddColumn(array);
-    array->Delete();
-  }
-
-  // query molecules collection
-  std::auto_ptr<DBClientCursor> cursor_ = db->queryMolecules(mongo::Query());
-
-  while (cursor_->more()) {
-    BSONObj obj = cursor_->next();
-    if (obj.isEmpty())
-      continue;
-
-    for (size_t i = 0; i < descriptorCount; i++) {
-      BSONElement value =
-        obj.getFieldDotted(std::string("descriptors.") + descriptors[i]);
-      vtkFloatArray *array =
-        vtkFloatArray::SafeDownCast(m_table->GetColumn(i));
-      array->InsertNextValue(static_cast<float>(value.numberDouble()));
-    }
-  }
+  MongoChem::DescriptorTable *descriptors =
+    MongoChem::DescriptorTable::instance();
+  descriptors->refresh();
+  descriptors->addColumns(m_table.GetPointer());
 }
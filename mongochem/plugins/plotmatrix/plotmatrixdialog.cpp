@@ -17,7 +17,7 @@
 #include "plotmatrixdialog.h"
 #include "ui_plotmatrixdialog.h"
 
-#include <mongochem/gui/mongodatabase.h>
+#include <mongochem/gui/descriptortable.h>
 
 #include <QVTKInteractor.h>
 #include <vtkContextView.h>
@@ -25,14 +25,12 @@
 #include <vtkTable.h>
 #include <vtkScatterPlotMatrix.h>
 #include <vtkContextScene.h>
-#include <vtkFloatArray.h>
 #include <vtkStringArray.h>
 #include <vtkAnnotationLink.h>
 #include <vtkEventQtSlotConnect.h>
 
 #include <mongochem/gui/diagramtooltipitem.h>
 
-using namespace mongo;
 using MongoChem::AbstractVtkChartWidget;
 
 PlotMatrixDialog::PlotMatrixDialog(QWidget *parent_)
@@ -50,8 +48,8 @@ PlotMatrixDialog::PlotMatrixDialog(QWidget *parent_)
   vtkNew<MongoChem::DiagramTooltipItem> tooltip;
   m_plotMatrix->SetTooltip(tooltip.GetPointer());
   m_plotMatrix->SetIndexedLabels(
-    vtkStringArray::SafeDownCast(m_table->GetColumnByName("name")));
-  m_table->RemoveColumnByName("name");
+    vtkStringArray::SafeDownCast(m_table->GetColumnByName("id")));
+  m_table->RemoveColumnByName("id");
   m_chartView->GetScene()->AddItem(m_plotMatrix.GetPointer());
   m_plotMatrix->SetInput(m_table.GetPointer());
 
@@ -88,48 +86,10 @@ void PlotMatrixDialog::setSelectionLink(vtkAnnotationLink *link)
 
 void PlotMatrixDialog::setupTable()
 {
-  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
-
-  // hard coded (for now) descriptor names
-  const char *descriptors[] = {"tpsa",
-                               "xlogp3",
-                               "mass",
-                               "rotatable-bonds",
-                               "vabc"};
-  size_t descriptorCount = sizeof(descriptors) / sizeof(*descriptors);
-
-  // add table columns
-  for (size_t i = 0; i < descriptorCount; ++i) {
-    vtkFloatArray *array = vtkFloatArray::New();
-    array->SetName(descriptors[i]);
-    m_table->AddColumn(array);
-    array->Delete();
-  }
-
-  // create labels array
-  vtkNew<vtkStringArray> nameArray;
-  nameArray->SetName("name");
-  m_table->AddColumn(nameArray.GetPointer());
-
-  // query molecules collection
-  std::auto_ptr<DBClientCursor> cursor_ = db->queryMolecules(mongo::Query());
-
-  while (cursor_->more()) {
-    BSONObj obj = cursor_->next();
-    if (obj.isEmpty())
-      continue;
-
-    for (size_t i = 0; i < descriptorCount; ++i) {
-      BSONElement value = obj.getFieldDotted(std::string("descriptors.")
-                                             + descriptors[i]);
-      vtkFloatArray *array = vtkFloatArray::SafeDownCast(m_table->GetColumn(i));
-      array->InsertNextValue(static_cast<float>(value.numberDouble()));
-    }
-
-    BSONElement nameElement = obj.getField("name");
-    std::string name;
-    if (!nameElement.eoo())
-      name = nameElement.str();
-    nameArray->InsertNextValue(name);
-  }
+  MongoChem::DescriptorTable *descriptors =
+    MongoChem::DescriptorTable::instance();
+  descriptors->refresh();
+
+  // the tooltips look up the molecules by id
+  descriptors->addColumns(m_table.GetPointer(), true);
 }
@@ -0,0 +1,254 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "pointdensitygrid.h"
+
+#include <algorithm>
+
+namespace {
+
+// The number of cells along each axis of the grid.
+const int gridSize = 512;
+
+// Accumulates points into the bins of a view.
+class BinAccumulator
+{
+public:
+  BinAccumulator(const double bounds[4], int binCount)
+    : m_binCount(binCount),
+      m_counts(binCount * binCount, 0),
+      m_sumX(binCount * binCount, 0),
+      m_sumY(binCount * binCount, 0)
+  {
+    std::copy(bounds, bounds + 4, m_bounds);
+  }
+
+  void add(double x, double y, unsigned int count)
+  {
+    int column = 0;
+    if (m_bounds[1] > m_bounds[0]) {
+      column = static_cast<int>((x - m_bounds[0]) /
+                                (m_bounds[1] - m_bounds[0]) * m_binCount);
+      column = std::min(std::max(column, 0), m_binCount - 1);
+    }
+
+    int row = 0;
+    if (m_bounds[3] > m_bounds[2]) {
+      row = static_cast<int>((y - m_bounds[2]) /
+                             (m_bounds[3] - m_bounds[2]) * m_binCount);
+      row = std::min(std::max(row, 0), m_binCount - 1);
+    }
+
+    size_t bin = static_cast<size_t>(row) * m_binCount + column;
+    m_counts[bin] += count;
+    m_sumX[bin] += x * count;
+    m_sumY[bin] += y * count;
+  }
+
+  void fill(PointDensityGrid::View &view) const
+  {
+    view.aggregated = true;
+    for (size_t i = 0; i < m_counts.size(); i++) {
+      if (m_counts[i] == 0)
+        continue;
+
+      view.x.push_back(static_cast<float>(m_sumX[i] / m_counts[i]));
+      view.y.push_back(static_cast<float>(m_sumY[i] / m_counts[i]));
+      view.counts.push_back(static_cast<float>(m_counts[i]));
+    }
+  }
+
+private:
+  double m_bounds[4];
+  int m_binCount;
+  std::vector<unsigned int> m_counts;
+  std::vector<double> m_sumX;
+  std::vector<double> m_sumY;
+};
+
+bool contains(const double bounds[4], double x, double y)
+{
+  return x >= bounds[0] && x <= bounds[1] && y >= bounds[2] && y <= bounds[3];
+}
+
+} // end anonymous namespace
+
+PointDensityGrid::PointDensityGrid()
+  : m_builtCount(0)
+{
+  std::fill(m_bounds, m_bounds + 4, 0.0);
+}
+
+void PointDensityGrid::clear()
+{
+  m_x.clear();
+  m_y.clear();
+  m_ids.clear();
+  m_order.clear();
+  m_cellStart.clear();
+  m_cellSumX.clear();
+  m_cellSumY.clear();
+  std::fill(m_bounds, m_bounds + 4, 0.0);
+  m_builtCount = 0;
+}
+
+void PointDensityGrid::addPoint(float x, float y, const mongo::OID &id)
+{
+  m_x.push_back(x);
+  m_y.push_back(y);
+  m_ids.push_back(id);
+}
+
+size_t PointDensityGrid::size() const
+{
+  return m_x.size();
+}
+
+void PointDensityGrid::build()
+{
+  m_builtCount = m_x.size();
+  if (m_builtCount == 0)
+    return;
+
+  m_bounds[0] = *std::min_element(m_x.begin(), m_x.end());
+  m_bounds[1] = *std::max_element(m_x.begin(), m_x.end());
+  m_bounds[2] = *std::min_element(m_y.begin(), m_y.end());
+  m_bounds[3] = *std::max_element(m_y.begin(), m_y.end());
+
+  // counting sort of the points by cell
+  size_t cellCount = static_cast<size_t>(gridSize) * gridSize;
+  std::vector<unsigned int> cells(m_builtCount);
+  m_cellStart.assign(cellCount + 1, 0);
+  m_cellSumX.assign(cellCount, 0);
+  m_cellSumY.assign(cellCount, 0);
+  for (size_t i = 0; i < m_builtCount; i++) {
+    cells[i] = cellRow(m_y[i]) * gridSize + cellColumn(m_x[i]);
+    m_cellStart[cells[i] + 1]++;
+    m_cellSumX[cells[i]] += m_x[i];
+    m_cellSumY[cells[i]] += m_y[i];
+  }
+
+  for (size_t i = 0; i < cellCount; i++)
+    m_cellStart[i + 1] += m_cellStart[i];
+
+  std::vector<unsigned int> next(m_cellStart.begin(), m_cellStart.end() - 1);
+  m_order.resize(m_builtCount);
+  for (size_t i = 0; i < m_builtCount; i++)
+    m_order[next[cells[i]]++] = static_cast<unsigned int>(i);
+}
+
+void PointDensityGrid::bounds(double bounds_[4]) const
+{
+  std::copy(m_bounds, m_bounds + 4, bounds_);
+}
+
+PointDensityGrid::View PointDensityGrid::query(const double bounds_[4],
+                                               size_t maximumPoints,
+                                               int binCount) const
+{
+  View view;
+  if (m_builtCount == 0 || bounds_[1] < bounds_[0] || bounds_[3] < bounds_[2])
+    return view;
+
+  int firstColumn = cellColumn(static_cast<float>(bounds_[0]));
+  int lastColumn = cellColumn(static_cast<float>(bounds_[1]));
+  int firstRow = cellRow(static_cast<float>(bounds_[2]));
+  int lastRow = cellRow(static_cast<float>(bounds_[3]));
+
+  // the number of points in the cells overlapping the view is an upper
+  // bound for the number of visible points
+  size_t count = 0;
+  for (int row = firstRow; row <= lastRow; row++) {
+    count += m_cellStart[row * gridSize + lastColumn + 1] -
+             m_cellStart[row * gridSize + firstColumn];
+  }
+
+  if (count <= maximumPoints) {
+    for (int row = firstRow; row <= lastRow; row++) {
+      unsigned int begin = m_cellStart[row * gridSize + firstColumn];
+      unsigned int end = m_cellStart[row * gridSize + lastColumn + 1];
+      for (unsigned int i = begin; i < end; i++) {
+        unsigned int point = m_order[i];
+        if (!contains(bounds_, m_x[point], m_y[point]))
+          continue;
+
+        view.x.push_back(m_x[point]);
+        view.y.push_back(m_y[point]);
+        view.counts.push_back(1);
+        view.ids.push_back(m_ids[point]);
+      }
+    }
+
+    return view;
+  }
+
+  BinAccumulator bins(bounds_, binCount);
+
+  // if each bin covers several cells the cells are binned rather than the
+  // points they contain
+  double cellWidth = (m_bounds[1] - m_bounds[0]) / gridSize;
+  double cellHeight = (m_bounds[3] - m_bounds[2]) / gridSize;
+  double binWidth = (bounds_[1] - bounds_[0]) / binCount;
+  double binHeight = (bounds_[3] - bounds_[2]) / binCount;
+  bool binCells = binWidth >= 2 * cellWidth && binHeight >= 2 * cellHeight;
+
+  for (int row = firstRow; row <= lastRow; row++) {
+    for (int column = firstColumn; column <= lastColumn; column++) {
+      size_t cell = static_cast<size_t>(row) * gridSize + column;
+      unsigned int begin = m_cellStart[cell];
+      unsigned int end = m_cellStart[cell + 1];
+      if (begin == end)
+        continue;
+
+      if (binCells) {
+        double x = m_cellSumX[cell] / (end - begin);
+        double y = m_cellSumY[cell] / (end - begin);
+        if (contains(bounds_, x, y))
+          bins.add(x, y, end - begin);
+        continue;
+      }
+
+      for (unsigned int i = begin; i < end; i++) {
+        unsigned int point = m_order[i];
+        if (contains(bounds_, m_x[point], m_y[point]))
+          bins.add(m_x[point], m_y[point], 1);
+      }
+    }
+  }
+
+  bins.fill(view);
+  return view;
+}
+
+int PointDensityGrid::cellColumn(float x) const
+{
+  double width = m_bounds[1] - m_bounds[0];
+  if (width <= 0)
+    return 0;
+
+  double column = (x - m_bounds[0]) / width * gridSize;
+  return static_cast<int>(std::min(std::max(column, 0.0), gridSize - 1.0));
+}
+
+int PointDensityGrid::cellRow(float y) const
+{
+  double height = m_bounds[3] - m_bounds[2];
+  if (height <= 0)
+    return 0;
+
+  double row = (y - m_bounds[2]) / height * gridSize;
+  return static_cast<int>(std::min(std::max(row, 0.0), gridSize - 1.0));
+}
@@ -0,0 +1,108 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef POINTDENSITYGRID_H
+#define POINTDENSITYGRID_H
+
+#include <mongo/client/dbclient.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * The PointDensityGrid class stores the points of a scatter plot in a
+ * uniform grid so that the points within a view can be found quickly.
+ *
+ * When few points are visible query() returns them individually along with
+ * their molecule ids. Otherwise the visible points are aggregated into bins
+ * and the number of points in each bin is returned instead. Bins which are
+ * larger than the grid cells are built from per-cell sums, so zooming out
+ * does not visit every point.
+ */
+class PointDensityGrid
+{
+public:
+  /** The points (or bins) within a view. */
+  struct View
+  {
+    View() : aggregated(false) { }
+
+    /** The positions of the points, or the mean position of each bin. */
+    std::vector<float> x;
+    std::vector<float> y;
+
+    /** The number of points at each position (1 for individual points). */
+    std::vector<float> counts;
+
+    /**
+     * The molecule id of each point. This is empty if the points are
+     * aggregated.
+     */
+    std::vector<mongo::OID> ids;
+
+    /** @c true if the points are aggregated into bins. */
+    bool aggregated;
+  };
+
+  /** Creates a new, empty, grid. */
+  PointDensityGrid();
+
+  /** Removes all points from the grid. */
+  void clear();
+
+  /** Adds a point. build() must be called before it is queried. */
+  void addPoint(float x, float y, const mongo::OID &id);
+
+  /** Returns the number of points. */
+  size_t size() const;
+
+  /** Sorts the points into the grid cells. This is O(n). */
+  void build();
+
+  /** Returns the bounds (xMin, xMax, yMin, yMax) of the points. */
+  void bounds(double bounds[4]) const;
+
+  /**
+   * Returns the points within @p bounds (xMin, xMax, yMin, yMax). If more
+   * than @p maximumPoints are visible they are aggregated into
+   * @p binCount x @p binCount bins.
+   */
+  View query(const double bounds[4],
+             size_t maximumPoints,
+             int binCount) const;
+
+private:
+  int cellColumn(float x) const;
+  int cellRow(float y) const;
+
+  std::vector<float> m_x;
+  std::vector<float> m_y;
+  std::vector<mongo::OID> m_ids;
+
+  double m_bounds[4];
+  size_t m_builtCount;
+
+  // the points sorted by cell. the points in cell i are
+  // m_order[m_cellStart[i]] to m_order[m_cellStart[i + 1] - 1].
+  std::vector<unsigned int> m_order;
+  std::vector<unsigned int> m_cellStart;
+
+  // the sum of the point positions in each cell
+  std::vector<double> m_cellSumX;
+  std::vector<double> m_cellSumY;
+};
+
+#endif // POINTDENSITYGRID_H
@@ -32,8 +32,14 @@
 #include <vtkTable.h>
 #include <vtkContextView.h>
 #include <vtkChartXY.h>
-#include <vtkAnnotationLink.h>
 #include <vtkEventQtSlotConnect.h>
+#include <vtkLookupTable.h>
+#include <vtkPlotPoints.h>
+
+#include <QtCore/QTime>
+#include <QtCore/QTimer>
+
+#include <cmath>
 
 #include <mongochem/gui/diagramtooltipitem.h>
 #include <mongochem/gui/queryprogressdialog.h>
@@ -41,6 +47,23 @@
 using namespace mongo;
 using MongoChem::AbstractVtkChartWidget;
 
+namespace {
+
+// The number of molecules returned by the server in each batch.
+const int queryBatchSize = 10000;
+
+// The minimum time (in milliseconds) between redraws while points are loaded.
+const int redrawInterval = 250;
+
+// The maximum number of points drawn individually. If more are visible they
+// are aggregated into bins.
+const size_t maximumVisiblePoints = 20000;
+
+// The number of bins along each axis when the points are aggregated.
+const int densityBinCount = 200;
+
+} // end anonymous namespace
+
 ScatterPlotDialog::ScatterPlotDialog(QWidget *parent_)
   : AbstractVtkChartWidget(parent_),
     ui(new Ui::ScatterPlotDialog)
@@ -55,11 +78,17 @@ ScatterPlotDialog::ScatterPlotDialog(QWidget *parent_)
   vtkFloatArray *yArray = vtkFloatArray::New();
   yArray->SetName("Y");
 
+  // the number of points at each position, on a log scale
+  vtkFloatArray *densityArray = vtkFloatArray::New();
+  densityArray->SetName("density");
+
   m_table->AddColumn(xArray);
   m_table->AddColumn(yArray);
+  m_table->AddColumn(densityArray);
 
   xArray->Delete();
   yArray->Delete();
+  densityArray->Delete();
 
   m_vtkWidget = new QVTKWidget(this);
 
@@ -71,12 +100,22 @@ ScatterPlotDialog::ScatterPlotDialog(QWidget *parent_)
   scatter->SetInputData(m_table.GetPointer(), "X", "Y");
   scatter->SetColor(0, 0, 1.0);
 
-  // create labels array
-  vtkStringArray *nameArray = vtkStringArray::New();
-  nameArray->SetName("name");
-  scatter->SetIndexedLabels(nameArray);
+  // color aggregated points from blue (sparse) to red (dense)
+  m_densityLookupTable->SetHueRange(0.667, 0.0);
+  m_densityLookupTable->Build();
+  vtkPlotPoints *points = vtkPlotPoints::SafeDownCast(scatter);
+  if (points) {
+    points->SetLookupTable(m_densityLookupTable.GetPointer());
+    points->SelectColorArray("density");
+    points->ScalarVisibilityOn();
+  }
+
+  // create labels array. the tooltips look up the molecules by id.
+  vtkStringArray *idArray = vtkStringArray::New();
+  idArray->SetName("id");
+  scatter->SetIndexedLabels(idArray);
   scatter->SetTooltipLabelFormat("%i");
-  nameArray->Delete();
+  idArray->Delete();
 
   m_chart->SetRenderEmpty(true);
   m_chart->SetAutoAxes(false);
@@ -84,8 +123,23 @@ ScatterPlotDialog::ScatterPlotDialog(QWidget *parent_)
 
   // set tooltip item
   vtkNew<MongoChem::DiagramTooltipItem> tooltip;
+  tooltip->SetPrefetchData(vtkFloatArray::SafeDownCast(
+                             m_table->GetColumnByName("X")),
+                           vtkFloatArray::SafeDownCast(
+                             m_table->GetColumnByName("Y")),
+                           scatter->GetIndexedLabels());
   m_chart->SetTooltip(tooltip.GetPointer());
 
+  // the points are updated shortly after the user stops panning or zooming
+  m_updateTimer = new QTimer(this);
+  m_updateTimer->setSingleShot(true);
+  m_updateTimer->setInterval(50);
+  connect(m_updateTimer, SIGNAL(timeout()), SLOT(updateLevelOfDetail()));
+  m_chartEventConnector->Connect(m_chart.GetPointer(),
+                                 vtkCommand::InteractionEvent,
+                                 m_updateTimer,
+                                 SLOT(start()));
+
   QVBoxLayout *graphLayout = new QVBoxLayout;
   graphLayout->addWidget(m_vtkWidget);
   ui->graphFrame->setLayout(graphLayout);
@@ -101,20 +155,9 @@ void ScatterPlotDialog::setSelectionLink(vtkAnnotationLink *link)
   // call super-class
   AbstractVtkChartWidget::setSelectionLink(link);
 
-  // disconnect from previous annoation link
-  m_annotationEventConnector->Disconnect();
-
-  // setup annotation link
-  m_chart->SetAnnotationLink(link);
-
-  // listen to annotation changed events
-  m_annotationEventConnector->Connect(link,
-                                      vtkCommand::AnnotationChangedEvent,
-                                      m_vtkWidget,
-                                      SLOT(update()));
-
-  // update render view
-  m_vtkWidget->update();
+  // the chart's selection is not linked. the table only holds the visible
+  // points (or bins of them) so its row numbers are not those of the
+  // molecules the other views select.
 }
 
 void ScatterPlotDialog::showClicked()
@@ -127,67 +170,124 @@ void ScatterPlotDialog::showClicked()
 
   MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
 
-  vtkFloatArray *xArray =
-    vtkFloatArray::SafeDownCast(m_table->GetColumnByName("X"));
-  vtkFloatArray *yArray =
-    vtkFloatArray::SafeDownCast(m_table->GetColumnByName("Y"));
-  vtkStringArray *nameArray = m_chart->GetPlot(0)->GetIndexedLabels();
-
   // clear current data
-  xArray->SetNumberOfValues(0);
-  yArray->SetNumberOfValues(0);
-  nameArray->SetNumberOfValues(0);
-
-  // query for x data (100 values at a time)
-  int skip = 0;
-  int stride = 100;
-
-  for (;;) {
-    // update ui
-    qApp->processEvents();
-
-    // stop loading data if the user clicked cancel
-    if (progressDialog.wasCanceled())
-      break;
-
-    std::auto_ptr<DBClientCursor> cursor_ =
-      db->queryMolecules(mongo::Query(), stride, skip);
-    if (!cursor_->more())
-      break;
-
-    while (cursor_->more()) {
-      BSONObj obj = cursor_->next();
-      progressDialog.setValue(0);
-
-      // get values
-      double xValue =
-        obj.getFieldDotted(
-          "descriptors." + xName.toStdString()).numberDouble();
-      double yValue =
-        obj.getFieldDotted(
-          "descriptors." + yName.toStdString()).numberDouble();
-
-      // insert into table
-      xArray->InsertNextValue(static_cast<float>(xValue));
-      yArray->InsertNextValue(static_cast<float>(yValue));
-
-      // add name to tooltip array
-      std::string name = obj.getField("name").str();
-      nameArray->InsertNextValue(name);
+  m_points.clear();
+  double bounds[4] = { 0, 0, 0, 0 };
+  showPoints(bounds);
+
+  std::string xField = "descriptors." + xName.toStdString();
+  std::string yField = "descriptors." + yName.toStdString();
+
+  // only fetch the plotted descriptors (and the id)
+  BSONObjBuilder fieldsBuilder;
+  fieldsBuilder.append(xField, 1);
+  if (yField != xField)
+    fieldsBuilder.append(yField, 1);
+  BSONObj fields = fieldsBuilder.obj();
+
+  // read every molecule with a single cursor. the points are drawn as they
+  // arrive rather than after all of them have been loaded.
+  std::auto_ptr<DBClientCursor> cursor_ =
+    db->queryMolecules(mongo::Query(), 0, 0, fields, queryBatchSize);
+
+  QTime redrawTime;
+  redrawTime.start();
+
+  while (cursor_.get()) {
+    // update ui after each batch from the server. this has to happen before
+    // more(), which fetches the next batch as soon as the current one is used.
+    if (cursor_->objsLeftInBatch() == 0) {
+      progressDialog.setValue(static_cast<int>(m_points.size()));
+      qApp->processEvents();
+
+      // stop loading data if the user clicked cancel
+      if (progressDialog.wasCanceled())
+        break;
+
+      if (redrawTime.elapsed() > redrawInterval) {
+        m_points.build();
+        m_points.bounds(bounds);
+        showPoints(bounds);
+        m_chart->RecalculateBounds();
+        m_vtkWidget->update();
+        redrawTime.restart();
+      }
+
+      if (!cursor_->more())
+        break;
     }
 
-    // move to next block of data
-    skip += stride;
+    BSONObj obj = cursor_->next();
+
+    // get values
+    double xValue = obj.getFieldDotted(xField).numberDouble();
+    double yValue = obj.getFieldDotted(yField).numberDouble();
 
-    // update progress dialog
-    progressDialog.setValue(xArray->GetNumberOfTuples());
+    m_points.addPoint(static_cast<float>(xValue),
+                      static_cast<float>(yValue),
+                      obj["_id"].OID());
   }
 
   // close progress dialog
   progressDialog.close();
 
   // refesh view
-  m_table->Modified();
+  m_points.build();
+  m_points.bounds(bounds);
+  showPoints(bounds);
   m_chart->RecalculateBounds();
   m_vtkWidget->update();
 }
+
+void ScatterPlotDialog::updateLevelOfDetail()
+{
+  vtkAxis *xAxis = m_chart->GetAxis(vtkAxis::BOTTOM);
+  vtkAxis *yAxis = m_chart->GetAxis(vtkAxis::LEFT);
+
+  double bounds[4] = { xAxis->GetMinimum(), xAxis->GetMaximum(),
+                       yAxis->GetMinimum(), yAxis->GetMaximum() };
+  showPoints(bounds);
+  m_vtkWidget->update();
+}
+
+void ScatterPlotDialog::showPoints(const double bounds[4])
+{
+  PointDensityGrid::View view =
+    m_points.query(bounds, maximumVisiblePoints, densityBinCount);
+
+  vtkFloatArray *xArray =
+    vtkFloatArray::SafeDownCast(m_table->GetColumnByName("X"));
+  vtkFloatArray *yArray =
+    vtkFloatArray::SafeDownCast(m_table->GetColumnByName("Y"));
+  vtkFloatArray *densityArray =
+    vtkFloatArray::SafeDownCast(m_table->GetColumnByName("density"));
+  vtkStringArray *idArray = m_chart->GetPlot(0)->GetIndexedLabels();
+
+  vtkIdType count = static_cast<vtkIdType>(view.x.size());
+  xArray->SetNumberOfValues(count);
+  yArray->SetNumberOfValues(count);
+  densityArray->SetNumberOfValues(count);
+  idArray->SetNumberOfValues(count);
+
+  float maximumDensity = 1;
+  for (vtkIdType i = 0; i < count; i++) {
+    float density = std::log10(view.counts[i]);
+    maximumDensity = std::max(maximumDensity, density);
+
+    xArray->SetValue(i, view.x[i]);
+    yArray->SetValue(i, view.y[i]);
+    densityArray->SetValue(i, density);
+
+    // the ids are only created for the visible points
+    if (view.aggregated)
+      idArray->SetValue(i, QString("%1 molecules")
+                             .arg(static_cast<int>(view.counts[i]))
+                             .toStdString());
+    else
+      idArray->SetValue(i, view.ids[i].str());
+  }
+
+  m_densityLookupTable->SetTableRange(0, maximumDensity);
+  idArray->Modified();
+  m_table->Modified();
+}
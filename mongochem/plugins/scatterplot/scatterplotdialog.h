@@ -19,14 +19,18 @@
 
 #include <mongochem/gui/abstractvtkchartwidget.h>
 
+#include "pointdensitygrid.h"
+
 #include <vtkNew.h>
 
+class QTimer;
 class QVTKWidget;
 class vtkChartXY;
 class vtkContextView;
 class vtkTable;
 class vtkAnnotationLink;
 class vtkEventQtSlotConnect;
+class vtkLookupTable;
 
 namespace Ui {
 class ScatterPlotDialog;
@@ -45,13 +49,25 @@ public:
 private slots:
   void showClicked();
 
+  /** Shows the points (or their density) within the current axis ranges. */
+  void updateLevelOfDetail();
+
 private:
+  /**
+   * Fills the table with the points within @p bounds (xMin, xMax, yMin,
+   * yMax). If there are too many they are aggregated and colored by density.
+   */
+  void showPoints(const double bounds[4]);
+
   Ui::ScatterPlotDialog *ui;
   QVTKWidget *m_vtkWidget;
   vtkNew<vtkTable> m_table;
   vtkNew<vtkContextView> m_chartView;
   vtkNew<vtkChartXY> m_chart;
-  vtkNew<vtkEventQtSlotConnect> m_annotationEventConnector;
+  vtkNew<vtkEventQtSlotConnect> m_chartEventConnector;
+  vtkNew<vtkLookupTable> m_densityLookupTable;
+  QTimer *m_updateTimer;
+  PointDensityGrid m_points;
 };
 
 #endif // SCATTERPLOTDIALOG_H
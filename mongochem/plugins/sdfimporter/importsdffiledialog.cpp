@@ -17,7 +17,10 @@
 #include "importsdffiledialog.h"
 #include "ui_importsdffiledialog.h"
 
+#include <QtConcurrent/QtConcurrentRun>
 #include <QtCore/QDebug>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QThread>
 #include <QtWidgets/QFileDialog>
 #include <QtWidgets/QMessageBox>
 #include <QtWidgets/QProgressDialog>
@@ -25,9 +28,205 @@
 #include <chemkit/molecule.h>
 #include <chemkit/moleculefile.h>
 
+#include <mongochem/gui/chemkit.h>
+#include <mongochem/gui/descriptortable.h>
+#include <mongochem/gui/fingerprintstore.h>
 #include <mongochem/gui/mongodatabase.h>
+#include <mongochem/gui/sdfreader.h>
 #include <mongochem/gui/svggenerator.h>
 
+#include <map>
+#include <sstream>
+
+namespace {
+
+// The number of records imported together. The records in each batch are
+// parsed on a worker thread and written with a single acknowledgement.
+const size_t importBatchSize = 250;
+
+struct ImportResult
+{
+  ImportResult() : importedCount(0) { }
+
+  int importedCount;
+
+  // the InChIs of the imported molecules which do not have a diagram yet
+  std::vector<std::string> inchisWithoutDiagrams;
+};
+
+// Returns the molecule document and descriptors for the SDF @p record. The
+// document is empty if the record could not be read.
+mongo::BSONObj createMoleculeObject(const std::string &record,
+                                    mongo::BSONObj &descriptors)
+{
+  std::istringstream input(record);
+  chemkit::MoleculeFile file;
+  if (!file.read(input, "sdf") || file.moleculeCount() == 0)
+    return mongo::BSONObj();
+
+  boost::shared_ptr<chemkit::Molecule> molecule = file.molecule();
+  if (!molecule || molecule->isEmpty())
+    return mongo::BSONObj();
+
+  std::string name =
+    molecule->data("PUBCHEM_IUPAC_TRADITIONAL_NAME").toString();
+  if (name.empty())
+    name = molecule->name();
+
+  std::string formula = molecule->formula();
+  std::string inchi = molecule->data("PUBCHEM_IUPAC_INCHI").toString();
+  std::string inchikey = molecule->data("PUBCHEM_IUPAC_INCHIKEY").toString();
+
+  // records from other sources do not contain the identifiers
+  if (inchi.empty() || inchikey.empty()) {
+    QMutexLocker locker(MongoChem::ChemKit::inchiMutex());
+    inchi = molecule->formula("inchi");
+    inchikey = molecule->formula("inchikey");
+  }
+  if (inchikey.empty())
+    return mongo::BSONObj();
+
+  double mass = molecule->data("PUBCHEM_MOLECULAR_WEIGHT").toDouble();
+  if (mass == 0.0)
+    mass = molecule->mass();
+
+  int atomCount = static_cast<int>(molecule->atomCount());
+  int heavyAtomCount =
+    static_cast<int>(molecule->atomCount() - molecule->atomCount("H"));
+
+  // read descriptors
+  double tpsa = molecule->data("PUBCHEM_CACTVS_TPSA").toDouble();
+  double xlogp3 = molecule->data("PUBCHEM_XLOGP3_AA").toDouble();
+  double vabc = molecule->descriptor("vabc").toDouble();
+
+  descriptors = BSON("descriptors.mass" << mass
+                     << "descriptors.tpsa" << tpsa
+                     << "descriptors.xlogp3" << xlogp3
+                     << "descriptors.vabc" << vabc);
+
+  mongo::BSONObjBuilder b;
+  b << "_id" << mongo::OID::gen();
+  b << "name" << name;
+  b << "formula" << formula;
+  b << "inchi" << inchi;
+  b << "inchikey" << inchikey;
+  b << "mass" << mass;
+  b << "atomCount" << atomCount;
+  b << "heavyAtomCount" << heavyAtomCount;
+  b << "fingerprints"
+    << MongoChem::FingerprintStore::createFingerprints(molecule.get());
+  return b.obj();
+}
+
+// Parses the SDF @p records and upserts them keyed on their InChIKey. This
+// runs on a worker thread while the next batches are read from the file.
+ImportResult importBatch(const std::vector<std::string> &records)
+{
+  ImportResult result;
+
+  // molecules which appear more than once in the batch are written once
+  // with the descriptors from the last record
+  std::map<std::string, std::pair<mongo::BSONObj, mongo::BSONObj> > molecules;
+  for (size_t i = 0; i < records.size(); i++) {
+    mongo::BSONObj descriptors;
+    mongo::BSONObj obj = createMoleculeObject(records[i], descriptors);
+    if (obj.isEmpty())
+      continue;
+
+    molecules[obj.getStringField("inchikey")] =
+      std::make_pair(obj, descriptors);
+  }
+
+  if (molecules.empty())
+    return result;
+
+  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
+  MongoChem::ScopedMongoConnection conn(db->connectionPool());
+  if (!conn)
+    return result;
+
+  std::string collection = db->moleculesCollectionName();
+
+  try {
+    // the molecule is only created if no molecule has the same InChIKey,
+    // while the descriptors are always set
+    mongo::BSONArrayBuilder inchikeys;
+    std::map<std::string, std::pair<mongo::BSONObj, mongo::BSONObj> >
+      ::const_iterator iter;
+    for (iter = molecules.begin(); iter != molecules.end(); ++iter) {
+      conn->update(collection,
+                   QUERY("inchikey" << iter->first),
+                   BSON("$set" << iter->second.second
+                        << "$setOnInsert" << iter->second.first),
+                   true,
+                   false);
+      inchikeys.append(iter->first);
+    }
+
+    // the upserts are not acknowledged individually. waiting for the last
+    // error once per batch keeps the reader from getting ahead of the
+    // server.
+    std::string error = conn->getLastError();
+    if (!error.empty())
+      qDebug() << "error importing molecules: " << error.c_str();
+
+    // find the molecules which still need a diagram
+    mongo::BSONObj fields = BSON("inchi" << 1);
+    std::auto_ptr<mongo::DBClientCursor> cursor =
+      conn->query(collection,
+                  QUERY("inchikey" << BSON("$in" << inchikeys.arr())
+                        << "svg" << BSON("$exists" << false)),
+                  0,
+                  0,
+                  &fields);
+    while (cursor.get() && cursor->more()) {
+      std::string inchi = cursor->next().getStringField("inchi");
+      if (!inchi.empty())
+        result.inchisWithoutDiagrams.push_back(inchi);
+    }
+  }
+  catch (mongo::DBException &e) {
+    qDebug() << "error importing molecules: " << e.what();
+    conn.setFailed();
+    return result;
+  }
+
+  result.importedCount = static_cast<int>(molecules.size());
+  return result;
+}
+
+// Stores @p svg and a PNG rendered from it as the diagram for the molecules
+// with @p inchi. This runs on a worker thread.
+void storeDiagram(const QByteArray &inchi, const QByteArray &svg)
+{
+  QByteArray png = MongoChem::SvgGenerator::renderPng(svg);
+
+  mongo::BSONObjBuilder b;
+  b.append("svg", svg.constData());
+  if (!png.isEmpty())
+    b.appendBinData(
+      "diagram", png.length(), mongo::BinDataGeneral, png.constData());
+
+  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
+  MongoChem::ScopedMongoConnection conn(db->connectionPool());
+  if (!conn)
+    return;
+
+  try {
+    conn->update(db->moleculesCollectionName(),
+                 QUERY("inchi" << inchi.constData()),
+                 BSON("$set" << b.obj()),
+                 false,
+                 true);
+  }
+  catch (mongo::DBException &e) {
+    qDebug() << "error storing diagram: " << e.what();
+    conn.setFailed();
+  }
+}
+
+} // end anonymous namespace
+
 ImportSdfFileDialog::ImportSdfFileDialog(QWidget *parent_)
   : AbstractImportDialog(parent_),
     ui(new Ui::ImportSdfFileDialog)
@@ -81,87 +280,63 @@ void ImportSdfFileDialog::openFile()
 
 void ImportSdfFileDialog::import()
 {
-  m_progressDialog->setLabelText("Importing Molecules");
-  m_progressDialog->show();
-
-  chemkit::MoleculeFile file(m_fileName.toStdString());
-
-  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
-  mongo::DBClientConnection *conn = db->connection();
-
-  bool ok = file.read();
-  if (!ok) {
+  MongoChem::SdfReader reader;
+  if (!reader.open(m_fileName)) {
     QMessageBox::warning(this,
                          "Error",
                          QString("Error reading file: %1")
-                           .arg(file.errorString().c_str()));
+                           .arg(reader.errorString()));
     return;
   }
 
-  std::string collection = db->moleculesCollectionName();
+  m_progressDialog->setLabelText("Importing Molecules");
+  m_progressDialog->setMaximum(100);
+  m_progressDialog->setValue(0);
+  m_progressDialog->show();
 
-  m_progressDialog->setMaximum(file.moleculeCount());
+  // records are read in batches which are imported on worker threads. the
+  // number of batches in flight is limited so that memory use does not
+  // depend on the size of the file.
+  int maximumPendingBatches = 2 * qMax(1, QThread::idealThreadCount());
+  QList<QFuture<ImportResult> > pendingBatches;
+  bool endOfFile = false;
 
-  foreach (const boost::shared_ptr<chemkit::Molecule> &molecule,
-           file.molecules()) {
-    // stop importing if the user clicked cancel
+  while (!endOfFile || !pendingBatches.isEmpty()) {
+    // stop reading if the user clicked cancel
     if (m_progressDialog->wasCanceled())
-      break;
-
-    std::string name =
-      molecule->data("PUBCHEM_IUPAC_TRADITIONAL_NAME").toString();
-    if (name.empty())
-      name = molecule->name();
-
-    std::string formula = molecule->formula();
-    std::string inchi = molecule->data("PUBCHEM_IUPAC_INCHI").toString();
-    std::string inchikey = molecule->data("PUBCHEM_IUPAC_INCHIKEY").toString();
-
-    double mass = molecule->data("PUBCHEM_MOLECULAR_WEIGHT").toDouble();
-    if (mass == 0.0)
-      mass = molecule->mass();
-
-    int atomCount = static_cast<int>(molecule->atomCount());
-    int heavyAtomCount =
-      static_cast<int>(molecule->atomCount() - molecule->atomCount("H"));
-
-    MongoChem::MoleculeRef ref = db->findMoleculeFromInChI(inchi);
-    if (!ref){
-        mongo::OID id = mongo::OID::gen();
-
-        mongo::BSONObjBuilder b;
-        b << "_id" << id;
-        b << "name" << name;
-        b << "formula" << formula;
-        b << "inchi" << inchi;
-        b << "inchikey" << inchikey;
-        b << "mass" << mass;
-        b << "atomCount" << atomCount;
-        b << "heavyAtomCount" << heavyAtomCount;
-
-        // add molecule
-        conn->insert(collection, b.obj());
-
-        ref = MongoChem::MoleculeRef(id.str());
+      endOfFile = true;
+
+    if (!endOfFile && pendingBatches.size() < maximumPendingBatches) {
+      std::vector<std::string> records;
+      std::string record;
+      while (records.size() < importBatchSize) {
+        if (!reader.readRecord(record)) {
+          endOfFile = true;
+          break;
+        }
+        records.push_back(record);
+      }
+
+      if (!records.empty())
+        pendingBatches.append(QtConcurrent::run(importBatch, records));
+
+      if (reader.size() > 0) {
+        m_progressDialog->setValue(
+          static_cast<int>(100 * reader.position() / reader.size()));
+      }
+
+      continue;
     }
 
-    // read descriptors
-    double tpsa = molecule->data("PUBCHEM_CACTVS_TPSA").toDouble();
-    double xlogp3 = molecule->data("PUBCHEM_XLOGP3_AA").toDouble();
-    double vabc = molecule->descriptor("vabc").toDouble();
-
-    // set descriptors
-    db->setMoleculeProperty(ref, "descriptors.mass", mass);
-    db->setMoleculeProperty(ref, "descriptors.tpsa", tpsa);
-    db->setMoleculeProperty(ref, "descriptors.xlogp3", xlogp3);
-    db->setMoleculeProperty(ref, "descriptors.vabc", vabc);
+    // wait for the oldest batch to finish
+    ImportResult result = pendingBatches.takeFirst().result();
 
     // generate diagrams
-    if (!inchi.empty()) {
+    for (size_t i = 0; i < result.inchisWithoutDiagrams.size(); i++) {
       // create and setup svg generator
       MongoChem::SvgGenerator *svgGenerator =
         new MongoChem::SvgGenerator(this);
-      svgGenerator->setInputData(inchi.c_str());
+      svgGenerator->setInputData(result.inchisWithoutDiagrams[i].c_str());
       svgGenerator->setInputFormat("inchi");
 
       // listen to finished signal
@@ -174,12 +349,26 @@ void ImportSdfFileDialog::import()
       // start the generation process in the background
       svgGenerator->start();
     }
+  }
+
+  // the charts reload their descriptors the next time they are shown
+  MongoChem::DescriptorTable::instance()->invalidate();
+
+  if (!reader.errorString().isEmpty()) {
+    QMessageBox::warning(this,
+                         "Error",
+                         QString("Error reading file: %1")
+                           .arg(reader.errorString()));
+  }
 
-    m_progressDialog->setValue(m_progressDialog->value() + 1);
+  if (m_svgGenerators.isEmpty()) {
+    m_progressDialog->hide();
+    accept();
+    return;
   }
-  m_progressDialog->setValue(file.moleculeCount());
 
   m_progressDialog->setLabelText("Generating Diagrams");
+  m_progressDialog->setMaximum(m_svgGenerators.size());
   m_progressDialog->setValue(0);
 }
 
@@ -200,37 +389,10 @@ void ImportSdfFileDialog::moleculeDiagramReady(int errorCode)
 
   if (errorCode != 0 || svg.isEmpty()) {
     qDebug() << "error generating svg";
-    return;
   }
-
-  // get molecule data
-  QByteArray identifier = svgGenerator->inputData();
-
-  // get molecule ref
-  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
-  MongoChem::MoleculeRef molecule =
-    db->findMoleculeFromIdentifier(identifier.constData(), "inchi");
-
-  // set molecule diagram
-  if (molecule) {
-    db->connection()->update(db->moleculesCollectionName(),
-                             QUERY("_id" << molecule.id()),
-                             BSON("$set" << BSON("svg" << svg.constData())),
-                             true,
-                             true);
-
-    QByteArray png = svgGenerator->png();
-    if (!png.isEmpty()) {
-      mongo::BSONObjBuilder b;
-      b.appendBinData(
-        "diagram", png.length(), mongo::BinDataGeneral, png.constData());
-
-      db->connection()->update(db->moleculesCollectionName(),
-                               QUERY("_id" << molecule.id()),
-                               BSON("$set" << b.obj()),
-                               true,
-                               true);
-    }
+  else {
+    // the PNG is rendered and stored in the background
+    QtConcurrent::run(storeDiagram, svgGenerator->inputData(), svg);
   }
 
   // remove and delete generator
@@ -16,14 +16,65 @@
 
 #include "mongodatabase.h"
 #include "chemkit.h"
+#include "fingerprintstore.h"
 
 #include "fingerprintsimilaritydialog.h"
 #include "ui_fingerprintsimilaritydialog.h"
 
+#include "packedfingerprints.h"
+
+#include <QtConcurrentMap>
+
+#include <algorithm>
+
 #include <chemkit/fingerprint.h>
+#include <chemkit/molecule.h>
 
 using namespace chemkit;
 
+namespace {
+
+// The lowest similarity (in percent) which can be shown. Only the pairs of
+// molecules above it are kept.
+const int minimumSimilarity = 20;
+
+// The number of molecules in each fingerprint calculation task.
+const size_t fingerprintBatchSize = 64;
+
+// Calculates the fingerprints which are not stored in the database for a
+// batch of molecules.
+struct FingerprintTask
+{
+  std::string name;
+  const std::vector<mongo::BSONObj> *objs;
+  std::vector<size_t> positions;
+  std::vector<Bitset> *fingerprints;
+};
+
+struct RunFingerprintTask
+{
+  void operator()(FingerprintTask &task) const
+  {
+    // fingerprint objects are not shared between threads
+    boost::scoped_ptr<Fingerprint> fingerprint_(Fingerprint::create(task.name));
+    if (!fingerprint_)
+      return;
+
+    for (size_t i = 0; i < task.positions.size(); ++i) {
+      size_t position = task.positions[i];
+      const mongo::BSONObj &obj = (*task.objs)[position];
+
+      boost::shared_ptr<Molecule> molecule =
+        MongoChem::ChemKit::createMolecule(obj);
+
+      if (molecule)
+        (*task.fingerprints)[position] = fingerprint_->value(molecule.get());
+    }
+  }
+};
+
+} // end anonymous namespace
+
 FingerprintSimilarityDialog::FingerprintSimilarityDialog(QWidget *parent_)
   : MongoChem::AbstractClusteringWidget(parent_),
     ui(new Ui::FingerprintSimilarityDialog)
@@ -31,6 +82,8 @@ FingerprintSimilarityDialog::FingerprintSimilarityDialog(QWidget *parent_)
   ui->setupUi(this);
 
   m_graphWidget = new SimilarityGraphWidget(this);
+  ui->similaritySlider->setMinimum(minimumSimilarity);
+  ui->similaritySpinBox->setMinimum(minimumSimilarity);
   ui->similaritySlider->setValue(45);
   m_graphWidget->setSimilarityThreshold(
     static_cast<float>(ui->similaritySlider->value()) / 100.f);
@@ -66,38 +119,49 @@ void FingerprintSimilarityDialog::setMolecules(const std::vector<MongoChem::Mole
 
 void FingerprintSimilarityDialog::setFingerprint(const QString &name)
 {
-  // calculate fingerprints
-  boost::scoped_ptr<Fingerprint> fingerprint_(Fingerprint::create(name.toStdString()));
-
-  std::vector<Bitset> fingerprints;
-  for (size_t i = 0; i < m_molecules.size(); ++i) {
-    const MongoChem::MoleculeRef &ref = m_molecules[i];
-    boost::shared_ptr<const chemkit::Molecule> molecule =
-        MongoChem::ChemKit::createMolecule(ref);
-
-    if (molecule)
-      fingerprints.push_back(fingerprint_->value(molecule.get()));
-    else
-      fingerprints.push_back(chemkit::Bitset());
+  // use the fingerprints stored in the database where possible
+  std::string storedName = name.toLower().toStdString();
+  mongo::BSONObjBuilder fieldsBuilder;
+  fieldsBuilder.appendElements(MongoChem::FingerprintStore::fields(storedName));
+  fieldsBuilder.append("smiles", 1);
+  fieldsBuilder.append("inchi", 1);
+
+  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
+  std::vector<mongo::BSONObj> objs =
+    db->fetchMolecules(m_molecules, fieldsBuilder.obj());
+
+  std::vector<Bitset> fingerprints(objs.size());
+  std::vector<FingerprintTask> tasks;
+  for (size_t i = 0; i < objs.size(); ++i) {
+    if (MongoChem::FingerprintStore::readFingerprint(objs[i], storedName,
+                                                     fingerprints[i]))
+      continue;
+
+    if (tasks.empty() || tasks.back().positions.size() >= fingerprintBatchSize) {
+      FingerprintTask task;
+      task.name = name.toStdString();
+      task.objs = &objs;
+      task.fingerprints = &fingerprints;
+      tasks.push_back(task);
+    }
+    tasks.back().positions.push_back(i);
   }
 
-  // calculate similarity matrix
-  Eigen::MatrixXf similarityMatrix;
-  similarityMatrix.resize(m_molecules.size(), m_molecules.size());
+  // calculate the remaining fingerprints from the molecules
+  QtConcurrent::blockingMap(tasks, RunFingerprintTask());
 
-  for (size_t i = 0; i < fingerprints.size(); ++i) {
-    for (size_t j = i + 1; j < fingerprints.size(); ++j) {
-      float similarity =
-        static_cast<float>(Fingerprint::tanimotoCoefficient(fingerprints[i],
-                                                            fingerprints[j]));
+  // pack the fingerprints and calculate the pairs of similar molecules
+  size_t bitCount = 0;
+  for (size_t i = 0; i < fingerprints.size(); ++i)
+    bitCount = std::max(bitCount, fingerprints[i].size());
 
-      similarityMatrix(i, j) = similarity;
-      similarityMatrix(j, i) = similarity;
-    }
-  }
+  PackedFingerprints packed(fingerprints.size(), bitCount);
+  for (size_t i = 0; i < fingerprints.size(); ++i)
+    packed.setFingerprint(i, fingerprints[i]);
 
-  // set similarity matrix
-  m_graphWidget->setSimilarityMatrix(similarityMatrix);
+  // set similar molecules
+  m_graphWidget->setSimilarityNeighbors(
+    packed.neighbors(minimumSimilarity / 100.f));
 }
 
 QString FingerprintSimilarityDialog::fingerprint() const
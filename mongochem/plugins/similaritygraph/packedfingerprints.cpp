@@ -0,0 +1,235 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "packedfingerprints.h"
+
+#include <mongochem/gui/fingerprintindex.h>
+
+#include <QtConcurrentMap>
+
+#include <algorithm>
+#include <cstring>
+
+using MongoChem::FingerprintIndex;
+
+namespace {
+
+// The number of fingerprints in each tile. Two tiles of 1024-bit
+// fingerprints take 32 KB so the columns stay in the cache while they are
+// compared to each row.
+const size_t tileSize = 128;
+
+// A pair of similar fingerprints found by a tile.
+struct Pair
+{
+  unsigned int first;
+  unsigned int second;
+  float similarity;
+};
+
+// The fingerprints sorted by the number of bits set.
+struct SortedFingerprints
+{
+  size_t count;
+  size_t wordCount;
+  std::vector<quint64> words;
+  std::vector<int> bitsSet;
+  std::vector<unsigned int> indices;
+};
+
+// Compares the fingerprints in the rows of one tile to those in the columns
+// of another tile (which may be the same tile).
+struct TileTask
+{
+  const SortedFingerprints *fingerprints;
+  float cutoff;
+  size_t rowBegin;
+  size_t rowEnd;
+  size_t columnBegin;
+  size_t columnEnd;
+  std::vector<Pair> pairs;
+};
+
+struct RunTileTask
+{
+  void operator()(TileTask &task) const
+  {
+    const SortedFingerprints &fingerprints = *task.fingerprints;
+    const size_t wordCount = fingerprints.wordCount;
+
+    for (size_t i = task.rowBegin; i < task.rowEnd; i++) {
+      const quint64 *row = &fingerprints.words[i * wordCount];
+      int rowBitsSet = fingerprints.bitsSet[i];
+
+      // only compare each pair in a tile on the diagonal once
+      size_t begin = std::max(task.columnBegin, i + 1);
+      for (size_t j = begin; j < task.columnEnd; j++) {
+        // the columns are sorted so no later column can exceed the bound
+        int columnBitsSet = fingerprints.bitsSet[j];
+        if (rowBitsSet <= task.cutoff * columnBitsSet)
+          break;
+
+        const quint64 *column = &fingerprints.words[j * wordCount];
+        int common = 0;
+        for (size_t k = 0; k < wordCount; k++)
+          common += FingerprintIndex::popcount(row[k] & column[k]);
+
+        int total = rowBitsSet + columnBitsSet - common;
+        float similarity = static_cast<float>(common) / total;
+        if (similarity > task.cutoff) {
+          Pair pair;
+          pair.first = fingerprints.indices[i];
+          pair.second = fingerprints.indices[j];
+          pair.similarity = similarity;
+          task.pairs.push_back(pair);
+        }
+      }
+    }
+  }
+};
+
+// Orders the fingerprint indices by the number of bits set.
+struct FewerBitsSet
+{
+  const std::vector<int> *bitsSet;
+
+  bool operator()(unsigned int a, unsigned int b) const
+  {
+    return (*bitsSet)[a] < (*bitsSet)[b];
+  }
+};
+
+} // end anonymous namespace
+
+PackedFingerprints::PackedFingerprints(size_t count, size_t bitCount)
+  : m_count(count),
+    m_bitCount(bitCount),
+    m_wordCount((bitCount + 63) / 64),
+    m_words(count * ((bitCount + 63) / 64), 0)
+{
+}
+
+size_t PackedFingerprints::size() const
+{
+  return m_count;
+}
+
+size_t PackedFingerprints::wordCount() const
+{
+  return m_wordCount;
+}
+
+void PackedFingerprints::setFingerprint(size_t index,
+                                        const chemkit::Bitset &fingerprint)
+{
+  quint64 *words_ = &m_words[index * m_wordCount];
+  std::fill(words_, words_ + m_wordCount, 0);
+  if (fingerprint.empty() || m_wordCount == 0)
+    return;
+
+  std::vector<chemkit::Bitset::block_type> blocks(fingerprint.num_blocks());
+  boost::to_block_range(fingerprint, blocks.begin());
+  memcpy(words_, &blocks[0],
+         std::min(blocks.size() * sizeof(chemkit::Bitset::block_type),
+                  m_wordCount * sizeof(quint64)));
+
+  // clear any bits past the end of the fingerprint
+  size_t paddingBits = m_wordCount * 64 - m_bitCount;
+  if (paddingBits > 0)
+    words_[m_wordCount - 1] &= ~Q_UINT64_C(0) >> paddingBits;
+}
+
+const quint64* PackedFingerprints::words(size_t index) const
+{
+  return &m_words[index * m_wordCount];
+}
+
+SimilarityNeighbors PackedFingerprints::neighbors(float cutoff) const
+{
+  SimilarityNeighbors neighbors_(m_count, cutoff);
+  if (m_count < 2 || m_wordCount == 0)
+    return neighbors_;
+
+  // sort the fingerprints by the number of bits set so that the pairs which
+  // cannot exceed the cutoff are at the end of each row
+  std::vector<int> bitsSet(m_count, 0);
+  for (size_t i = 0; i < m_count; i++) {
+    const quint64 *words_ = words(i);
+    for (size_t k = 0; k < m_wordCount; k++)
+      bitsSet[i] += FingerprintIndex::popcount(words_[k]);
+  }
+
+  SortedFingerprints sorted;
+  sorted.count = m_count;
+  sorted.wordCount = m_wordCount;
+  sorted.indices.resize(m_count);
+  for (size_t i = 0; i < m_count; i++)
+    sorted.indices[i] = static_cast<unsigned int>(i);
+  FewerBitsSet fewerBitsSet;
+  fewerBitsSet.bitsSet = &bitsSet;
+  std::stable_sort(sorted.indices.begin(), sorted.indices.end(), fewerBitsSet);
+
+  sorted.words.resize(m_words.size());
+  sorted.bitsSet.resize(m_count);
+  for (size_t i = 0; i < m_count; i++) {
+    unsigned int index = sorted.indices[i];
+    std::copy(words(index), words(index) + m_wordCount,
+              sorted.words.begin() + i * m_wordCount);
+    sorted.bitsSet[i] = bitsSet[index];
+  }
+
+  // create a task for each pair of tiles which may contain similar pairs.
+  // the fewest bits set in a column tile only increase, so once a tile can
+  // be skipped so can every tile after it.
+  std::vector<TileTask> tasks;
+  for (size_t row = 0; row < m_count; row += tileSize) {
+    size_t rowEnd = std::min(row + tileSize, m_count);
+    int rowMostBitsSet = sorted.bitsSet[rowEnd - 1];
+
+    for (size_t column = row; column < m_count; column += tileSize) {
+      if (rowMostBitsSet <= cutoff * sorted.bitsSet[column])
+        break;
+
+      TileTask task;
+      task.fingerprints = &sorted;
+      task.cutoff = cutoff;
+      task.rowBegin = row;
+      task.rowEnd = rowEnd;
+      task.columnBegin = column;
+      task.columnEnd = std::min(column + tileSize, m_count);
+      tasks.push_back(task);
+    }
+  }
+
+  QtConcurrent::blockingMap(tasks, RunTileTask());
+
+  // gather the pairs into the row of the fingerprint with the lower index
+  std::vector<std::vector<SimilarityNeighbors::Neighbor> > rows(m_count);
+  for (size_t i = 0; i < tasks.size(); i++) {
+    const std::vector<Pair> &pairs = tasks[i].pairs;
+    for (size_t j = 0; j < pairs.size(); j++) {
+      SimilarityNeighbors::Neighbor neighbor;
+      neighbor.index = std::max(pairs[j].first, pairs[j].second);
+      neighbor.similarity = pairs[j].similarity;
+      rows[std::min(pairs[j].first, pairs[j].second)].push_back(neighbor);
+    }
+  }
+
+  for (size_t i = 0; i < m_count; i++)
+    neighbors_.setRow(i, rows[i]);
+
+  return neighbors_;
+}
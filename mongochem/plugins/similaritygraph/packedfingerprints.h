@@ -0,0 +1,71 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef PACKEDFINGERPRINTS_H
+#define PACKEDFINGERPRINTS_H
+
+#include "similarityneighbors.h"
+
+#include <QtGlobal>
+
+#include <chemkit/bitset.h>
+
+#include <vector>
+
+/**
+ * The PackedFingerprints class stores a set of fingerprints as packed 64-bit
+ * words and finds the pairs of similar fingerprints.
+ *
+ * neighbors() compares every pair of fingerprints with the Tanimoto
+ * coefficient. The fingerprints are sorted by the number of bits set and
+ * compared in tiles of rows and columns which fit in the cache, with the
+ * tiles processed on multiple threads. The similarity of two fingerprints
+ * with a and b bits set (a <= b) is at most a / b (Swamidass and Baldi,
+ * 2007), so the pairs and whole tiles whose bound is not above the cutoff
+ * are skipped without being compared.
+ */
+class PackedFingerprints
+{
+public:
+  /** Creates a new set of @p count empty fingerprints of @p bitCount bits. */
+  PackedFingerprints(size_t count, size_t bitCount);
+
+  /** Returns the number of fingerprints. */
+  size_t size() const;
+
+  /** Returns the number of 64-bit words in each fingerprint. */
+  size_t wordCount() const;
+
+  /** Sets the fingerprint at @p index to @p fingerprint. */
+  void setFingerprint(size_t index, const chemkit::Bitset &fingerprint);
+
+  /** Returns the words of the fingerprint at @p index. */
+  const quint64* words(size_t index) const;
+
+  /**
+   * Returns the pairs of fingerprints with a Tanimoto coefficient greater
+   * than @p cutoff.
+   */
+  SimilarityNeighbors neighbors(float cutoff) const;
+
+private:
+  size_t m_count;
+  size_t m_bitCount;
+  size_t m_wordCount;
+  std::vector<quint64> m_words;
+};
+
+#endif // PACKEDFINGERPRINTS_H
@@ -17,6 +17,7 @@
 #include "similaritygraphwidget.h"
 
 #include <QtCore/QMutex>
+#include <QtCore/QFutureWatcher>
 #include <QtConcurrent/QtConcurrentRun>
 #include <QtWidgets/QProgressDialog>
 #include <QtGui/QStandardItemModel>
@@ -40,12 +41,15 @@ class SimilarityGraphWidgetPrivate
 public:
   bool layoutPaused;
   float similarityThreshold;
-  Eigen::MatrixXf similarityMatrix;
+  SimilarityNeighbors neighbors;
   QVTKWidget *vtkWidget;
   vtkNew<vtkMutableUndirectedGraph> graph;
   vtkNew<vtkForceDirectedLayoutStrategy> layoutStrategy;
   QMutex layoutGraphMutex;
   vtkNew<vtkGraphLayoutView> graphView;
+
+  // the layout iterations run on a worker thread one at a time
+  QFutureWatcher<void> *layoutWatcher;
 };
 
 SimilarityGraphWidget::SimilarityGraphWidget(QWidget *parent_)
@@ -53,6 +57,7 @@ SimilarityGraphWidget::SimilarityGraphWidget(QWidget *parent_)
     d(new SimilarityGraphWidgetPrivate)
 {
   d->layoutPaused = false;
+  d->layoutWatcher = new QFutureWatcher<void>(this);
 
   // setup graph and layout strategy
   d->layoutStrategy->SetGraph(d->graph.GetPointer());
@@ -85,30 +90,75 @@ SimilarityGraphWidget::SimilarityGraphWidget(QWidget *parent_)
   theme->SetCellLookupTable(colorTransferFunction.GetPointer());
   d->graphView->ApplyViewTheme(theme.GetPointer());
 
-  connect(this, SIGNAL(readyToRender()), SLOT(renderGraph()),
-          Qt::QueuedConnection);
+  // render the graph (and start the next iterations) after each layout
+  connect(d->layoutWatcher, SIGNAL(finished()), SLOT(renderGraph()));
   connect(d->vtkWidget, SIGNAL(mouseEvent(QMouseEvent*)),
           this, SLOT(graphViewMouseEvent(QMouseEvent*)));
 }
 
 SimilarityGraphWidget::~SimilarityGraphWidget()
 {
+  d->layoutWatcher->waitForFinished();
   delete d;
 }
 
-void SimilarityGraphWidget::setSimilarityMatrix(const Eigen::MatrixXf &matrix)
+void SimilarityGraphWidget::setSimilarityNeighbors(const SimilarityNeighbors &neighbors)
 {
-  d->similarityMatrix = matrix;
+  d->neighbors = neighbors;
 
-  d->graph->SetNumberOfVertices(matrix.rows());
+  d->graph->SetNumberOfVertices(neighbors.size());
 
   // update graph
   setSimilarityThreshold(d->similarityThreshold);
 }
 
-const Eigen::MatrixXf& SimilarityGraphWidget::similarityMatrix() const
+void SimilarityGraphWidget::setSimilarityRows(const std::vector<size_t> &rows,
+                                              const std::vector<std::vector<SimilarityNeighbors::Neighbor> > &neighbors)
 {
-  return d->similarityMatrix;
+  // replacing rows which already have edges requires rebuilding the graph
+  bool rebuild = false;
+  for (size_t i = 0; i < rows.size(); i++) {
+    if (!d->neighbors.neighbors(rows[i]).empty())
+      rebuild = true;
+
+    d->neighbors.setRow(rows[i], neighbors[i]);
+  }
+
+  vtkFloatArray *weights =
+    vtkFloatArray::SafeDownCast(d->graph->GetEdgeData()->GetArray("weights"));
+  if (rebuild || !weights) {
+    setSimilarityThreshold(d->similarityThreshold);
+    return;
+  }
+
+  d->layoutGraphMutex.lock();
+
+  // add the edges of the new rows which exceed the similarity threshold
+  for (size_t i = 0; i < rows.size(); i++) {
+    const std::vector<SimilarityNeighbors::Neighbor> &rowNeighbors =
+      d->neighbors.neighbors(rows[i]);
+    size_t count = d->neighbors.neighborCount(rows[i], d->similarityThreshold);
+
+    for (size_t j = 0; j < count; j++) {
+      d->graph->AddEdge(static_cast<vtkIdType>(rows[i]),
+                        static_cast<vtkIdType>(rowNeighbors[j].index));
+      weights->InsertNextValue(rowNeighbors[j].similarity);
+    }
+  }
+
+  weights->Modified();
+
+  // restart the layout with the new edges
+  d->layoutStrategy->SetGraph(d->graph.GetPointer());
+  d->layoutStrategy->Initialize();
+  d->layoutGraphMutex.unlock();
+
+  renderGraph();
+}
+
+const SimilarityNeighbors& SimilarityGraphWidget::similarityNeighbors() const
+{
+  return d->neighbors;
 }
 
 void SimilarityGraphWidget::setSimilarityThreshold(float value)
@@ -126,15 +176,17 @@ void SimilarityGraphWidget::setSimilarityThreshold(float value)
   vtkNew<vtkFloatArray> weights;
   weights->SetName("weights");
 
-  // add edges that exceed similarity threshold
-  for (int i = 0; i < d->similarityMatrix.rows(); i++) {
-    for (int j = i + 1; j < d->similarityMatrix.cols(); j++) {
-      float similarity = d->similarityMatrix(i, j);
-
-      if (similarity > d->similarityThreshold) {
-        d->graph->AddEdge(i, j);
-        weights->InsertNextValue(similarity);
-      }
+  // add edges that exceed similarity threshold. the neighbors of each
+  // molecule are sorted by similarity so only those edges are visited.
+  for (size_t i = 0; i < d->neighbors.size(); i++) {
+    const std::vector<SimilarityNeighbors::Neighbor> &neighbors =
+      d->neighbors.neighbors(i);
+    size_t count = d->neighbors.neighborCount(i, d->similarityThreshold);
+
+    for (size_t j = 0; j < count; j++) {
+      d->graph->AddEdge(static_cast<vtkIdType>(i),
+                        static_cast<vtkIdType>(neighbors[j].index));
+      weights->InsertNextValue(neighbors[j].similarity);
     }
   }
 
@@ -182,9 +234,6 @@ void SimilarityGraphWidget::updateLayout()
   d->layoutGraphMutex.lock();
   d->layoutStrategy->Layout();
   d->layoutGraphMutex.unlock();
-
-  // render graph on next event loop
-  emit readyToRender();
 }
 
 void SimilarityGraphWidget::renderGraph()
@@ -192,8 +241,13 @@ void SimilarityGraphWidget::renderGraph()
   // render graph
   d->vtkWidget->update();
 
-  if (!d->layoutPaused && !d->layoutStrategy->IsLayoutComplete())
-    QtConcurrent::run(this, &SimilarityGraphWidget::updateLayout);
+  // only one layout runs at a time. the running one renders the graph and
+  // continues the layout when it finishes.
+  if (!d->layoutPaused && !d->layoutStrategy->IsLayoutComplete() &&
+      !d->layoutWatcher->isRunning()) {
+    d->layoutWatcher->setFuture(
+      QtConcurrent::run(this, &SimilarityGraphWidget::updateLayout));
+  }
 }
 
 void SimilarityGraphWidget::graphViewMouseEvent(QMouseEvent *event_)
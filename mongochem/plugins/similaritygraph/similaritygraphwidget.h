@@ -21,7 +21,7 @@
 
 #include <vtkType.h>
 
-#include <Eigen/Core>
+#include "similarityneighbors.h"
 
 class SimilarityGraphWidgetPrivate;
 
@@ -36,11 +36,22 @@ public:
   /** Destroys the similarity graph widget. */
   ~SimilarityGraphWidget();
 
-  /** Sets the similarity matrix. */
-  void setSimilarityMatrix(const Eigen::MatrixXf &matrix);
+  /**
+   * Sets the pairs of similar molecules. Thresholds below the cutoff of
+   * @p neighbors show the pairs above the cutoff.
+   */
+  void setSimilarityNeighbors(const SimilarityNeighbors &neighbors);
+
+  /**
+   * Sets the neighbors of each molecule in @p rows to the matching entry in
+   * @p neighbors. When the rows had no neighbors before, only their edges are
+   * added to the graph so rows can be shown as they are calculated.
+   */
+  void setSimilarityRows(const std::vector<size_t> &rows,
+                         const std::vector<std::vector<SimilarityNeighbors::Neighbor> > &neighbors);
 
-  /** Returns the similarity matrix. */
-  const Eigen::MatrixXf& similarityMatrix() const;
+  /** Returns the pairs of similar molecules. */
+  const SimilarityNeighbors& similarityNeighbors() const;
 
   /** Returns the similarity threshold. */
   float similarityThreshold() const;
@@ -59,8 +70,6 @@ public slots:
   void setSimilarityThreshold(float value);
 
 signals:
-  void readyToRender();
-
   /** This signal is emitted when a graph vertex is double clicked. */
   void vertexDoubleClicked(vtkIdType id);
 
@@ -0,0 +1,98 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "similarityneighbors.h"
+
+#include <algorithm>
+
+namespace {
+
+// Orders neighbors by decreasing similarity and then increasing index.
+bool moreSimilar(const SimilarityNeighbors::Neighbor &a,
+                 const SimilarityNeighbors::Neighbor &b)
+{
+  if (a.similarity != b.similarity)
+    return a.similarity > b.similarity;
+  return a.index < b.index;
+}
+
+// Returns true if @p neighbor is more similar than @p threshold.
+bool aboveThreshold(const SimilarityNeighbors::Neighbor &neighbor,
+                    float threshold)
+{
+  return neighbor.similarity > threshold;
+}
+
+} // end anonymous namespace
+
+SimilarityNeighbors::SimilarityNeighbors()
+  : m_cutoff(0)
+{
+}
+
+SimilarityNeighbors::SimilarityNeighbors(size_t size_, float cutoff_)
+  : m_cutoff(cutoff_),
+    m_rows(size_)
+{
+}
+
+size_t SimilarityNeighbors::size() const
+{
+  return m_rows.size();
+}
+
+float SimilarityNeighbors::cutoff() const
+{
+  return m_cutoff;
+}
+
+void SimilarityNeighbors::setRow(size_t row, const std::vector<Neighbor> &neighbors_)
+{
+  std::vector<Neighbor> kept;
+  for (size_t i = 0; i < neighbors_.size(); i++) {
+    const Neighbor &neighbor = neighbors_[i];
+    if (neighbor.index > row && neighbor.index < m_rows.size() &&
+        neighbor.similarity > m_cutoff)
+      kept.push_back(neighbor);
+  }
+
+  std::sort(kept.begin(), kept.end(), moreSimilar);
+  m_rows[row].swap(kept);
+}
+
+size_t SimilarityNeighbors::neighborCount(size_t row, float threshold) const
+{
+  // the neighbors above the threshold are a prefix of the row
+  const std::vector<Neighbor> &neighbors_ = m_rows[row];
+  std::vector<Neighbor>::const_iterator end =
+    std::lower_bound(neighbors_.begin(), neighbors_.end(), threshold,
+                     aboveThreshold);
+  return static_cast<size_t>(end - neighbors_.begin());
+}
+
+const std::vector<SimilarityNeighbors::Neighbor>&
+SimilarityNeighbors::neighbors(size_t row) const
+{
+  return m_rows[row];
+}
+
+size_t SimilarityNeighbors::pairCount() const
+{
+  size_t count = 0;
+  for (size_t i = 0; i < m_rows.size(); i++)
+    count += m_rows[i].size();
+  return count;
+}
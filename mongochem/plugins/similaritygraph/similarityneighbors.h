@@ -0,0 +1,85 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#ifndef SIMILARITYNEIGHBORS_H
+#define SIMILARITYNEIGHBORS_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * The SimilarityNeighbors class stores the pairs of similar molecules in a
+ * set as a sparse graph.
+ *
+ * Each pair is stored once, in the row of the molecule with the lower index,
+ * and only if its similarity is greater than the cutoff. The neighbors in
+ * each row are sorted by decreasing similarity so the neighbors above any
+ * threshold (not less than the cutoff) are found with a binary search.
+ */
+class SimilarityNeighbors
+{
+public:
+  /** A molecule similar to the molecule of a row. */
+  struct Neighbor
+  {
+    /** The index of the neighboring molecule. */
+    unsigned int index;
+
+    /** The similarity between the molecules. */
+    float similarity;
+  };
+
+  /** Creates a new, empty, set of neighbors. */
+  SimilarityNeighbors();
+
+  /**
+   * Creates a new set of neighbors for @p size molecules which keeps the
+   * pairs with a similarity greater than @p cutoff.
+   */
+  SimilarityNeighbors(size_t size, float cutoff);
+
+  /** Returns the number of molecules. */
+  size_t size() const;
+
+  /** Returns the similarity cutoff. */
+  float cutoff() const;
+
+  /**
+   * Sets the neighbors of @p row to @p neighbors. Only the neighbors with a
+   * greater index than @p row and a similarity greater than the cutoff are
+   * kept.
+   */
+  void setRow(size_t row, const std::vector<Neighbor> &neighbors);
+
+  /**
+   * Returns the number of neighbors of @p row with a similarity greater
+   * than @p threshold. These are the first neighbors returned by
+   * neighbors().
+   */
+  size_t neighborCount(size_t row, float threshold) const;
+
+  /** Returns the neighbors of @p row sorted by decreasing similarity. */
+  const std::vector<Neighbor>& neighbors(size_t row) const;
+
+  /** Returns the number of pairs stored. */
+  size_t pairCount() const;
+
+private:
+  float m_cutoff;
+  std::vector<std::vector<Neighbor> > m_rows;
+};
+
+#endif // SIMILARITYNEIGHBORS_H
@@ -15,21 +15,140 @@
 ******************************************************************************/
 
 #include "mongodatabase.h"
+#include "chemkit.h"
 
 #include "structuresimilaritydialog.h"
 #include "ui_structuresimilaritydialog.h"
 
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QTimer>
+#include <QtWidgets/QProgressDialog>
+
+#include <chemkit/molecule.h>
 #include <chemkit/structuresimilaritydescriptor.h>
 
+#include <algorithm>
+
 using namespace chemkit;
 
+namespace {
+
+// The lowest similarity (in percent) which can be shown. Only the pairs of
+// molecules above it are kept.
+const int minimumSimilarity = 20;
+
+// The number of molecules fetched and parsed by each task.
+const size_t parseBatchSize = 64;
+
+// The interval (in milliseconds) between adding the finished rows to the
+// graph. Adding each row on its own would restart the layout too often.
+const int publishInterval = 250;
+
+// A batch of molecules to be parsed on a single thread.
+struct ParseTask
+{
+  const QAtomicInt *currentGeneration;
+  int generation;
+  std::vector<MongoChem::MoleculeRef> molecules;
+  std::vector<size_t> positions;
+  std::vector<boost::shared_ptr<Molecule> > *parsed;
+};
+
+struct RunParseTask
+{
+  void operator()(ParseTask &task) const
+  {
+    if (task.currentGeneration->load() != task.generation)
+      return;
+
+    std::vector<mongo::BSONObj> objs =
+      MongoChem::MongoDatabase::instance()->fetchMolecules(
+        task.molecules, BSON("smiles" << 1 << "inchi" << 1));
+
+    for (size_t i = 0; i < objs.size(); i++) {
+      const mongo::BSONObj &obj = objs[i];
+
+      // molecules which could not be fetched are left null so that they are
+      // not cached and are fetched again by the next calculation
+      if (obj.isEmpty())
+        continue;
+
+      boost::shared_ptr<Molecule> molecule =
+        MongoChem::ChemKit::createMolecule(obj);
+      if (!molecule)
+        molecule.reset(new Molecule);
+
+      // perceive the rings now so the molecule is only read when it is
+      // shared between the threads comparing it
+      molecule->ringCount();
+
+      (*task.parsed)[task.positions[i]] = molecule;
+    }
+  }
+};
+
+// Compares one molecule to each of the molecules after it.
+struct RowTask
+{
+  StructureSimilarityDialog *dialog;
+  const QAtomicInt *currentGeneration;
+  int generation;
+  size_t row;
+  float cutoff;
+  const std::vector<boost::shared_ptr<Molecule> > *molecules;
+};
+
+struct RunRowTask
+{
+  void operator()(RowTask &task) const
+  {
+    if (task.currentGeneration->load() != task.generation)
+      return;
+
+    const std::vector<boost::shared_ptr<Molecule> > &molecules =
+      *task.molecules;
+    StructureSimilarityDescriptor descriptor;
+    descriptor.setMolecule(molecules[task.row]);
+
+    std::vector<SimilarityNeighbors::Neighbor> neighbors;
+    for (size_t j = task.row + 1; j < molecules.size(); j++) {
+      if (task.currentGeneration->load() != task.generation)
+        return;
+
+      float similarity = descriptor.value(molecules[j].get()).toFloat();
+      if (similarity > task.cutoff) {
+        SimilarityNeighbors::Neighbor neighbor;
+        neighbor.index = static_cast<unsigned int>(j);
+        neighbor.similarity = similarity;
+        neighbors.push_back(neighbor);
+      }
+    }
+
+    QMetaObject::invokeMethod(task.dialog, "addRow", Qt::QueuedConnection,
+                              Q_ARG(int, task.generation),
+                              Q_ARG(int, static_cast<int>(task.row)),
+                              Q_ARG(std::vector<SimilarityNeighbors::Neighbor>,
+                                    neighbors));
+  }
+};
+
+} // end anonymous namespace
+
 StructureSimilarityDialog::StructureSimilarityDialog(QWidget *parent_)
   : MongoChem::AbstractClusteringWidget(parent_),
-    ui(new Ui::StructureSimilarityDialog)
+    ui(new Ui::StructureSimilarityDialog),
+    m_generation(0),
+    m_finishedRows(0)
 {
+    qRegisterMetaType<std::vector<SimilarityNeighbors::Neighbor> >();
+
     ui->setupUi(this);
 
     m_graphWidget = new SimilarityGraphWidget(this);
+    ui->similaritySlider->setMinimum(minimumSimilarity);
+    ui->similaritySpinBox->setMinimum(minimumSimilarity);
     ui->similaritySlider->setValue(45);
     m_graphWidget->setSimilarityThreshold(
       static_cast<float>(ui->similaritySlider->value()) / 100.f);
@@ -40,41 +159,169 @@ StructureSimilarityDialog::StructureSimilarityDialog(QWidget *parent_)
     connect(ui->similaritySlider, SIGNAL(valueChanged(int)), ui->similaritySpinBox, SLOT(setValue(int)));
     connect(ui->similaritySpinBox, SIGNAL(valueChanged(int)), ui->similaritySlider, SLOT(setValue(int)));
     connect(ui->similaritySlider, SIGNAL(sliderReleased()), SLOT(similaritySliderReleased()));
+
+    m_progressDialog = new QProgressDialog(tr("Calculating Similarity"),
+                                           tr("Cancel"),
+                                           0,
+                                           0,
+                                           this);
+    m_progressDialog->setMinimumDuration(0);
+    m_progressDialog->reset();
+    connect(m_progressDialog, SIGNAL(canceled()), SLOT(cancel()));
+
+    m_publishTimer = new QTimer(this);
+    m_publishTimer->setSingleShot(true);
+    m_publishTimer->setInterval(publishInterval);
+    connect(m_publishTimer, SIGNAL(timeout()), SLOT(publishRows()));
 }
 
 StructureSimilarityDialog::~StructureSimilarityDialog()
 {
+    cancel();
+
+    // wait for the workers as they post their results to this object
+    foreach (QFuture<void> future, m_futures)
+      future.waitForFinished();
+
     delete ui;
 }
 
 void StructureSimilarityDialog::setMolecules(const std::vector<MongoChem::MoleculeRef> &molecules)
 {
-  MongoChem::MongoDatabase *db = MongoChem::MongoDatabase::instance();
+  cancel();
+
+  // forget the calculations which have already finished
+  QList<QFuture<void> > running;
+  foreach (QFuture<void> future, m_futures) {
+    if (!future.isFinished())
+      running.append(future);
+  }
+  m_futures = running;
 
   m_molecules = molecules;
 
-  // calculate similarity matrix
-  Eigen::MatrixXf similarityMatrix;
-  similarityMatrix.resize(m_molecules.size(), m_molecules.size());
+  // start with an empty graph which is filled in as the rows are finished
+  m_pendingRows.clear();
+  m_pendingNeighbors.clear();
+  m_graphWidget->setSimilarityNeighbors(
+    SimilarityNeighbors(m_molecules.size(), minimumSimilarity / 100.f));
 
-  for(size_t i = 0; i < m_molecules.size(); i++){
-    const MongoChem::MoleculeRef &refI = m_molecules[i];
-    boost::shared_ptr<Molecule> molecule = db->createMolecule(refI);
-    StructureSimilarityDescriptor descriptor;
-    descriptor.setMolecule(molecule);
+  if (m_molecules.empty())
+    return;
 
-    for(size_t j = i + 1; j < m_molecules.size(); j++){
-      const MongoChem::MoleculeRef &refJ = m_molecules[j];
-      boost::shared_ptr<Molecule> moleculeJ = db->createMolecule(refJ);
-      float similarity = descriptor.value(moleculeJ.get()).toFloat();
+  m_finishedRows = 0;
+  m_progressDialog->setRange(0, static_cast<int>(m_molecules.size()));
+  m_progressDialog->setValue(0);
+
+  int generation = m_generation.fetchAndAddOrdered(1) + 1;
+  m_futures.append(QtConcurrent::run(this, &StructureSimilarityDialog::run,
+                                     generation, m_molecules));
+}
+
+void StructureSimilarityDialog::cancel()
+{
+  m_generation.fetchAndAddOrdered(1);
+  m_progressDialog->reset();
 
-      similarityMatrix(i, j) = similarity;
-      similarityMatrix(j, i) = similarity;
+  // show the rows which were finished before canceling
+  publishRows();
+}
+
+void StructureSimilarityDialog::addRow(int generation, int row,
+                                       const std::vector<SimilarityNeighbors::Neighbor> &neighbors)
+{
+  if (generation != m_generation.load())
+    return;
+
+  m_pendingRows.push_back(static_cast<size_t>(row));
+  m_pendingNeighbors.push_back(neighbors);
+  if (!m_publishTimer->isActive())
+    m_publishTimer->start();
+
+  m_progressDialog->setValue(++m_finishedRows);
+}
+
+void StructureSimilarityDialog::publishRows()
+{
+  m_publishTimer->stop();
+  if (m_pendingRows.empty())
+    return;
+
+  m_graphWidget->setSimilarityRows(m_pendingRows, m_pendingNeighbors);
+  m_pendingRows.clear();
+  m_pendingNeighbors.clear();
+}
+
+void StructureSimilarityDialog::similarityFinished(int generation)
+{
+  if (generation != m_generation.load())
+    return;
+
+  m_progressDialog->reset();
+  publishRows();
+}
+
+void StructureSimilarityDialog::run(int generation,
+                                    const std::vector<MongoChem::MoleculeRef> &refs)
+{
+  // use the molecules parsed by earlier calculations where possible
+  std::vector<boost::shared_ptr<Molecule> > molecules(refs.size());
+  std::vector<ParseTask> parseTasks;
+  {
+    QMutexLocker locker(&m_moleculeCacheMutex);
+    for (size_t i = 0; i < refs.size(); i++) {
+      std::map<std::string, boost::shared_ptr<Molecule> >::const_iterator iter =
+        m_moleculeCache.find(refs[i].id());
+      if (iter != m_moleculeCache.end()) {
+        molecules[i] = iter->second;
+        continue;
+      }
+
+      if (parseTasks.empty() ||
+          parseTasks.back().molecules.size() >= parseBatchSize) {
+        ParseTask task;
+        task.currentGeneration = &m_generation;
+        task.generation = generation;
+        task.parsed = &molecules;
+        parseTasks.push_back(task);
+      }
+      parseTasks.back().molecules.push_back(refs[i]);
+      parseTasks.back().positions.push_back(i);
+    }
+  }
+
+  // fetch and parse each of the remaining molecules once
+  QtConcurrent::blockingMap(parseTasks, RunParseTask());
+  if (m_generation.load() != generation)
+    return;
+
+  {
+    QMutexLocker locker(&m_moleculeCacheMutex);
+    for (size_t i = 0; i < refs.size(); i++) {
+      if (molecules[i])
+        m_moleculeCache[refs[i].id()] = molecules[i];
+      else
+        molecules[i].reset(new Molecule);
     }
   }
 
-  // recalculate graph
-  m_graphWidget->setSimilarityMatrix(similarityMatrix);
+  // compare the molecules of each row to the molecules after it
+  std::vector<RowTask> rowTasks;
+  for (size_t i = 0; i < refs.size(); i++) {
+    RowTask task;
+    task.dialog = this;
+    task.currentGeneration = &m_generation;
+    task.generation = generation;
+    task.row = i;
+    task.cutoff = minimumSimilarity / 100.f;
+    task.molecules = &molecules;
+    rowTasks.push_back(task);
+  }
+
+  QtConcurrent::blockingMap(rowTasks, RunRowTask());
+
+  QMetaObject::invokeMethod(this, "similarityFinished", Qt::QueuedConnection,
+                            Q_ARG(int, generation));
 }
 
 void StructureSimilarityDialog::similaritySliderPressed()
@@ -21,6 +21,25 @@
 
 #include "similaritygraphwidget.h"
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QFuture>
+#include <QtCore/QList>
+#include <QtCore/QMetaType>
+#include <QtCore/QMutex>
+
+#include <boost/shared_ptr.hpp>
+
+#include <map>
+#include <string>
+#include <vector>
+
+class QProgressDialog;
+class QTimer;
+
+namespace chemkit {
+class Molecule;
+}
+
 namespace Ui {
 class StructureSimilarityDialog;
 }
@@ -37,17 +56,51 @@ public:
   ~StructureSimilarityDialog();
 
   /// Sets the molecules to display in the graph.
+  ///
+  /// The similarity of each pair is calculated on worker threads and the
+  /// rows are added to the graph as they are finished. Any calculation
+  /// already running is canceled.
   void setMolecules(const std::vector<MongoChem::MoleculeRef> &molecules);
 
+public slots:
+  /// Cancels the similarity calculation. The pairs already calculated are
+  /// still shown.
+  void cancel();
+
 private slots:
   void similaritySliderPressed();
   void similaritySliderReleased();
   void similarityValueChanged(int value);
+  void addRow(int generation, int row,
+              const std::vector<SimilarityNeighbors::Neighbor> &neighbors);
+  void publishRows();
+  void similarityFinished(int generation);
 
 private:
+  /// Calculates the similarity of each pair of @p molecules on a worker
+  /// thread.
+  void run(int generation, const std::vector<MongoChem::MoleculeRef> &molecules);
+
   Ui::StructureSimilarityDialog *ui;
   SimilarityGraphWidget *m_graphWidget;
+  QProgressDialog *m_progressDialog;
   std::vector<MongoChem::MoleculeRef> m_molecules;
+
+  // the molecules parsed by earlier calculations, keyed by their id
+  QMutex m_moleculeCacheMutex;
+  std::map<std::string, boost::shared_ptr<chemkit::Molecule> > m_moleculeCache;
+
+  // incremented each time a calculation is started or canceled
+  QAtomicInt m_generation;
+  QList<QFuture<void> > m_futures;
+  int m_finishedRows;
+
+  // the rows finished since the graph was last updated
+  QTimer *m_publishTimer;
+  std::vector<size_t> m_pendingRows;
+  std::vector<std::vector<SimilarityNeighbors::Neighbor> > m_pendingNeighbors;
 };
 
+Q_DECLARE_METATYPE(std::vector<SimilarityNeighbors::Neighbor>)
+
 #endif // STRUCTURESIMILARITYDIALOG_H
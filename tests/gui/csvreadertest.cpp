@@ -0,0 +1,122 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "csvreadertest.h"
+
+#include "csvreader.h"
+
+#include <QtTest>
+#include <QtCore/QTemporaryFile>
+
+using MongoChem::CsvReader;
+
+void CsvReaderTest::parseRecord()
+{
+  std::vector<std::string> fields;
+
+  const char plain[] = "a,b,,c\r\nnext";
+  const char *end = plain + sizeof(plain) - 1;
+  const char *next = CsvReader::parseRecord(plain, end, ',', fields);
+  QCOMPARE(fields.size(), size_t(4));
+  QCOMPARE(fields[0], std::string("a"));
+  QCOMPARE(fields[2], std::string(""));
+  QCOMPARE(fields[3], std::string("c"));
+  QCOMPARE(std::string(next), std::string("next"));
+
+  const char quoted[] = "\"a,b\",\"say \"\"hi\"\"\",\"two\nlines\"";
+  end = quoted + sizeof(quoted) - 1;
+  next = CsvReader::parseRecord(quoted, end, ',', fields);
+  QCOMPARE(fields.size(), size_t(3));
+  QCOMPARE(fields[0], std::string("a,b"));
+  QCOMPARE(fields[1], std::string("say \"hi\""));
+  QCOMPARE(fields[2], std::string("two\nlines"));
+  QVERIFY(next == end);
+}
+
+void CsvReaderTest::readRecord()
+{
+  QTemporaryFile file;
+  QVERIFY(file.open());
+  file.write("name|value\n\n\"x|y\"|1\n");
+  file.close();
+
+  CsvReader reader;
+  reader.setDelimiter('|');
+  QVERIFY(reader.open(file.fileName()));
+
+  std::vector<std::string> fields;
+  QVERIFY(reader.readRecord(fields));
+  QCOMPARE(fields.size(), size_t(2));
+  QCOMPARE(fields[0], std::string("name"));
+
+  // the empty record is skipped
+  QVERIFY(reader.readRecord(fields));
+  QCOMPARE(fields[0], std::string("x|y"));
+  QCOMPARE(fields[1], std::string("1"));
+
+  QVERIFY(!reader.readRecord(fields));
+  QVERIFY(reader.atEnd());
+}
+
+void CsvReaderTest::readBlock()
+{
+  QTemporaryFile file;
+  QVERIFY(file.open());
+  const int rowCount = 10000;
+  for (int i = 0; i < rowCount; i++)
+    file.write(QString("\"C%1\nO\",%1,,%2\r\n").arg(i).arg(i * 0.5).toLatin1());
+  file.write("last,-1,,");
+  file.close();
+
+  CsvReader reader;
+  QVERIFY(reader.open(file.fileName()));
+
+  std::vector<CsvReader::ColumnType> types;
+  types.push_back(CsvReader::String);
+  types.push_back(CsvReader::Number);
+  types.push_back(CsvReader::Ignored);
+  types.push_back(CsvReader::Number);
+  reader.setColumnTypes(types);
+
+  // small blocks are split at record boundaries
+  reader.setBlockSize(1000);
+
+  std::vector<std::string> names;
+  std::vector<double> values;
+  std::vector<double> halves;
+  CsvReader::Block block;
+  while (reader.readBlock(block)) {
+    QCOMPARE(block.strings[0].size(), block.rowCount);
+    QVERIFY(block.strings[1].empty());
+    QVERIFY(block.numbers[2].empty());
+    names.insert(names.end(), block.strings[0].begin(), block.strings[0].end());
+    values.insert(values.end(), block.numbers[1].begin(), block.numbers[1].end());
+    halves.insert(halves.end(), block.numbers[3].begin(), block.numbers[3].end());
+  }
+
+  QCOMPARE(names.size(), size_t(rowCount + 1));
+  for (int i = 0; i < rowCount; i++) {
+    QCOMPARE(names[i], QString("C%1\nO").arg(i).toStdString());
+    QCOMPARE(values[i], double(i));
+    QCOMPARE(halves[i], i * 0.5);
+  }
+
+  QCOMPARE(names[rowCount], std::string("last"));
+  QCOMPARE(values[rowCount], -1.0);
+  QVERIFY(qIsNaN(halves[rowCount]));
+}
+
+QTEST_MAIN(CsvReaderTest)
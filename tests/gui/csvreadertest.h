@@ -0,0 +1,34 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include <QtCore/QObject>
+
+class CsvReaderTest : public QObject
+{
+  Q_OBJECT
+public:
+  CsvReaderTest()
+    : QObject(NULL)
+  {
+
+  }
+
+private slots:
+  void parseRecord();
+  void readRecord();
+  void readBlock();
+
+};
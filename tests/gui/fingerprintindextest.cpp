@@ -0,0 +1,223 @@
+/******************************************************************************
+
+  This source file is part of the MongoChem project.
+
+  Copyright 2013 Kitware, Inc.
+
+  This source code is released under the New BSD License, (the "License").
+
+  Unless required by applicable law or agreed to in writing, software
+  distributed under the License is distributed on an "AS IS" BASIS,
+  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+  See the License for the specific language governing permissions and
+  limitations under the License.
+
+******************************************************************************/
+
+#include "fingerprintindextest.h"
+
+#include "fingerprintindex.h"
+
+#include <QtTest>
+
+#include <algorithm>
+#include <cstdlib>
+
+using MongoChem::FingerprintIndex;
+using MongoChem::MoleculeRef;
+
+namespace {
+
+// The number of fingerprints in the test index. This is enough for the
+// index to be scored by more than one thread.
+const size_t fingerprintCount = 40000;
+
+// The size of the test fingerprints, which is not a multiple of 64.
+const size_t bitCount = 1021;
+
+mongo::OID testId(size_t i)
+{
+  return mongo::OID(QString("%1").arg(i, 24, 16, QChar('0')).toStdString());
+}
+
+chemkit::Bitset randomFingerprint()
+{
+  // vary the density so the bound on the similarity prunes some of them
+  chemkit::Bitset fingerprint(bitCount);
+  int density = rand() % 300 + 1;
+  for (size_t i = 0; i < bitCount; i++) {
+    if (rand() % 1000 < density)
+      fingerprint.set(i);
+  }
+  return fingerprint;
+}
+
+float tanimoto(const chemkit::Bitset &a, const chemkit::Bitset &b)
+{
+  size_t total = (a | b).count();
+  return total > 0 ? static_cast<float>((a & b).count()) / total : 0.0f;
+}
+
+struct Expected
+{
+  float similarity;
+  size_t index;
+
+  bool operator<(const Expected &other) const
+  {
+    if (similarity != other.similarity)
+      return similarity > other.similarity;
+    return index < other.index;
+  }
+};
+
+// Builds an index of random fingerprints.
+void buildIndex(FingerprintIndex &index,
+                std::vector<chemkit::Bitset> &fingerprints)
+{
+  srand(1);
+  fingerprints.resize(fingerprintCount);
+  for (size_t i = 0; i < fingerprintCount; i++) {
+    fingerprints[i] = randomFingerprint();
+    index.insert(testId(i), fingerprints[i]);
+  }
+}
+
+// Returns the @p count fingerprints at @p indices most similar to @p query.
+std::vector<Expected> bruteForce(const std::vector<chemkit::Bitset> &fingerprints,
+                                 const std::vector<size_t> &indices,
+                                 const chemkit::Bitset &query,
+                                 size_t count)
+{
+  std::vector<Expected> expected;
+  for (size_t i = 0; i < indices.size(); i++) {
+    Expected e;
+    e.similarity = tanimoto(query, fingerprints[indices[i]]);
+    e.index = indices[i];
+    expected.push_back(e);
+  }
+
+  std::sort(expected.begin(), expected.end());
+  expected.resize(std::min(count, expected.size()));
+  return expected;
+}
+
+void compare(const std::vector<FingerprintIndex::Match> &matches,
+             const std::vector<Expected> &expected)
+{
+  QCOMPARE(matches.size(), expected.size());
+  for (size_t i = 0; i < matches.size(); i++) {
+    QCOMPARE(matches[i].molecule.id(), testId(expected[i].index).str());
+    QCOMPARE(matches[i].similarity, expected[i].similarity);
+  }
+}
+
+} // end anonymous namespace
+
+void FingerprintIndexTest::search()
+{
+  FingerprintIndex index("test");
+  std::vector<chemkit::Bitset> fingerprints;
+  buildIndex(index, fingerprints);
+  QCOMPARE(index.size(), fingerprintCount);
+
+  std::vector<size_t> all(fingerprintCount);
+  for (size_t i = 0; i < fingerprintCount; i++)
+    all[i] = i;
+
+  for (int i = 0; i < 5; i++) {
+    chemkit::Bitset query = randomFingerprint();
+    compare(index.search(query, 25), bruteForce(fingerprints, all, query, 25));
+  }
+
+  // a molecule in the index is its own best match
+  std::vector<FingerprintIndex::Match> matches =
+    index.search(fingerprints[42], 1);
+  QCOMPARE(matches.size(), size_t(1));
+  QCOMPARE(matches[0].molecule.id(), testId(42).str());
+  QCOMPARE(matches[0].similarity, 1.0f);
+
+  QVERIFY(index.search(fingerprints[0], 0).empty());
+  QCOMPARE(index.search(fingerprints[0], fingerprintCount * 2).size(),
+           fingerprintCount);
+}
+
+void FingerprintIndexTest::searchMolecules()
+{
+  FingerprintIndex index("test");
+  std::vector<chemkit::Bitset> fingerprints;
+  buildIndex(index, fingerprints);
+
+  std::vector<size_t> subset;
+  std::vector<MoleculeRef> molecules;
+  for (size_t i = 0; i < fingerprintCount; i += 3) {
+    subset.push_back(i);
+    molecules.push_back(MoleculeRef(testId(i).str()));
+  }
+
+  // molecules which are not in the index are ignored
+  molecules.push_back(MoleculeRef(testId(fingerprintCount).str()));
+  molecules.push_back(MoleculeRef());
+
+  chemkit::Bitset query = randomFingerprint();
+  compare(index.search(query, molecules, 10),
+          bruteForce(fingerprints, subset, query, 10));
+}
+
+void FingerprintIndexTest::screen()
+{
+  FingerprintIndex index("test");
+  std::vector<chemkit::Bitset> fingerprints;
+  buildIndex(index, fingerprints);
+
+  chemkit::Bitset query(bitCount);
+  query.set(3);
+  query.set(500);
+  query.set(bitCount - 1);
+
+  std::vector<std::string> expected;
+  for (size_t i = 0; i < fingerprintCount; i++) {
+    if (query.is_subset_of(fingerprints[i]))
+      expected.push_back(testId(i).str());
+  }
+
+  std::vector<MoleculeRef> molecules = index.screen(query);
+  std::vector<std::string> screened;
+  for (size_t i = 0; i < molecules.size(); i++)
+    screened.push_back(molecules[i].id());
+  std::sort(screened.begin(), screened.end());
+
+  QVERIFY(!expected.empty());
+  QVERIFY(screened == expected);
+}
+
+void FingerprintIndexTest::insert()
+{
+  FingerprintIndex index("test");
+
+  chemkit::Bitset first(bitCount);
+  first.set(1);
+  chemkit::Bitset second(bitCount);
+  second.set(2);
+
+  index.insert(testId(2), second);
+  index.insert(testId(1), first);
+  QCOMPARE(index.size(), size_t(2));
+
+  // inserting an existing molecule replaces its fingerprint
+  index.insert(testId(2), first);
+  QCOMPARE(index.size(), size_t(2));
+
+  std::vector<FingerprintIndex::Match> matches = index.search(first, 2);
+  QCOMPARE(matches.size(), size_t(2));
+  QCOMPARE(matches[0].molecule.id(), testId(1).str());
+  QCOMPARE(matches[0].similarity, 1.0f);
+  QCOMPARE(matches[1].molecule.id(), testId(2).str());
+  QCOMPARE(matches[1].similarity, 1.0f);
+
+  index.clear();
+  QCOMPARE(index.size(), size_t(0));
+  QVERIFY(index.search(first, 1).empty());
+}
+
+QTEST_MAIN(FingerprintIndexTest)